@@ -0,0 +1,82 @@
+// Tunes the blocking parameters of the multiply kernel for this host,
+// calibrates the cost model that picks a multiply algorithm, and saves both to
+// its tuning profile, which MXL loads on its first multiply.
+//
+// Usage: Autotune [--types float,double,int,long] [--size 384]
+//                 [--min-time seconds] [--output profile.txt] [--verbose on]
+//                 [--model off]
+//
+// The profile goes to mxl::tuning_profile_path() unless --output is given
+// (point MXL_TUNING_PROFILE at such a file to use it).
+#include <iostream>
+#include <mxl/autotune.hpp>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+vector<string> split(const string& s) {
+    vector<string> parts;
+    stringstream ss(s);
+    for (string part; getline(ss, part, ',');)
+        parts.push_back(part);
+    return parts;
+}
+
+template <typename T>
+void tune(const string& type, const mxl::autotune_options& opts, bool verbose, bool model) {
+    mxl::blocking before = mxl::get_blocking<T>();
+    mxl::blocking after = mxl::autotune<T>(opts, verbose ? &cerr : nullptr);
+    cout << type << ": mc=" << after.mc << " kc=" << after.kc << " nc=" << after.nc << " mr=" << after.mr
+         << " nr=" << after.nr << (after == before ? " (unchanged)" : "") << "\n";
+    if (model) {
+        // Calibrated after the blocking, so blocked_ns is for the new blocks.
+        mxl::multiply_cost_model cm = mxl::calibrate_cost_model<T>(opts);
+        cout << type << ": naive " << cm.naive_ns << " ns, unrolled " << cm.unrolled_ns << " ns, gemv "
+             << cm.gemv_ns << " ns, blocked " << cm.blocked_ns << " ns per multiply-add\n";
+    }
+}
+
+int main(int argc, char** argv) {
+    vector<string> types = {"float", "double", "int", "long"};
+    mxl::autotune_options opts;
+    string output = mxl::tuning_profile_path();
+    bool verbose = false, model = true;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        string flag = argv[i], value = argv[i + 1];
+        if (flag == "--types")
+            types = split(value);
+        else if (flag == "--size")
+            opts.size = stoull(value);
+        else if (flag == "--min-time")
+            opts.min_time = stod(value);
+        else if (flag == "--output")
+            output = value;
+        else if (flag == "--verbose")
+            verbose = value == "on";
+        else if (flag == "--model")
+            model = value != "off";
+        else {
+            cerr << "Unknown option " << flag << "\n";
+            return 1;
+        }
+    }
+
+    mxl::cache_sizes caches = mxl::detect_cache_sizes();
+    cout << "caches: L1d " << (caches.l1d >> 10) << " KiB, L2 " << (caches.l2 >> 10) << " KiB, L3 "
+         << (caches.l3 >> 10) << " KiB\n";
+    for (const string& t: types) {
+        if (t == "int") tune<int>(t, opts, verbose, model);
+        else if (t == "long") tune<long>(t, opts, verbose, model);
+        else if (t == "float") tune<float>(t, opts, verbose, model);
+        else if (t == "double") tune<double>(t, opts, verbose, model);
+        else {
+            cerr << "Unknown type " << t << "\n";
+            return 1;
+        }
+    }
+
+    mxl::save_tuning_profile(output);
+    cout << "saved " << output << "\n";
+}
@@ -0,0 +1,231 @@
+// Benchmarks the core matrix operations over a sweep of sizes, element types
+// and operand layouts, and prints the results as JSON so that runs from
+// different releases can be compared.
+//
+// Usage: Bench [--sizes 64,256,1024] [--types int,long,float,double]
+//              [--filter name] [--min-time seconds] [--output file.json]
+//              [--perf on]
+//
+// Each record holds the operation, type, shape and layout ("N" for row-major
+// operands, "T" for transposed ones), the time per operation, and the rates
+// in GFLOP/s and GB/s. Bytes count the minimum traffic: every operand read
+// once and the result written once.
+//
+// With --perf on, each record also holds hardware counters per operation
+// (cycles, instructions, IPC, cache and branch misses) for all threads, from
+// one extra timed batch. Counters the machine does not provide are left out.
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <mxl/mxl.hpp>
+#include <mxl/packed.hpp>
+#include <mxl/perf.hpp>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+using mxl::matrix;
+
+struct options {
+    vector<size_t> sizes = {64, 256, 1024};
+    vector<string> types = {"int", "long", "float", "double"};
+    string filter;
+    double min_time = 0.2;
+    string output;
+    bool perf = false;
+};
+
+struct result {
+    string name, type, layout;
+    size_t rows, cols, iterations;
+    double ns_per_op, gflops, gbps;
+    mxl::perf_sample counters;  // per operation
+};
+
+// Keeps the compiler from discarding benchmarked work.
+volatile double sink;
+
+// Times op, in batches that double in size until one takes min_time, and
+// returns the fastest time per call in nanoseconds.
+double time_op(const function<void()>& op, double min_time, size_t& iterations) {
+    op();  // warm up caches and the thread pool
+    double best = 1e300;
+    iterations = 0;
+    for (size_t batch = 1;; batch *= 2) {
+        auto start = chrono::steady_clock::now();
+        for (size_t i = 0; i != batch; i++)
+            op();
+        chrono::duration<double> secs = chrono::steady_clock::now() - start;
+        iterations += batch;
+        best = min(best, secs.count() * 1e9 / batch);
+        if (secs.count() >= min_time)
+            return best;
+    }
+}
+
+// A square n x n matrix of small values in the given layout.
+template <typename T>
+matrix<T> operand(size_t n, char layout, uint64_t seed) {
+    matrix<T> mat(n, n, mxl::uniform(-4, 4), seed);
+    if (layout == 'T') {
+        // Same shape, stored column after column.
+        mat = matrix<T>(n, n, vector<T>(mat.begin(), mat.end()));
+        mat.transpose();
+    }
+    return mat;
+}
+
+template <typename T>
+void run_type(const string& type, const options& opts, vector<result>& out) {
+    auto bench = [&](const string& name, size_t n, const string& layout, double flops, double bytes,
+                     const function<void()>& op) {
+        if (!opts.filter.empty() && name.find(opts.filter) == string::npos)
+            return;
+        result r{name, type, layout, n, n, 0, 0, 0, 0, {}};
+        r.ns_per_op = time_op(op, opts.min_time, r.iterations);
+        r.gflops = flops / r.ns_per_op;
+        r.gbps = bytes / r.ns_per_op;
+        if (opts.perf) {
+            // Count all threads, over a batch of about min_time.
+            size_t batch = max<size_t>(1, r.iterations / 2);
+            mxl::perf_sample total = mxl::measure([&] {
+                for (size_t i = 0; i != batch; i++)
+                    op();
+            }, mxl::perf_scope::process);
+            r.counters = total;
+            for (uint64_t& v: r.counters.values)
+                v /= batch;
+        }
+        out.push_back(r);
+        cerr << name << " " << type << " " << n << " " << layout << ": " << r.ns_per_op << " ns\n";
+    };
+    const string layouts[] = {"NN", "NT", "TN", "TT"};
+
+    for (size_t n: opts.sizes) {
+        const double elems = double(n) * n, bytes = elems * sizeof(T);
+        for (const string& l: layouts) {
+            matrix<T> a = operand<T>(n, l[0], 1), b = operand<T>(n, l[1], 2);
+            if (n <= 512) {
+                bench("multiply", n, l, 2 * elems * n, 3 * bytes, [&] { sink = (a * b)(0, 0); });
+                // The right operand packed once, outside the timed loop.
+                mxl::packed_matrix<T> packed(b);
+                bench("multiply_packed", n, l, 2 * elems * n, 3 * bytes, [&] { sink = (a * packed)(0, 0); });
+            }
+            bench("add", n, l, elems, 3 * bytes, [&] { sink = (a + b)(0, 0); });
+        }
+        for (char l: {'N', 'T'}) {
+            matrix<T> a = operand<T>(n, l, 1);
+            bench("scalar_multiply", n, string(1, l), elems, 2 * bytes, [&] { a *= T(1); sink = a(0, 0); });
+            bench("transpose_copy", n, string(1, l), 0, 2 * bytes, [&] { sink = a.transpose_copy()(0, 0); });
+            if (n <= 256)
+                bench("to_string", n, string(1, l), 0, bytes, [&] { sink = double(a.to_string().size()); });
+        }
+
+        vector<T> flat(n * n, T(1));
+        vector<vector<T>> rows(n, vector<T>(n, T(1)));
+        bench("construct_value", n, "N", 0, bytes, [&] { sink = matrix<T>(n, n, T(3))(0, 0); });
+        bench("construct_identity", n, "N", 0, bytes, [&] { sink = matrix<T>(n, n, mxl::identity)(0, 0); });
+        bench("construct_random", n, "N", 0, bytes, [&] {
+            sink = matrix<T>(n, n, mxl::uniform(0, 1))(0, 0);
+        });
+        bench("construct_vector", n, "N", 0, 2 * bytes, [&] { sink = matrix<T>(n, n, flat)(0, 0); });
+        bench("construct_2d_vector", n, "N", 0, 2 * bytes, [&] { sink = matrix<T>(rows)(0, 0); });
+    }
+}
+
+#ifndef MXL_BUILD_TYPE
+#define MXL_BUILD_TYPE "unknown"
+#define MXL_BUILD_FLAGS ""
+#endif
+
+string compiler() {
+#ifdef __VERSION__
+    return __VERSION__;
+#else
+    return "unknown";
+#endif
+}
+
+vector<string> split(const string& s) {
+    vector<string> parts;
+    stringstream ss(s);
+    for (string part; getline(ss, part, ',');)
+        parts.push_back(part);
+    return parts;
+}
+
+int main(int argc, char** argv) {
+    options opts;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        string flag = argv[i], value = argv[i + 1];
+        if (flag == "--sizes") {
+            opts.sizes.clear();
+            for (const string& s: split(value))
+                opts.sizes.push_back(stoull(s));
+        } else if (flag == "--types")
+            opts.types = split(value);
+        else if (flag == "--filter")
+            opts.filter = value;
+        else if (flag == "--min-time")
+            opts.min_time = stod(value);
+        else if (flag == "--output")
+            opts.output = value;
+        else if (flag == "--perf")
+            opts.perf = value == "on";
+        else {
+            cerr << "Unknown option " << flag << "\n";
+            return 1;
+        }
+    }
+
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(__OPTIMIZE__)
+    cerr << "Warning: Bench was built without optimization; do not publish these numbers\n";
+#endif
+    if (opts.perf) {
+        mxl::perf_counters probe;
+        if (!probe.hardware_available())
+            cerr << "Hardware counters unavailable (" << probe.error() << "); recording software counters only\n";
+    }
+
+    vector<result> results;
+    for (const string& t: opts.types) {
+        if (t == "int") run_type<int>(t, opts, results);
+        else if (t == "long") run_type<long>(t, opts, results);
+        else if (t == "float") run_type<float>(t, opts, results);
+        else if (t == "double") run_type<double>(t, opts, results);
+        else {
+            cerr << "Unknown type " << t << "\n";
+            return 1;
+        }
+    }
+
+    ostringstream json;
+    json << "{\n  \"context\": {\"threads\": " << mxl::current_context().threads
+         << ", \"compiler\": \"" << compiler() << "\", \"build\": \"" << MXL_BUILD_TYPE
+         << "\", \"flags\": \"" << MXL_BUILD_FLAGS << "\", \"min_time\": " << opts.min_time << "},\n"
+         << "  \"benchmarks\": [";
+    for (size_t i = 0; i != results.size(); i++) {
+        const result& r = results[i];
+        json << (i ? "," : "") << "\n    {\"name\": \"" << r.name << "\", \"type\": \"" << r.type
+             << "\", \"rows\": " << r.rows << ", \"cols\": " << r.cols << ", \"layout\": \"" << r.layout
+             << "\", \"iterations\": " << r.iterations << ", \"ns_per_op\": " << r.ns_per_op
+             << ", \"gflops\": " << r.gflops << ", \"gbps\": " << r.gbps;
+        for (mxl::perf_event e: {mxl::perf_event::cycles, mxl::perf_event::instructions,
+                                 mxl::perf_event::cache_misses, mxl::perf_event::branch_misses,
+                                 mxl::perf_event::page_faults})
+            if (r.counters.has(e))
+                json << ", \"" << mxl::perf_event_name(e) << "\": " << r.counters[e];
+        if (r.counters.ipc())
+            json << ", \"ipc\": " << r.counters.ipc();
+        json << "}";
+    }
+    json << "\n  ]\n}\n";
+
+    if (opts.output.empty())
+        cout << json.str();
+    else
+        ofstream(opts.output) << json.str();
+}
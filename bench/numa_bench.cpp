@@ -0,0 +1,60 @@
+// Measures the memory bandwidth of the element-wise kernels when a matrix's
+// pages are first touched by one thread versus in parallel, with and without
+// pinned worker threads. On a multi-socket machine the parallel, pinned runs
+// should be the fastest; on a single socket all four should be close.
+//
+// Usage: NumaBench [elements] [repetitions]
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mxl/mxl.hpp>
+
+using namespace std;
+using mxl::matrix;
+
+// Returns the best bandwidth of reps runs of op, in GB/s.
+template <typename F>
+double best_bandwidth(F op, double bytes, int reps) {
+    double best = 0;
+    for (int r = 0; r != reps; r++) {
+        auto start = chrono::steady_clock::now();
+        op();
+        chrono::duration<double> secs = chrono::steady_clock::now() - start;
+        best = max(best, bytes / secs.count() / 1e9);
+    }
+    return best;
+}
+
+int main(int argc, char** argv) {
+    size_t elements = argc > 1 ? strtoull(argv[1], nullptr, 10) : size_t(1) << 25;
+    int reps = argc > 2 ? atoi(argv[2]) : 5;
+    const size_t cols = 1024, rows = max<size_t>(1, elements / cols);
+    const double bytes = double(rows * cols * sizeof(double));
+
+    string nodes = "unknown";
+    ifstream("/sys/devices/system/node/online") >> nodes;
+    size_t workers = max(1u, thread::hardware_concurrency()) - 1;
+    cout << "matrix: " << rows << " x " << cols << " doubles (" << bytes / (1 << 20) << " MiB)\n"
+         << "threads: " << workers + 1 << ", NUMA nodes online: " << nodes << "\n\n"
+         << left << setw(10) << "touch" << setw(8) << "pinned" << right << setw(14) << "a += b GB/s"
+         << setw(14) << "a *= 2 GB/s" << "\n";
+
+    mxl::context serial(make_shared<mxl::thread_pool>(0));
+    for (bool pin: {false, true})
+        for (bool parallel: {false, true}) {
+            mxl::context ctx(make_shared<mxl::thread_pool>(workers, pin));
+            matrix<double> a, b;
+            {
+                mxl::context_scope scope(parallel ? ctx : serial);
+                a = matrix<double>(rows, cols, 1.0);
+                b = matrix<double>(rows, cols, 2.0);
+            }
+            // a += b reads a and b and writes a; a *= 2 reads and writes a.
+            double add = best_bandwidth([&] { a.add_assign(b, ctx); }, 3 * bytes, reps);
+            double scale = best_bandwidth([&] { a.multiply_assign(2.0, ctx); }, 2 * bytes, reps);
+            cout << left << setw(10) << (parallel ? "parallel" : "serial") << setw(8) << (pin ? "yes" : "no")
+                 << right << fixed << setprecision(2) << setw(14) << add << setw(14) << scale << "\n";
+        }
+}
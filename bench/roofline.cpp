@@ -0,0 +1,230 @@
+// Places the operations measured by Bench on a roofline of this machine.
+//
+// Usage: Bench --output results.json
+//        Roofline --input results.json [--csv roofline.csv] [--elements N]
+//                 [--min-time seconds]
+//
+// Roofline first measures the two ceilings with as many threads as Bench
+// used: peak arithmetic throughput per element type, from a multiply-add loop
+// over independent accumulators, and memory bandwidth, from a STREAM-like
+// triad over arrays much larger than the caches. It then reads each Bench
+// record, computes its arithmetic intensity (FLOPs per byte of minimum
+// traffic) and the ceiling at that intensity, min(peak, intensity *
+// bandwidth), and reports whether the operation is memory- or compute-bound
+// and what fraction of its ceiling it reaches. Operations without arithmetic
+// (copies, transposes, constructors) are compared with the bandwidth alone,
+// so their ceiling is in GB/s rather than GOP/s. Operands that fit in cache
+// can exceed the memory ceiling, which is measured from DRAM.
+//
+// The peak loop is built with the same flags as Bench (an optimized build and
+// any MXL_MARCH), so the peaks are for the instruction set the library was
+// compiled for, not the best the hardware could do with other flags.
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+struct options {
+    string input = "-";
+    string csv;
+    size_t elements = size_t(1) << 23;
+    double min_time = 0.2;
+};
+
+// A Bench record, with the fields the roofline needs.
+struct record {
+    string name, type, layout;
+    size_t rows = 0, cols = 0;
+    double gflops = 0, gbps = 0;
+};
+
+// Keeps the compiler from discarding measured work.
+volatile double sink;
+
+// Runs body(t) on threads threads at once and returns the wall time.
+template <typename F>
+double run_threads(size_t threads, F body) {
+    vector<thread> pool;
+    auto start = chrono::steady_clock::now();
+    for (size_t t = 1; t < threads; t++)
+        pool.emplace_back(body, t);
+    body(size_t(0));
+    for (thread& th: pool)
+        th.join();
+    chrono::duration<double> secs = chrono::steady_clock::now() - start;
+    return secs.count();
+}
+
+// Returns the peak multiply-add throughput for T in GFLOP/s.
+template <typename T>
+double peak_gflops(size_t threads, double min_time) {
+    const size_t lanes = 32;
+    // Loaded through volatiles so that acc * one + zero cannot be folded, and
+    // never changes acc, so integers do not overflow and floats stay normal.
+    volatile T vone = T(1), vzero = T(0);
+    double best = 0;
+    for (size_t iters = 1 << 12;; iters *= 2) {
+        double secs = run_threads(threads, [&](size_t t) {
+            const T one = vone, zero = vzero;
+            T acc[lanes];
+            for (size_t j = 0; j != lanes; j++)
+                acc[j] = T(t + j);
+            for (size_t i = 0; i != iters; i++)
+                for (size_t j = 0; j != lanes; j++)
+                    acc[j] = acc[j] * one + zero;
+            T sum = T(0);
+            for (size_t j = 0; j != lanes; j++)
+                sum += acc[j];
+            sink = double(sum);
+        });
+        best = max(best, 2.0 * lanes * iters * threads / secs / 1e9);
+        if (secs >= min_time)
+            return best;
+    }
+}
+
+// Returns the best STREAM triad bandwidth, a[i] = b[i] + s * c[i], in GB/s.
+double triad_gbps(size_t threads, size_t elements, double min_time) {
+    vector<double*> a(threads), b(threads), c(threads);
+    const size_t part = max<size_t>(1, elements / threads);
+    // Each thread touches its own part first, so its pages are local.
+    run_threads(threads, [&](size_t t) {
+        a[t] = new double[part];
+        b[t] = new double[part];
+        c[t] = new double[part];
+        fill(a[t], a[t] + part, 0.0);
+        fill(b[t], b[t] + part, 1.0);
+        fill(c[t], c[t] + part, 2.0);
+    });
+    const double bytes = 3.0 * sizeof(double) * part * threads;
+    double best = 0, total = 0;
+    for (int rep = 0; rep < 3 || total < min_time; rep++) {
+        double secs = run_threads(threads, [&](size_t t) {
+            double* x = a[t];
+            const double* y = b[t];
+            const double* z = c[t];
+            for (size_t i = 0; i != part; i++)
+                x[i] = y[i] + 3.0 * z[i];
+        });
+        total += secs;
+        best = max(best, bytes / secs / 1e9);
+    }
+    sink = a[0][part / 2];
+    for (size_t t = 0; t != threads; t++) {
+        delete[] a[t];
+        delete[] b[t];
+        delete[] c[t];
+    }
+    return best;
+}
+
+// Returns the value of "key" in a line of Bench JSON, or an empty string.
+string field(const string& line, const string& key) {
+    size_t at = line.find("\"" + key + "\": ");
+    if (at == string::npos)
+        return "";
+    at += key.size() + 4;
+    if (line[at] == '"')
+        return line.substr(at + 1, line.find('"', at + 1) - at - 1);
+    return line.substr(at, line.find_first_of(",}", at) - at);
+}
+
+int main(int argc, char** argv) {
+    options opts;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        string flag = argv[i], value = argv[i + 1];
+        if (flag == "--input")
+            opts.input = value;
+        else if (flag == "--csv")
+            opts.csv = value;
+        else if (flag == "--elements")
+            opts.elements = stoull(value);
+        else if (flag == "--min-time")
+            opts.min_time = stod(value);
+        else {
+            cerr << "Unknown option " << flag << "\n";
+            return 1;
+        }
+    }
+
+    ifstream file;
+    if (opts.input != "-") {
+        file.open(opts.input);
+        if (!file) {
+            cerr << "Cannot open " << opts.input << "\n";
+            return 1;
+        }
+    }
+    istream& in = opts.input == "-" ? cin : file;
+    size_t threads = max(1u, thread::hardware_concurrency());
+    vector<record> records;
+    for (string line; getline(in, line);) {
+        if (line.find("\"context\"") != string::npos && !field(line, "threads").empty())
+            threads = stoull(field(line, "threads"));
+        if (field(line, "name").empty())
+            continue;
+        record r;
+        r.name = field(line, "name");
+        r.type = field(line, "type");
+        r.layout = field(line, "layout");
+        r.rows = stoull(field(line, "rows"));
+        r.cols = stoull(field(line, "cols"));
+        r.gflops = stod(field(line, "gflops"));
+        r.gbps = stod(field(line, "gbps"));
+        records.push_back(r);
+    }
+
+    map<string, double> peak = {{"int", peak_gflops<int>(threads, opts.min_time)},
+                                {"long", peak_gflops<long>(threads, opts.min_time)},
+                                {"float", peak_gflops<float>(threads, opts.min_time)},
+                                {"double", peak_gflops<double>(threads, opts.min_time)}};
+    const double bandwidth = triad_gbps(threads, opts.elements, opts.min_time);
+
+    cout << "threads: " << threads << "\nmemory bandwidth (triad): " << bandwidth << " GB/s\n";
+    for (const auto& p: peak)
+        cout << "peak " << p.first << ": " << p.second << " GOP/s, ridge at " << p.second / bandwidth
+             << " ops/byte\n";
+    cout << "\n";
+
+    ostringstream csv;
+    csv << "name,type,rows,cols,layout,intensity,gflops,gbps,ceiling,bound,fraction\n";
+    char row[256];
+    snprintf(row, sizeof(row), "%-20s %-6s %6s %-6s %9s %9s %9s %9s %-7s %8s\n", "operation", "type", "size",
+             "layout", "ops/byte", "GOP/s", "GB/s", "ceiling", "bound", "of ceil");
+    cout << row;
+    for (const record& r: records) {
+        if (!peak.count(r.type))
+            continue;
+        double intensity = r.gbps > 0 ? r.gflops / r.gbps : 0, ceiling, fraction;
+        bool memory_bound;
+        if (r.gflops > 0) {
+            ceiling = min(peak[r.type], intensity * bandwidth);
+            memory_bound = intensity * bandwidth < peak[r.type];
+            fraction = r.gflops / ceiling;
+        } else {
+            // Nothing to compute: the ceiling is the bandwidth, in GB/s.
+            ceiling = bandwidth;
+            memory_bound = true;
+            fraction = r.gbps / ceiling;
+        }
+        const char* bound = memory_bound ? "memory" : "compute";
+        snprintf(row, sizeof(row), "%-20s %-6s %6zu %-6s %9.3f %9.3f %9.3f %9.3f %-7s %7.1f%%\n", r.name.c_str(),
+                 r.type.c_str(), r.rows, r.layout.c_str(), intensity, r.gflops, r.gbps, ceiling, bound,
+                 100 * fraction);
+        cout << row;
+        csv << r.name << "," << r.type << "," << r.rows << "," << r.cols << "," << r.layout << "," << intensity
+            << "," << r.gflops << "," << r.gbps << "," << ceiling << "," << bound << "," << fraction << "\n";
+    }
+
+    if (!opts.csv.empty())
+        ofstream(opts.csv) << csv.str();
+}
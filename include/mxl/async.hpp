@@ -0,0 +1,173 @@
+/*! \file async.hpp
+    \brief Asynchronous variants of long-running operations.
+
+    Each function here starts its operation on an executor and returns at
+    once with a std::future for the result, so the calling thread (an RPC
+    handler, say) stays free and several large operations can overlap.
+    Computations run on the executor of the given context; file I/O runs on
+    its I/O executor if it has one. The operation itself still runs in
+    parallel on the context's threads.
+
+    run_async() starts any callable the same way, and also takes a completion
+    callback instead of returning a future:
+
+    \code
+    mxl::run_async([a, b] { return a * b; }, [](std::future<mxl::matrix<double>> r) {
+        reply(r.get());   // get() rethrows if the product failed
+    });
+    \endcode
+*/
+#pragma once
+
+#include "io.hpp"
+
+#include <future>
+
+namespace mxl {
+
+    namespace detail {
+
+        //! Wraps f in a task that runs it with ctx as the current context.
+        template <typename F>
+        std::shared_ptr<std::packaged_task<typename std::invoke_result<F>::type()>>
+        package(F f, const context& ctx) {
+            using R = typename std::invoke_result<F>::type;
+            return std::make_shared<std::packaged_task<R()>>([f = std::move(f), ctx]() mutable {
+                context_scope scope(ctx);
+                return f();
+            });
+        }
+
+        //! Submits task to exec, or runs it inline if exec has no threads.
+        inline void launch(const std::shared_ptr<executor>& exec, std::function<void()> task) {
+            if (exec && exec->concurrency())
+                exec->submit(std::move(task));
+            else
+                task();
+        }
+
+        //! The executor for file I/O under ctx.
+        inline const std::shared_ptr<executor>& io_executor(const context& ctx) {
+            return ctx.io ? ctx.io : ctx.exec;
+        }
+
+    }
+
+    //! Runs f() on the executor of ctx.
+    /*!
+        MXL operations inside f use ctx. Exceptions thrown by f are stored in
+        the future. If the executor has no threads of its own, f runs before
+        run_async returns.
+        \param f the work to run. Capture operands by value (or std::move them
+        in) so they outlive the call.
+        \param ctx the context to run on.
+        \return a future for the result of f.
+    */
+    template <typename F>
+    std::future<typename std::invoke_result<F>::type> run_async(F f, const context& ctx=current_context()) {
+        auto task = detail::package(std::move(f), ctx);
+        auto result = task->get_future();
+        detail::launch(ctx.exec, [task] { (*task)(); });
+        return result;
+    }
+
+    //! Runs f() on the executor of ctx and then calls done with the outcome.
+    /*!
+        done receives a ready std::future for the result: get() returns it, or
+        rethrows what f threw. done runs on the executor's thread and must not
+        throw.
+        \param f the work to run.
+        \param done the completion callback.
+        \param ctx the context to run on.
+    */
+    template <typename F, typename Callback, typename = typename std::enable_if<
+        !std::is_convertible<Callback, const context&>::value>::type>
+    void run_async(F f, Callback done, const context& ctx=current_context()) {
+        auto task = detail::package(std::move(f), ctx);
+        detail::launch(ctx.exec, [task, done]() mutable {
+            auto result = task->get_future();
+            (*task)();
+            done(std::move(result));
+        });
+    }
+
+    //! Starts lhs * rhs on ctx.
+    /*!
+        The operands are held by the task until it finishes; pass them with
+        std::move to avoid copying.
+        \return a future for the product. It holds a std::domain_error if the
+        shapes do not match.
+    */
+    template <typename T>
+    std::future<matrix<T>> multiply_async(matrix<T> lhs, matrix<T> rhs, const context& ctx=current_context()) {
+        return run_async([lhs = std::move(lhs), rhs = std::move(rhs), ctx]() mutable {
+            return multiply(std::move(lhs), rhs, ctx);
+        }, ctx);
+    }
+
+    //! Starts lhs + rhs on ctx. Same as multiply_async, for addition.
+    template <typename T>
+    std::future<matrix<T>> add_async(matrix<T> lhs, matrix<T> rhs, const context& ctx=current_context()) {
+        return run_async([lhs = std::move(lhs), rhs = std::move(rhs), ctx]() mutable {
+            return add(std::move(lhs), rhs, ctx);
+        }, ctx);
+    }
+
+    namespace detail {
+
+        //! Runs f on the I/O executor of ctx and returns a future for it.
+        template <typename F>
+        std::future<typename std::invoke_result<F>::type> io_async(F f, const context& ctx) {
+            auto task = package(std::move(f), ctx);
+            auto result = task->get_future();
+            launch(io_executor(ctx), [task] { (*task)(); });
+            return result;
+        }
+
+    }
+
+    //! Starts loading a matrix in the MXL binary format. See load().
+    template <typename T>
+    std::future<matrix<T>> load_async(const std::string& path, const context& ctx=current_context()) {
+        return detail::io_async([path] { return load<T>(path); }, ctx);
+    }
+
+    //! Starts saving a matrix in the MXL binary format. See save().
+    template <typename T>
+    std::future<void> save_async(matrix<T> mat, const std::string& path, const context& ctx=current_context()) {
+        return detail::io_async([mat = std::move(mat), path] { save(mat, path); }, ctx);
+    }
+
+    //! Starts reading a delimited text file. See read_csv().
+    template <typename T>
+    std::future<matrix<T>> read_csv_async(const std::string& path, const csv_options& opts=csv_options(),
+                                          const context& ctx=current_context()) {
+        return detail::io_async([path, opts] { return read_csv<T>(path, opts); }, ctx);
+    }
+
+    //! Starts loading a Matrix Market file. See load_mtx().
+    template <typename T>
+    std::future<matrix<T>> load_mtx_async(const std::string& path, const context& ctx=current_context()) {
+        return detail::io_async([path] { return load_mtx<T>(path); }, ctx);
+    }
+
+    //! Starts saving a Matrix Market file. See save_mtx().
+    template <typename T>
+    std::future<void> save_mtx_async(matrix<T> mat, const std::string& path, mtx_format format=mtx_format::array,
+                                     const context& ctx=current_context()) {
+        return detail::io_async([mat = std::move(mat), path, format] { save_mtx(mat, path, format); }, ctx);
+    }
+
+    //! Starts loading a NumPy .npy file. See load_npy().
+    template <typename T>
+    std::future<matrix<T>> load_npy_async(const std::string& path, const context& ctx=current_context()) {
+        return detail::io_async([path] { return load_npy<T>(path); }, ctx);
+    }
+
+    //! Starts saving a NumPy .npy file. See save_npy().
+    template <typename T>
+    std::future<void> save_npy_async(matrix<T> mat, const std::string& path, const context& ctx=current_context()) {
+        return detail::io_async([mat = std::move(mat), path] { save_npy(mat, path); }, ctx);
+    }
+
+}
@@ -0,0 +1,243 @@
+/*! \file autotune.hpp
+    \brief Searches for the fastest blocking parameters of the multiply kernel
+    on this host, measures the costs the multiply dispatcher weighs, and saves
+    both to its tuning profile.
+
+    The best block sizes depend on the cache sizes and core of the machine.
+    MXL starts from default_blocking() for the detected caches, and uses the
+    host's tuning profile instead once there is one:
+
+    \code
+    mxl::autotune<float>();
+    mxl::autotune<double>();
+    mxl::calibrate_cost_model<float>();
+    mxl::calibrate_cost_model<double>();
+    mxl::save_tuning_profile();   // loaded by later runs on this host
+    \endcode
+
+    The Autotune program does the same for the common element types.
+*/
+#pragma once
+
+#include "mxl.hpp"
+
+#include <filesystem>
+
+namespace mxl {
+
+    //! How autotune() measures candidates.
+    struct autotune_options {
+        //! Rows and columns of the square operands multiplied.
+        std::size_t size = 384;
+        //! Seconds to spend on each candidate; its fastest product counts.
+        double min_time = 0.02;
+    };
+
+    namespace detail {
+
+        //! Returns the fastest time, in seconds, of a * b on ctx under bl.
+        template <typename T>
+        double time_blocking(const matrix<T>& a, const matrix<T>& b, const blocking& bl, const context& ctx,
+                             double min_time) {
+            set_blocking<T>(bl);
+            double best = 1e300, total = 0;
+            do {
+                auto start = std::chrono::steady_clock::now();
+                matrix<T> c = multiply(a, b, ctx);
+                std::chrono::duration<double> secs = std::chrono::steady_clock::now() - start;
+                best = std::min(best, secs.count());
+                total += secs.count();
+            } while (total < min_time);
+            return best;
+        }
+
+    }
+
+    //! Finds fast blocking parameters for multiplying matrices of T on this
+    //! host, and sets them with set_blocking().
+    /*!
+        Starting from the current parameters, tries each register tile, then
+        each kc, mc and nc in turn, keeping whatever is fastest, on one thread
+        (each worker thread runs the kernel on its own rows). While it runs,
+        other multiplications of T in the process use the candidates.
+        \param opts the operand size and time per candidate.
+        \param log if set, each candidate and its time are written to it.
+        \return the parameters found.
+    */
+    template <typename T>
+    blocking autotune(const autotune_options& opts=autotune_options(), std::ostream* log=nullptr) {
+        const std::size_t n = std::max<std::size_t>(opts.size, 8);
+        matrix<T> a(n, n, uniform(-4, 4), 1), b(n, n, uniform(-4, 4), 2);
+        const context serial(std::make_shared<thread_pool>(0));
+
+        blocking best = get_blocking<T>();
+        double best_time = detail::time_blocking(a, b, best, serial, opts.min_time);
+        auto consider = [&](blocking candidate) {
+            candidate.mc = std::max(candidate.mr, candidate.mc / candidate.mr * candidate.mr);
+            candidate.nc = std::max(candidate.nr, candidate.nc / candidate.nr * candidate.nr);
+            if (candidate == best)
+                return;
+            double t = detail::time_blocking(a, b, candidate, serial, opts.min_time);
+            if (log)
+                *log << detail::tuning_key<T>() << " mc=" << candidate.mc << " kc=" << candidate.kc << " nc="
+                     << candidate.nc << " mr=" << candidate.mr << " nr=" << candidate.nr << ": "
+                     << 2.0 * n * n * n / t / 1e9 << " GFLOP/s\n";
+            if (t < best_time) {
+                best = candidate;
+                best_time = t;
+            }
+        };
+
+        for (std::size_t mr: {4, 8})
+            for (std::size_t nr: {4, 8})
+                consider(blocking{best.mc, best.kc, best.nc, mr, nr});
+        for (std::size_t kc: {64, 128, 192, 256, 384, 512})
+            consider(blocking{best.mc, kc, best.nc, best.mr, best.nr});
+        for (std::size_t mc: {32, 64, 96, 128, 192, 256, 384})
+            consider(blocking{mc, best.kc, best.nc, best.mr, best.nr});
+        for (std::size_t nc: {256, 512, 1024, 2048, 4096, 8192})
+            consider(blocking{best.mc, best.kc, nc, best.mr, best.nr});
+
+        set_blocking<T>(best);
+        return best;
+    }
+
+    namespace detail {
+
+        //! Returns the fastest time of f(), in nanoseconds, over about
+        //! min_time seconds.
+        template <typename F>
+        double best_ns(F f, double min_time) {
+            double best = 1e300, total = 0;
+            do {
+                auto start = std::chrono::steady_clock::now();
+                f();
+                std::chrono::duration<double, std::nano> ns = std::chrono::steady_clock::now() - start;
+                best = std::min(best, ns.count());
+                total += ns.count() * 1e-9;
+            } while (total < min_time);
+            return best;
+        }
+
+        //! Writes the fields of cm as they appear in a tuning profile.
+        inline void write_cost_model(std::ostream& out, const multiply_cost_model& cm) {
+            out << " naive_ns=" << cm.naive_ns << " strided_ns=" << cm.strided_ns << " loop_ns=" << cm.loop_ns
+                << " unrolled_ns=" << cm.unrolled_ns << " gemv_ns=" << cm.gemv_ns << " blocked_ns=" << cm.blocked_ns
+                << " pack_ns=" << cm.pack_ns << " setup_ns=" << cm.setup_ns << " task_ns=" << cm.task_ns
+                << " strassen_min=" << cm.strassen_min;
+        }
+
+    }
+
+    //! Measures the costs of the multiply dispatcher's model for matrices of
+    //! T on this host, and sets them with set_cost_model().
+    /*!
+        Times each kernel on its own, on one thread, at sizes where it would
+        be chosen; the per-thread cost is measured on the default context.
+        strassen_min is kept from the current model.
+        \param opts the time per measurement (opts.size is not used).
+        \param log if set, the measured model is written to it.
+        \return the measured model.
+    */
+    template <typename T>
+    multiply_cost_model calibrate_cost_model(const autotune_options& opts=autotune_options(),
+                                             std::ostream* log=nullptr) {
+        multiply_cost_model cm = get_cost_model<T>();
+        const blocking bl = get_blocking<T>();
+        workspace arena;
+        std::vector<T> a(512 * 512), b(512 * 512), c(512 * 512), scratch(512);
+        for (std::size_t k = 0; k != a.size(); ++k) {
+            a[k] = T(k % 7) - T(3);
+            b[k] = T(k % 5) - T(2);
+        }
+        auto per = [&](double ns, double count) { return std::max(ns / count, 1e-3); };
+
+        // Row kernel, with the right operand stored by rows and by columns.
+        const std::size_t s = 64;
+        cm.naive_ns = per(detail::best_ns([&] {
+            detail::multiply_rows(a.data(), s, 1, b.data(), s, 1, c.data(), s, s, 0, s, scratch.data());
+        }, opts.min_time), double(s) * s * s);
+        cm.strided_ns = per(detail::best_ns([&] {
+            detail::multiply_rows(a.data(), s, 1, b.data(), 1, s, c.data(), s, s, 0, s, scratch.data());
+        }, opts.min_time), double(s) * s * s);
+        // With one column, each multiply-add starts an inner loop.
+        cm.loop_ns = per(detail::best_ns([&] {
+            detail::multiply_rows(a.data(), 512, 1, b.data(), 1, 1, c.data(), 1, 512, 0, 512, scratch.data());
+        }, opts.min_time) - cm.naive_ns * 512 * 512, 512.0 * 512);
+        cm.unrolled_ns = per(detail::best_ns([&] {
+            detail::multiply_unrolled(a.data(), 4, 1, b.data(), 256, 1, c.data(), 256, 4, 0, 256);
+        }, opts.min_time), 256.0 * 256 * 4);
+        // Matrix-vector products over both layouts of the matrix.
+        cm.gemv_ns = per(detail::best_ns([&] {
+            detail::multiply_gemv(a.data(), 512, 1, b.data(), 1, c.data(), 512, 0, 512);
+            detail::multiply_gemv(a.data(), 1, 512, b.data(), 1, c.data(), 512, 0, 512);
+        }, opts.min_time), 2.0 * 512 * 512);
+        const std::size_t n = 256;
+        cm.blocked_ns = per(detail::best_ns([&] {
+            detail::multiply_blocked(a.data(), n, 1, b.data(), n, 1, c.data(), n, n, 0, n, bl, arena);
+        }, opts.min_time), double(n) * n * n);
+        cm.pack_ns = per(detail::best_ns([&] {
+            detail::pack_left<T, 4>(a.data(), 512, 1, 0, 512, 0, 512, c.data());
+        }, opts.min_time), 512.0 * 512);
+        const double small = detail::best_ns([&] {
+            detail::multiply_blocked(a.data(), 8, 1, b.data(), 8, 1, c.data(), 8, 8, 0, 8, bl, arena);
+        }, opts.min_time);
+        cm.setup_ns = std::max(small - cm.blocked_ns * 512 - cm.pack_ns * 128, 1.0);
+
+        const context& ctx = current_context();
+        if (ctx.exec && ctx.threads > 1) {
+            std::atomic<std::size_t> sink(0);
+            const double t = detail::best_ns([&] {
+                ctx.parallel_for(ctx.threads, 1, [&](std::size_t i0, std::size_t i1) { sink += i1 - i0; });
+            }, opts.min_time);
+            cm.task_ns = per(t, double(ctx.threads - 1));
+        }
+
+        if (log) {
+            *log << detail::tuning_key<T>();
+            detail::write_cost_model(*log, cm);
+            *log << "\n";
+        }
+        set_cost_model<T>(cm);
+        return cm;
+    }
+
+    //! Writes the blocking parameters and cost models set with
+    //! set_blocking() and set_cost_model() (including those found by
+    //! autotune() and calibrate_cost_model()) or loaded from a profile, so
+    //! that later runs load them. Creates the directory if needed.
+    /*!
+        Throws a std::runtime_error if the file cannot be written.
+        \param path where to write; the host's profile by default.
+    */
+    inline void save_tuning_profile(const std::string& path=tuning_profile_path()) {
+        std::error_code ec;
+        std::filesystem::path parent = std::filesystem::path(path).parent_path();
+        if (!parent.empty())
+            std::filesystem::create_directories(parent, ec);
+
+        std::ofstream out(path);
+        out << "# MXL tuning profile: element type, multiply blocking parameters and cost model\n";
+        {
+            detail::tuning_table& table = detail::tuning();
+            std::lock_guard<std::mutex> lock(table.m);
+            std::vector<std::string> keys;
+            for (const std::pair<std::string, blocking>& e: table.entries)
+                keys.push_back(e.first);
+            for (const std::pair<std::string, multiply_cost_model>& e: table.models)
+                if (std::find(keys.begin(), keys.end(), e.first) == keys.end())
+                    keys.push_back(e.first);
+            for (const std::string& key: keys) {
+                out << key;
+                if (const blocking* b = detail::find_entry(table.entries, key))
+                    out << " mc=" << b->mc << " kc=" << b->kc << " nc=" << b->nc << " mr=" << b->mr << " nr=" << b->nr;
+                if (const multiply_cost_model* cm = detail::find_entry(table.models, key))
+                    detail::write_cost_model(out, *cm);
+                out << "\n";
+            }
+        }
+        if (!out)
+            throw std::runtime_error("Failed to write tuning profile " + path + ".");
+    }
+
+}
@@ -0,0 +1,1046 @@
+/*! \file io.hpp
+    \brief Reading and writing MXL matrices.
+
+    Text (CSV, or the output of matrix::to_string) is read with mxl::parse and
+    mxl::read_csv. Matrix Market files are read and written with mxl::load_mtx
+    and mxl::save_mtx, and NumPy .npy files with mxl::load_npy, 
+    mxl::load_npy_mapped and mxl::save_npy.
+
+    The binary format (".mxl") is a 64-byte header followed by the raw
+    contents of the matrix's underlying container:
+
+    | offset | size | field                                               |
+    |--------|------|-----------------------------------------------------|
+    | 0      | 6    | magic, "MXLBIN"                                     |
+    | 6      | 1    | format version (1)                                  |
+    | 7      | 1    | dtype code (see mxl::dtype)                         |
+    | 8      | 4    | byte order mark, 0x01020304 in the writer's order   |
+    | 12     | 1    | element size in bytes                               |
+    | 13     | 1    | layout: 0 row after row, 1 column after column      |
+    | 14     | 2    | reserved, 0                                         |
+    | 16     | 8    | number of rows                                      |
+    | 24     | 8    | number of columns                                   |
+    | 32     | 8    | data offset from the start of the file              |
+    | 40     | 8    | data alignment                                      |
+    | 48     | 16   | reserved, 0                                         |
+
+    The data offset is a multiple of the alignment, so a memory-mapped file
+    can be read in place.
+*/
+#pragma once
+
+#include "mxl.hpp"
+
+#include <cctype>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <istream>
+#include <limits>
+#include <ostream>
+#include <sstream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define MXL_HAS_MMAP 1
+#endif
+
+namespace mxl {
+
+    //! Element types that can be stored in MXL files.
+    enum class dtype: std::uint8_t {
+        int8 = 1, uint8, int16, uint16, int32, uint32, int64, uint64, float32, float64
+    };
+
+    namespace detail {
+
+        //! Maps an element type to its dtype code.
+        template <typename T, typename = void>
+        struct dtype_of;
+
+        template <typename T>
+        struct dtype_of<T, typename std::enable_if<std::is_integral<T>::value>::type> {
+            static const dtype value = static_cast<dtype>(
+                (sizeof(T) == 1 ? 1 : sizeof(T) == 2 ? 3 : sizeof(T) == 4 ? 5 : 7) +
+                (std::is_signed<T>::value ? 0 : 1));
+        };
+
+        template <>
+        struct dtype_of<float> { static const dtype value = dtype::float32; };
+
+        template <>
+        struct dtype_of<double> { static const dtype value = dtype::float64; };
+
+        //! On-disk header of the binary format, see io.hpp.
+        struct binary_header {
+            char magic[6];
+            std::uint8_t version;
+            std::uint8_t type;
+            std::uint32_t byte_order;
+            std::uint8_t element_size;
+            std::uint8_t layout;
+            std::uint16_t reserved0;
+            std::uint64_t rows;
+            std::uint64_t cols;
+            std::uint64_t data_offset;
+            std::uint64_t alignment;
+            std::uint64_t reserved1[2];
+        };
+
+        static_assert(sizeof(binary_header) == 64, "binary_header must be 64 bytes.");
+
+        const char binary_magic[6] = {'M', 'X', 'L', 'B', 'I', 'N'};
+        const std::uint32_t byte_order_mark = 0x01020304;
+        const std::uint64_t binary_alignment = 64;
+
+        //! Builds the header describing mat.
+        template <typename T>
+        binary_header make_header(const matrix<T>& mat) {
+            binary_header h;
+            std::memset(&h, 0, sizeof(h));
+            std::memcpy(h.magic, binary_magic, sizeof(h.magic));
+            h.version = 1;
+            h.type = static_cast<std::uint8_t>(dtype_of<T>::value);
+            h.byte_order = byte_order_mark;
+            h.element_size = sizeof(T);
+            h.layout = mat.is_transposed() ? 1 : 0;
+            h.rows = mat.shape().first;
+            h.cols = mat.shape().second;
+            h.data_offset = binary_alignment;
+            h.alignment = binary_alignment;
+            return h;
+        }
+
+        //! Throws a std::runtime_error unless h describes a matrix<T>.
+        /*!
+            \param h the header read from the file.
+            \param file_size the size of the file, or 0 if unknown.
+        */
+        template <typename T>
+        void check_header(const binary_header& h, std::uint64_t file_size) {
+            if (std::memcmp(h.magic, binary_magic, sizeof(h.magic)) != 0 || h.version != 1)
+                throw std::runtime_error("Not an MXL binary matrix file.");
+            if (h.byte_order != byte_order_mark)
+                throw std::runtime_error("MXL binary matrix file has a different byte order.");
+            if (h.type != static_cast<std::uint8_t>(dtype_of<T>::value) || h.element_size != sizeof(T))
+                throw std::runtime_error("MXL binary matrix file holds dtype " + std::to_string(h.type) +
+                    ", expected " + std::to_string(static_cast<int>(dtype_of<T>::value)) + ".");
+            if (h.data_offset < sizeof(h) || h.layout > 1)
+                throw std::runtime_error("Corrupt MXL binary matrix header.");
+            // Sizes come from the file, so products must not wrap around.
+            const std::uint64_t max_bytes = std::numeric_limits<std::size_t>::max();
+            if (h.cols && h.rows > max_bytes / sizeof(T) / h.cols)
+                throw std::runtime_error("MXL binary matrix header has too many elements.");
+            const std::uint64_t bytes = h.rows * h.cols * sizeof(T);
+            if (h.data_offset > max_bytes - bytes)
+                throw std::runtime_error("Corrupt MXL binary matrix header.");
+            if (file_size && file_size < h.data_offset + bytes)
+                throw std::runtime_error("MXL binary matrix file is truncated.");
+        }
+
+        //! The number of bytes left in a seekable stream, or 0 if unknown.
+        inline std::uint64_t remaining_size(std::istream& is) {
+            std::istream::pos_type start = is.tellg();
+            if (start == std::istream::pos_type(-1))
+                return 0;
+            std::streamoff size = is.seekg(0, std::ios::end).tellg() - start;
+            is.clear();
+            is.seekg(start);
+            return size > 0 ? static_cast<std::uint64_t>(size) : 0;
+        }
+
+    }
+
+    //! Writes a matrix to a stream in the MXL binary format.
+    /*!
+        The underlying container is written as-is, so transposed matrices keep
+        their layout.
+        \param mat the matrix to write.
+        \param os the (binary) stream to write to.
+    */
+    template <typename T>
+    void save(const matrix<T>& mat, std::ostream& os) {
+        detail::binary_header h = detail::make_header(mat);
+        char pad[detail::binary_alignment] = {};
+        os.write(reinterpret_cast<const char*>(&h), sizeof(h));
+        os.write(pad, h.data_offset - sizeof(h));
+        os.write(reinterpret_cast<const char*>(mat.raw_data()), h.rows * h.cols * sizeof(T));
+        if (!os)
+            throw std::runtime_error("Failed to write MXL binary matrix.");
+    }
+
+    //! Writes a matrix to a file in the MXL binary format.
+    /*!
+        \param mat the matrix to write.
+        \param path the file to create or overwrite.
+    */
+    template <typename T>
+    void save(const matrix<T>& mat, const std::string& path) {
+        std::ofstream os(path, std::ios::binary | std::ios::trunc);
+        if (!os)
+            throw std::runtime_error("Cannot open " + path + " for writing.");
+        save(mat, os);
+    }
+
+    //! Reads a matrix in the MXL binary format from a stream.
+    /*!
+        Throws a std::runtime_error if the data is not a matrix<T>.
+        \param is the (binary) stream to read from.
+    */
+    template <typename T>
+    matrix<T> load(std::istream& is) {
+        // Bounds the allocation below by the stream's size, where it has one.
+        const std::uint64_t size = detail::remaining_size(is);
+        detail::binary_header h;
+        if (!is.read(reinterpret_cast<char*>(&h), sizeof(h)))
+            throw std::runtime_error("Not an MXL binary matrix file.");
+        detail::check_header<T>(h, size);
+        is.ignore(h.data_offset - sizeof(h));
+
+        const bool row_major = !h.layout;
+        matrix<T> out(row_major ? h.rows : h.cols, row_major ? h.cols : h.rows);
+        if (!is.read(reinterpret_cast<char*>(out.raw_data()), h.rows * h.cols * sizeof(T)))
+            throw std::runtime_error("MXL binary matrix file is truncated.");
+        if (!row_major)
+            out.transpose();
+        return out;
+    }
+
+    //! Reads a matrix in the MXL binary format from a file.
+    /*!
+        \param path the file to read.
+    */
+    template <typename T>
+    matrix<T> load(const std::string& path) {
+        std::ifstream is(path, std::ios::binary);
+        if (!is)
+            throw std::runtime_error("Cannot open " + path + " for reading.");
+        return load<T>(is);
+    }
+
+#ifdef MXL_HAS_MMAP
+    namespace detail {
+
+        //! A read-only, shared memory mapping of a whole file.
+        class mapped_file {
+        public:
+            explicit mapped_file(const std::string& path): addr(nullptr), length(0) {
+                int fd = ::open(path.c_str(), O_RDONLY);
+                if (fd < 0)
+                    throw std::runtime_error("Cannot open " + path + " for reading.");
+                struct stat st;
+                if (::fstat(fd, &st) != 0) {
+                    ::close(fd);
+                    throw std::runtime_error("Cannot stat " + path + ".");
+                }
+                length = static_cast<std::size_t>(st.st_size);
+                if (length) {
+                    void* p = ::mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+                    if (p == MAP_FAILED) {
+                        ::close(fd);
+                        throw std::runtime_error("Cannot map " + path + ".");
+                    }
+                    addr = static_cast<const char*>(p);
+                }
+                ::close(fd);
+            }
+
+            ~mapped_file() {
+                if (addr)
+                    ::munmap(const_cast<char*>(addr), length);
+            }
+
+            mapped_file(const mapped_file&) = delete;
+            mapped_file& operator=(const mapped_file&) = delete;
+
+            const char* data() const { return addr; }
+            std::size_t size() const { return length; }
+
+        private:
+            const char* addr;
+            std::size_t length;
+        };
+
+    }
+
+    //! Maps a file in the MXL binary format into memory and returns a view of
+    //! it, without copying.
+    /*!
+        Pages are read lazily from the page cache as elements are accessed, so
+        opening a file is constant-time regardless of its size. The mapping is
+        released when the last copy of the view is destroyed. Throws a
+        std::runtime_error if the file is not a matrix<T>.
+        \param path the file to map.
+    */
+    template <typename T>
+    matrix_view<T> load_mapped(const std::string& path) {
+        std::shared_ptr<detail::mapped_file> file = std::make_shared<detail::mapped_file>(path);
+        detail::binary_header h;
+        if (file->size() < sizeof(h))
+            throw std::runtime_error("Not an MXL binary matrix file.");
+        std::memcpy(&h, file->data(), sizeof(h));
+        detail::check_header<T>(h, file->size());
+        if (h.data_offset % alignof(T))
+            throw std::runtime_error("MXL binary matrix data is not aligned for mapping; use load.");
+        const T* first = reinterpret_cast<const T*>(file->data() + h.data_offset);
+        return matrix_view<T>(first, h.rows, h.cols, h.layout == 1, file);
+    }
+#endif
+
+    //! Options for reading matrices from text.
+    struct csv_options {
+        //! The character between values on a line, besides whitespace.
+        char delimiter = ',';
+        //! The number of leading lines to skip, e.g. a CSV header.
+        std::size_t skip_rows = 0;
+        //! The number of chunks each block is cut into for parallel parsing. 0
+        //! uses the threads of current_context(), which also runs the chunks.
+        unsigned threads = 0;
+        //! How many bytes read_csv reads from the stream at a time.
+        std::size_t block_size = std::size_t(1) << 24;
+    };
+
+    namespace detail {
+
+        //! Blocks smaller than this are not split between threads.
+        const std::size_t min_parse_chunk = std::size_t(1) << 18;
+
+        //! Characters that separate values: whitespace, the delimiter, and the
+        //! brackets written by matrix::to_string.
+        inline bool is_separator(char c, char delimiter) {
+            return c == delimiter || c == ' ' || c == '\t' || c == '\r' || c == '[' || c == ']';
+        }
+
+        //! Returns the end of the line starting at first (the '\n' or last).
+        inline const char* line_end(const char* first, const char* last) {
+            const void* nl = std::memchr(first, '\n', last - first);
+            return nl ? static_cast<const char*>(nl) : last;
+        }
+
+        //! Returns true if the line holds at least one value.
+        inline bool has_values(const char* first, const char* last, char delimiter) {
+            for (; first != last; ++first)
+                if (!is_separator(*first, delimiter))
+                    return true;
+            return false;
+        }
+
+        //! Counts the lines in [first, last) that hold values.
+        inline std::size_t count_rows(const char* first, const char* last, char delimiter) {
+            std::size_t rows = 0;
+            while (first < last) {
+                const char* eol = line_end(first, last);
+                rows += has_values(first, eol, delimiter);
+                first = eol + 1;
+            }
+            return rows;
+        }
+
+        //! Parses the values on one line into out, and returns how many there
+        //! were. Parsing stops after max values.
+        /*!
+            Throws a std::runtime_error if a value is not a valid T.
+        */
+        template <typename T>
+        std::size_t parse_line(const char* first, const char* last, char delimiter, T* out, std::size_t max) {
+            std::size_t count = 0;
+            while (true) {
+                while (first != last && is_separator(*first, delimiter))
+                    ++first;
+                if (first == last)
+                    return count;
+                if (*first == '+' && first + 1 != last)
+                    ++first;
+                T value;
+                std::from_chars_result r = std::from_chars(first, last, value);
+                if (r.ec != std::errc() || (r.ptr != last && !is_separator(*r.ptr, delimiter)))
+                    throw std::runtime_error("Cannot parse \"" + std::string(first, line_end(first, last)) + 
+                        "\" as a matrix element.");
+                if (count < max)
+                    out[count] = value;
+                ++count;
+                first = r.ptr;
+            }
+        }
+
+        //! Parses every line with values in [first, last) as a row of width
+        //! values, written one after the other to out.
+        /*!
+            Throws a std::domain_error if a row has the wrong number of values.
+            \param row0 the index of the first row, used in error messages.
+        */
+        template <typename T>
+        void parse_rows(const char* first, const char* last, char delimiter, std::size_t width,
+                        T* out, std::size_t row0) {
+            while (first < last) {
+                const char* eol = line_end(first, last);
+                if (has_values(first, eol, delimiter)) {
+                    std::size_t n = parse_line(first, eol, delimiter, out, width);
+                    if (n != width)
+                        throw std::domain_error("Row " + std::to_string(row0) + " has " + std::to_string(n) +
+                            " values, expected " + std::to_string(width) + ".");
+                    out += width;
+                    ++row0;
+                }
+                first = eol + 1;
+            }
+        }
+
+        //! Runs task(0), ..., task(count - 1) in parallel on current_context()
+        //! and rethrows the first exception, if any.
+        template <typename Task>
+        void run_tasks(std::size_t count, Task task) {
+            current_context().parallel_for(count, 1, [&](std::size_t first, std::size_t last) {
+                for (std::size_t t = first; t != last; ++t)
+                    task(t);
+            });
+        }
+
+        //! Cuts [first, last) into line-aligned chunks, one per thread (0 uses
+        //! the threads of current_context()), and returns the chunk boundaries.
+        inline std::vector<const char*> split_lines(const char* first, const char* last, unsigned threads) {
+            std::size_t count = threads ? threads : current_context().threads;
+            std::size_t chunks = std::max<std::size_t>(1, std::min<std::size_t>(count, (last - first) / min_parse_chunk));
+            std::vector<const char*> bounds(1, first);
+            for (std::size_t c = 1; c < chunks; ++c) {
+                const char* p = std::max(bounds.back(), first + (last - first) * c / chunks);
+                bounds.push_back(std::min(last, line_end(p, last) + 1));
+            }
+            bounds.push_back(last);
+            return bounds;
+        }
+
+        //! Parses the complete lines in [first, last) and appends them to data.
+        /*!
+            The block is cut into line-aligned chunks. Each chunk's rows are
+            counted in parallel, the storage is grown once, and each chunk is
+            then parsed in parallel straight into its place in data.
+            \param width the row width; set from the first row if 0.
+            \param rows the number of rows parsed so far, updated.
+        */
+        template <typename T>
+        void parse_block(const char* first, const char* last, const csv_options& opts,
+                         std::size_t& width, std::size_t& rows, std::vector<T, first_touch_allocator<T>>& data) {
+            const char d = opts.delimiter;
+            if (!width) {
+                while (first < last) {
+                    const char* eol = line_end(first, last);
+                    if (has_values(first, eol, d)) {
+                        width = parse_line<T>(first, eol, d, nullptr, 0);
+                        break;
+                    }
+                    first = eol + 1;
+                }
+                if (!width)
+                    return;
+            }
+
+            std::vector<const char*> bounds = split_lines(first, last, opts.threads);
+            std::size_t chunks = bounds.size() - 1;
+
+            std::vector<std::size_t> offsets(chunks + 1, 0);
+            run_tasks(chunks, [&](std::size_t c) {
+                offsets[c + 1] = count_rows(bounds[c], bounds[c + 1], d);
+            });
+            for (std::size_t c = 0; c != chunks; ++c)
+                offsets[c + 1] += offsets[c];
+
+            std::size_t start = data.size();
+            data.resize(start + offsets[chunks] * width);
+            run_tasks(chunks, [&](std::size_t c) {
+                parse_rows(bounds[c], bounds[c + 1], d, width, data.data() + start + offsets[c] * width,
+                    rows + offsets[c]);
+            });
+            rows += offsets[chunks];
+        }
+
+        //! Builds the parsed matrix on data without copying it; a matrix with
+        //! no rows is empty.
+        template <typename T>
+        matrix<T> parsed_matrix(std::size_t rows, std::size_t width,
+                                std::vector<T, first_touch_allocator<T>>&& data) {
+            return rows ? adopt_storage(rows, width, std::move(data)) : matrix<T>();
+        }
+
+        //! Returns the position after the first count lines of [first, last).
+        inline const char* skip_lines(const char* first, const char* last, std::size_t count) {
+            for (; count && first < last; --count)
+                first = line_end(first, last) + 1;
+            return std::min(first, last);
+        }
+
+    }
+
+    //! Parses a matrix from text.
+    /*!
+        Each line with values is a row. Values are separated by whitespace, the
+        delimiter, or brackets, so both CSV and the output of 
+        matrix::to_string() are accepted. Throws a std::domain_error if the
+        rows have different lengths and a std::runtime_error if a value is not
+        a valid T.
+        \param text the text to parse.
+        \param opts the delimiter, lines to skip, and number of threads.
+    */
+    template <typename T>
+    matrix<T> parse(const std::string& text, const csv_options& opts=csv_options()) {
+        const char* first = text.data();
+        const char* last = first + text.size();
+        first = detail::skip_lines(first, last, opts.skip_rows);
+        std::size_t width = 0, rows = 0;
+        std::vector<T, detail::first_touch_allocator<T>> data;
+        detail::parse_block(first, last, opts, width, rows, data);
+        return detail::parsed_matrix(rows, width, std::move(data));
+    }
+
+    //! Reads a matrix from a text stream, such as a CSV file.
+    /*!
+        The stream is read opts.block_size bytes at a time; each block's
+        complete lines are parsed in parallel into the matrix storage before
+        the next block is read. Accepts the same text as mxl::parse.
+        \param is the stream to read.
+        \param opts the delimiter, lines to skip, threads and block size.
+    */
+    template <typename T>
+    matrix<T> read_csv(std::istream& is, const csv_options& opts=csv_options()) {
+        std::vector<char> buf(std::max<std::size_t>(opts.block_size, 2));
+        std::size_t width = 0, rows = 0, carry = 0, skip = opts.skip_rows;
+        std::vector<T, detail::first_touch_allocator<T>> data;
+
+        while (true) {
+            if (carry == buf.size())
+                buf.resize(buf.size() * 2);
+            is.read(buf.data() + carry, buf.size() - carry);
+            std::size_t len = carry + static_cast<std::size_t>(is.gcount());
+            bool done = len < buf.size();
+            const char* first = buf.data();
+            const char* last = first + len;
+            const char* cut = last;
+            if (!done) {
+                while (cut != first && cut[-1] != '\n')
+                    --cut;
+            }
+            while (skip && first < cut) {
+                first = std::min(cut, detail::line_end(first, cut) + 1);
+                --skip;
+            }
+            detail::parse_block(first, cut, opts, width, rows, data);
+            if (done)
+                break;
+            carry = last - cut;
+            std::memmove(buf.data(), cut, carry);
+        }
+        return detail::parsed_matrix(rows, width, std::move(data));
+    }
+
+    //! Reads a matrix from a text file, such as a CSV file.
+    /*!
+        \param path the file to read.
+        \param opts the delimiter, lines to skip, threads and block size.
+        \sa read_csv(std::istream&, const csv_options&)
+    */
+    template <typename T>
+    matrix<T> read_csv(const std::string& path, const csv_options& opts=csv_options()) {
+        std::ifstream is(path, std::ios::binary);
+        if (!is)
+            throw std::runtime_error("Cannot open " + path + " for reading.");
+        return read_csv<T>(is, opts);
+    }
+
+    //! Matrix Market storage formats.
+    enum class mtx_format {
+        //! Every element, column after column.
+        array,
+        //! Only the non-zero elements, as (row, column, value) lines.
+        coordinate
+    };
+
+    namespace detail {
+
+        //! The parsed banner and size line of a Matrix Market file.
+        struct mtx_header {
+            bool coordinate = false;
+            bool pattern = false;
+            //! "general", "symmetric" or "skew-symmetric"
+            std::string symmetry;
+            std::size_t rows = 0, cols = 0, entries = 0;
+        };
+
+        //! Returns the next line of [first, last) and advances first past it.
+        inline std::string next_line(const char*& first, const char* last) {
+            const char* eol = line_end(first, last);
+            std::string line(first, eol);
+            first = std::min(last, eol + 1);
+            return line;
+        }
+
+        //! Parses the banner, comments and size line, and advances first to the
+        //! first data line. Throws a std::runtime_error for unsupported files.
+        inline mtx_header parse_mtx_header(const char*& first, const char* last) {
+            std::string banner = next_line(first, last);
+            for (char& c: banner)
+                c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+            std::istringstream ss(banner);
+            std::string tag, object, format, field, symmetry;
+            ss >> tag >> object >> format >> field >> symmetry;
+            if (tag != "%%matrixmarket" || object != "matrix")
+                throw std::runtime_error("Not a Matrix Market matrix file.");
+            if (format != "array" && format != "coordinate")
+                throw std::runtime_error("Unknown Matrix Market format \"" + format + "\".");
+            if (field != "real" && field != "double" && field != "integer" && 
+                !(field == "pattern" && format == "coordinate"))
+                throw std::runtime_error("Unsupported Matrix Market field \"" + field + "\".");
+            if (symmetry != "general" && symmetry != "symmetric" && symmetry != "skew-symmetric")
+                throw std::runtime_error("Unsupported Matrix Market symmetry \"" + symmetry + "\".");
+
+            mtx_header h;
+            h.coordinate = format == "coordinate";
+            h.pattern = field == "pattern";
+            h.symmetry = symmetry;
+
+            std::string line;
+            do {
+                if (first >= last)
+                    throw std::runtime_error("Matrix Market file has no size line.");
+                line = next_line(first, last);
+            } while (line.empty() || line[0] == '%' || !has_values(line.data(), line.data() + line.size(), ' '));
+            std::istringstream size_line(line);
+            if (!(size_line >> h.rows >> h.cols) || (h.coordinate && !(size_line >> h.entries)))
+                throw std::runtime_error("Bad Matrix Market size line \"" + line + "\".");
+            if (h.symmetry != "general" && h.rows != h.cols)
+                throw std::runtime_error("Symmetric Matrix Market matrices must be square.");
+            return h;
+        }
+
+        //! One element of a coordinate file, with 0-based indexes.
+        template <typename T>
+        struct mtx_entry {
+            std::size_t i, j;
+            T value;
+        };
+
+        //! Parses the coordinate lines in [first, last) and appends them to out.
+        template <typename T>
+        void parse_mtx_entries(const char* first, const char* last, const mtx_header& h,
+                               std::vector<mtx_entry<T>>& out) {
+            std::size_t fields = h.pattern ? 2 : 3;
+            while (first < last) {
+                const char* eol = line_end(first, last);
+                if (*first != '%' && has_values(first, eol, ' ')) {
+                    double idx[2];
+                    T value = T(1);
+                    std::size_t n = parse_line<double>(first, eol, ' ', idx, 2);
+                    if (n != fields)
+                        throw std::runtime_error("Bad Matrix Market entry \"" + std::string(first, eol) + "\".");
+                    if (!h.pattern) {
+                        const char* p = first;
+                        for (int k = 0; k != 2; ++k) {
+                            while (is_separator(*p, ' ')) ++p;
+                            while (!is_separator(*p, ' ')) ++p;
+                        }
+                        parse_line<T>(p, eol, ' ', &value, 1);
+                    }
+                    if (idx[0] < 1 || idx[1] < 1 || idx[0] > h.rows || idx[1] > h.cols)
+                        throw std::runtime_error("Matrix Market entry \"" + std::string(first, eol) + 
+                            "\" is out of range.");
+                    out.push_back(mtx_entry<T>{std::size_t(idx[0]) - 1, std::size_t(idx[1]) - 1, value});
+                }
+                first = eol + 1;
+            }
+        }
+
+        //! Builds a row-major matrix from the data lines of a Matrix Market
+        //! file.
+        template <typename T>
+        matrix<T> parse_mtx(const char* first, const char* last, unsigned threads) {
+            mtx_header h = parse_mtx_header(first, last);
+            const bool symmetric = h.symmetry != "general";
+            const T mirror_sign = h.symmetry == "skew-symmetric" ? T(-1) : T(1);
+            matrix<T> out(h.rows, h.cols, zeros);
+            T* dst = out.raw_data();
+
+            if (!h.coordinate) {
+                // Array files list the (lower triangle of the) matrix column
+                // after column, one value per line.
+                csv_options opts;
+                opts.delimiter = ' ';
+                opts.threads = threads;
+                std::size_t width = 0, count = 0;
+                std::vector<T, first_touch_allocator<T>> values;
+                parse_block(first, last, opts, width, count, values);
+                if (count && width != 1)
+                    throw std::runtime_error("Matrix Market array files must have one value per line.");
+                std::size_t n = h.rows;
+                std::size_t expected = !symmetric ? h.rows * h.cols :
+                    h.symmetry == "symmetric" ? n * (n + 1) / 2 : n * (n - 1) / 2;
+                if (count != expected)
+                    throw std::runtime_error("Matrix Market file has " + std::to_string(count) + 
+                        " values, expected " + std::to_string(expected) + ".");
+                if (!symmetric) {
+                    transpose_into(values.data(), h.cols, h.rows, dst);
+                    return out;
+                }
+                const T* v = values.data();
+                for (std::size_t j = 0; j != n; ++j)
+                    for (std::size_t i = h.symmetry == "symmetric" ? j : j + 1; i < n; ++i, ++v) {
+                        dst[i * n + j] = *v;
+                        dst[j * n + i] = i == j ? *v : mirror_sign * *v;
+                    }
+                return out;
+            }
+
+            std::vector<const char*> bounds = split_lines(first, last, threads);
+            std::vector<std::vector<mtx_entry<T>>> entries(bounds.size() - 1);
+            run_tasks(entries.size(), [&](std::size_t c) {
+                parse_mtx_entries(bounds[c], bounds[c + 1], h, entries[c]);
+            });
+            std::size_t count = 0;
+            for (const std::vector<mtx_entry<T>>& chunk: entries)
+                for (const mtx_entry<T>& e: chunk) {
+                    dst[e.i * h.cols + e.j] += e.value;
+                    if (symmetric && e.i != e.j)
+                        dst[e.j * h.cols + e.i] += mirror_sign * e.value;
+                    ++count;
+                }
+            if (count != h.entries)
+                throw std::runtime_error("Matrix Market file has " + std::to_string(count) + 
+                    " entries, expected " + std::to_string(h.entries) + ".");
+            return out;
+        }
+
+        //! Reads the rest of a stream into a string in one buffered pass.
+        inline std::string read_all(std::istream& is) {
+            std::string text;
+            std::istream::pos_type start = is.tellg();
+            std::streamoff size = -1;
+            if (start != std::istream::pos_type(-1) && is.seekg(0, std::ios::end))
+                size = is.tellg() - start;
+            if (size > 0) {
+                is.seekg(start);
+                text.resize(static_cast<std::size_t>(size));
+                is.read(&text[0], size);
+                text.resize(static_cast<std::size_t>(is.gcount()));
+            } else {
+                is.clear();
+                std::ostringstream ss;
+                ss << is.rdbuf();
+                text = ss.str();
+            }
+            return text;
+        }
+
+    }
+
+    //! Reads a Matrix Market matrix from a stream.
+    /*!
+        Supports the array and coordinate formats with real, integer and 
+        (coordinate only) pattern fields, and general, symmetric and
+        skew-symmetric matrices. The result is stored row after row, the layout
+        the multiply prefers, and coordinate files are expanded to a dense
+        matrix with duplicate entries summed. The data lines are parsed in 
+        parallel. Throws a std::runtime_error for malformed or unsupported 
+        files.
+        \param is the stream to read.
+        \param threads the number of parsing chunks, 0 for the threads of
+        current_context().
+    */
+    template <typename T>
+    matrix<T> load_mtx(std::istream& is, unsigned threads=0) {
+        std::string text = detail::read_all(is);
+        return detail::parse_mtx<T>(text.data(), text.data() + text.size(), threads);
+    }
+
+    //! Reads a Matrix Market (.mtx) file.
+    /*!
+        \param path the file to read.
+        \param threads the number of parsing chunks, 0 for the threads of
+        current_context().
+        \sa load_mtx(std::istream&, unsigned)
+    */
+    template <typename T>
+    matrix<T> load_mtx(const std::string& path, unsigned threads=0) {
+        std::ifstream is(path, std::ios::binary);
+        if (!is)
+            throw std::runtime_error("Cannot open " + path + " for reading.");
+        return load_mtx<T>(is, threads);
+    }
+
+    //! Writes a matrix to a stream in Matrix Market format.
+    /*!
+        Matrices are written as general matrices, with an integer field for
+        integral types and a real field otherwise.
+        \param mat the matrix to write.
+        \param os the stream to write to.
+        \param format array (every element) or coordinate (non-zeros only).
+        \param fmt how floating point values are written; the default 
+        round-trips exactly.
+    */
+    template <typename T>
+    void save_mtx(const matrix<T>& mat, std::ostream& os, mtx_format format=mtx_format::array,
+                  const format_options& fmt=format_options(format_options::notation::shortest)) {
+        using size_type = typename matrix<T>::size_type;
+        const size_type m = mat.shape().first, n = mat.shape().second;
+        const bool coordinate = format == mtx_format::coordinate;
+        size_type nnz = 0;
+        if (coordinate)
+            for (const T& x: mat)
+                nnz += x != T(0);
+
+        std::string header = std::string("%%MatrixMarket matrix ") + (coordinate ? "coordinate " : "array ") +
+            (std::is_floating_point<T>::value ? "real" : "integer") + " general\n" + 
+            std::to_string(m) + " " + std::to_string(n) + (coordinate ? " " + std::to_string(nnz) : "") + "\n";
+
+        {
+            detail::stream_sink sink(os);
+            sink.append(header.data(), header.size());
+            // Room for the separators after the indices and the number.
+            char index[2 * (std::numeric_limits<size_type>::digits10 + 2)];
+            char num[detail::max_number_chars<T> + 1];
+            for (size_type j = 0; j != n; ++j)
+                for (size_type i = 0; i != m; ++i) {
+                    T x = mat(i, j);
+                    if (coordinate) {
+                        if (x == T(0))
+                            continue;
+                        char* p = std::to_chars(index, index + sizeof(index) / 2 - 1, i + 1).ptr;
+                        *p++ = ' ';
+                        p = std::to_chars(p, index + sizeof(index) - 1, j + 1).ptr;
+                        *p++ = ' ';
+                        sink.append(index, p - index);
+                    }
+                    char* end = detail::format_number(num, num + detail::max_number_chars<T>, x, fmt,
+                        std::is_floating_point<T>());
+                    *end++ = '\n';
+                    sink.append(num, end - num);
+                }
+        }
+        if (!os)
+            throw std::runtime_error("Failed to write Matrix Market matrix.");
+    }
+
+    //! Writes a matrix to a Matrix Market (.mtx) file.
+    /*!
+        \param mat the matrix to write.
+        \param path the file to create or overwrite.
+        \param format array (every element) or coordinate (non-zeros only).
+        \sa save_mtx(const matrix<T>&, std::ostream&, mtx_format, const format_options&)
+    */
+    template <typename T>
+    void save_mtx(const matrix<T>& mat, const std::string& path, mtx_format format=mtx_format::array) {
+        std::ofstream os(path, std::ios::binary | std::ios::trunc);
+        if (!os)
+            throw std::runtime_error("Cannot open " + path + " for writing.");
+        save_mtx(mat, os, format);
+    }
+
+    namespace detail {
+
+        const char npy_magic[6] = {'\x93', 'N', 'U', 'M', 'P', 'Y'};
+
+        //! Returns the NumPy type string (e.g. "<f8") for T.
+        template <typename T>
+        std::string npy_descr() {
+            static_assert(std::is_arithmetic<T>::value, "NumPy files hold arithmetic types.");
+            char kind = std::is_floating_point<T>::value ? 'f' : std::is_signed<T>::value ? 'i' : 'u';
+            return std::string(sizeof(T) == 1 ? "|" : "<") + kind + std::to_string(sizeof(T));
+        }
+
+        //! The parts of a .npy header that MXL uses.
+        struct npy_header {
+            std::string descr;
+            bool fortran_order = false;
+            std::size_t rows = 0, cols = 0;
+            //! Offset of the data from the start of the file.
+            std::size_t data_offset = 0;
+        };
+
+        //! Returns the text after 'key': in the header dictionary.
+        inline std::string npy_value(const std::string& dict, const std::string& key) {
+            std::string::size_type k = dict.find("'" + key + "'");
+            if (k == std::string::npos)
+                throw std::runtime_error("NumPy header has no '" + key + "' entry.");
+            std::string::size_type colon = dict.find(':', k);
+            std::string::size_type v = dict.find_first_not_of(' ', colon + 1);
+            if (colon == std::string::npos || v == std::string::npos)
+                throw std::runtime_error("Malformed NumPy header.");
+            return dict.substr(v);
+        }
+
+        //! Parses the preamble and header dictionary of a .npy file.
+        /*!
+            \param first the start of the file.
+            \param size the number of bytes available at first.
+            \param prefix_only set when only the first 10 bytes are available;
+            then only the header length is read (into data_offset).
+        */
+        inline npy_header parse_npy_header(const char* first, std::size_t size, bool prefix_only=false) {
+            if (size < 10 || std::memcmp(first, npy_magic, sizeof(npy_magic)) != 0)
+                throw std::runtime_error("Not a NumPy .npy file.");
+            unsigned major = static_cast<unsigned char>(first[6]);
+            std::size_t len_bytes = major == 1 ? 2 : 4;
+            if (major < 1 || major > 3)
+                throw std::runtime_error("Unsupported .npy version " + std::to_string(major) + ".");
+            std::size_t header_len = 0;
+            for (std::size_t b = 0; b != len_bytes; ++b)
+                header_len |= std::size_t(static_cast<unsigned char>(first[8 + b])) << (8 * b);
+
+            npy_header h;
+            h.data_offset = 8 + len_bytes + header_len;
+            if (prefix_only)
+                return h;
+            if (size < h.data_offset)
+                throw std::runtime_error("NumPy .npy file is truncated.");
+            std::string dict(first + 8 + len_bytes, header_len);
+
+            std::string descr = npy_value(dict, "descr");
+            h.descr = descr.substr(1, descr.find(descr[0], 1) - 1);
+            h.fortran_order = npy_value(dict, "fortran_order").compare(0, 4, "True") == 0;
+
+            std::string shape = npy_value(dict, "shape");
+            shape = shape.substr(1, shape.find(')') - 1);
+            std::vector<std::size_t> dims;
+            std::istringstream ss(shape);
+            std::string dim;
+            while (std::getline(ss, dim, ','))
+                if (dim.find_first_not_of(' ') != std::string::npos)
+                    dims.push_back(std::stoull(dim));
+            if (dims.size() > 2)
+                throw std::runtime_error("Cannot load a " + std::to_string(dims.size()) + 
+                    "-dimensional NumPy array as a matrix.");
+            // 0-d arrays become 1 x 1 matrices, and 1-d arrays row vectors.
+            h.rows = dims.size() == 2 ? dims[0] : 1;
+            h.cols = dims.empty() ? 1 : dims.back();
+            return h;
+        }
+
+        //! Throws a std::runtime_error unless h describes a matrix<T>.
+        template <typename T>
+        void check_npy_header(const npy_header& h) {
+            std::string expected = npy_descr<T>();
+            std::string actual = h.descr;
+            if (!actual.empty() && actual[0] == '=')
+                actual[0] = expected[0];
+            if (actual != expected)
+                throw std::runtime_error("NumPy array has dtype '" + h.descr + "', expected '" + expected + "'.");
+            if (h.cols && h.rows > std::numeric_limits<std::size_t>::max() / sizeof(T) / h.cols)
+                throw std::runtime_error("NumPy array has too many elements.");
+        }
+
+        //! Builds a .npy version 1 preamble and header for mat, padded so the
+        //! data starts on a 64-byte boundary.
+        template <typename T>
+        std::string make_npy_header(const matrix<T>& mat) {
+            std::string dict = "{'descr': '" + npy_descr<T>() + "', 'fortran_order': " +
+                (mat.is_transposed() ? "True" : "False") + ", 'shape': (" + 
+                std::to_string(mat.shape().first) + ", " + std::to_string(mat.shape().second) + "), }";
+            std::size_t total = 10 + dict.size() + 1;
+            dict.append((64 - total % 64) % 64, ' ');
+            dict += '\n';
+            std::string out(npy_magic, sizeof(npy_magic));
+            out += '\x01';
+            out += '\x00';
+            out += static_cast<char>(dict.size() & 0xff);
+            out += static_cast<char>(dict.size() >> 8);
+            return out + dict;
+        }
+
+    }
+
+    //! Writes a matrix to a stream in NumPy .npy format.
+    /*!
+        The underlying container is written as-is: a transposed matrix is 
+        written with fortran_order set.
+        \param mat the matrix to write.
+        \param os the (binary) stream to write to.
+    */
+    template <typename T>
+    void save_npy(const matrix<T>& mat, std::ostream& os) {
+        std::string header = detail::make_npy_header(mat);
+        os.write(header.data(), header.size());
+        os.write(reinterpret_cast<const char*>(mat.raw_data()), 
+            mat.shape().first * mat.shape().second * sizeof(T));
+        if (!os)
+            throw std::runtime_error("Failed to write NumPy array.");
+    }
+
+    //! Writes a matrix to a NumPy .npy file.
+    /*!
+        \param mat the matrix to write.
+        \param path the file to create or overwrite.
+    */
+    template <typename T>
+    void save_npy(const matrix<T>& mat, const std::string& path) {
+        std::ofstream os(path, std::ios::binary | std::ios::trunc);
+        if (!os)
+            throw std::runtime_error("Cannot open " + path + " for writing.");
+        save_npy(mat, os);
+    }
+
+    //! Reads a NumPy .npy array from a stream.
+    /*!
+        The array's dtype must match T (e.g. '<f8' for double). Arrays in
+        fortran_order are loaded without reordering, as transposed matrices.
+        1-d arrays are loaded as row vectors. Throws a std::runtime_error
+        otherwise.
+        \param is the (binary) stream to read from.
+    */
+    template <typename T>
+    matrix<T> load_npy(std::istream& is) {
+        char prefix[10];
+        if (!is.read(prefix, sizeof(prefix)))
+            throw std::runtime_error("Not a NumPy .npy file.");
+        std::size_t offset = detail::parse_npy_header(prefix, sizeof(prefix), true).data_offset;
+        std::string header(prefix, sizeof(prefix));
+        header.resize(offset);
+        if (!is.read(&header[sizeof(prefix)], offset - sizeof(prefix)))
+            throw std::runtime_error("NumPy .npy file is truncated.");
+        detail::npy_header h = detail::parse_npy_header(header.data(), header.size());
+        detail::check_npy_header<T>(h);
+
+        const bool row_major = !h.fortran_order;
+        matrix<T> out(row_major ? h.rows : h.cols, row_major ? h.cols : h.rows);
+        if (!is.read(reinterpret_cast<char*>(out.raw_data()), h.rows * h.cols * sizeof(T)))
+            throw std::runtime_error("NumPy .npy file is truncated.");
+        if (!row_major)
+            out.transpose();
+        return out;
+    }
+
+    //! Reads a NumPy .npy file.
+    /*!
+        \param path the file to read.
+        \sa load_npy(std::istream&)
+    */
+    template <typename T>
+    matrix<T> load_npy(const std::string& path) {
+        std::ifstream is(path, std::ios::binary);
+        if (!is)
+            throw std::runtime_error("Cannot open " + path + " for reading.");
+        return load_npy<T>(is);
+    }
+
+#ifdef MXL_HAS_MMAP
+    //! Maps a NumPy .npy file into memory and returns a view of it, without
+    //! copying.
+    /*!
+        Same as load_mapped, but for .npy files: fortran_order arrays are viewed
+        as transposed. Throws a std::runtime_error if the dtype is not T.
+        \param path the file to map.
+    */
+    template <typename T>
+    matrix_view<T> load_npy_mapped(const std::string& path) {
+        std::shared_ptr<detail::mapped_file> file = std::make_shared<detail::mapped_file>(path);
+        detail::npy_header h = detail::parse_npy_header(file->data(), file->size());
+        detail::check_npy_header<T>(h);
+        if (file->size() < h.data_offset + h.rows * h.cols * sizeof(T))
+            throw std::runtime_error("NumPy .npy file is truncated.");
+        if (h.data_offset % alignof(T))
+            throw std::runtime_error("NumPy .npy data is not aligned for mapping; use load_npy.");
+        const T* first = reinterpret_cast<const T*>(file->data() + h.data_offset);
+        return matrix_view<T>(first, h.rows, h.cols, h.fortran_order, file);
+    }
+#endif
+
+}
@@ -8,6 +8,29 @@
    This is meant to be a single-header library that you can just drop in to your
    project.
 
+   Multiplication, addition and scaling run in parallel. The threads, the
+   executor they run on and the scratch memory they use are set with an
+   mxl::context, either passed explicitly or installed on the calling thread
+   with an mxl::context_scope. MXL starts its own thread pool only when
+   parallel work first needs it; a program with its own pool can hand it to
+   mxl::set_default_executor beforehand.
+
+   Defining MXL_INSTRUMENT (the MXL_INSTRUMENT CMake option) counts calls,
+   FLOPs, bytes, allocations and time for each operation; read them with
+   mxl::instrumentation_snapshot. Without it the counting compiles away.
+   Likewise MXL_TRACE records spans of operations and of the chunks, tasks
+   and tiles they run, for a Chrome trace (see mxl::start_tracing).
+
+   Optional modules live in separate headers next to mxl.hpp:
+   mxl/io.hpp adds binary, text, Matrix Market and NumPy file I/O,
+   mxl/tiled.hpp adds disk-backed tiled matrices for data larger than memory,
+   mxl/tasks.hpp adds a work-stealing task graph for tiled algorithms,
+   mxl/async.hpp adds asynchronous variants of long-running operations,
+   mxl/perf.hpp reads hardware performance counters on Linux,
+   mxl/autotune.hpp tunes the multiply kernel's blocking and the multiply
+   dispatcher's cost model for the host, and mxl/packed.hpp packs a right
+   operand once for many multiplications.
+
    \see
      \ref mxl    
      \ref mxl::matrix
@@ -15,20 +38,2191 @@
 #pragma once
 
 #include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
 #include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <cstdio>
+#include <exception>
+#include <fstream>
+#include <functional>
 #include <initializer_list>
 #include <iostream>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <mutex>
 #include <random>
+#include <sstream>
 #include <stdexcept>
 #include <string>
+#include <thread>
 #include <type_traits>
 #include <vector>
 
-//! MXL namespace  
-/*!
-    The MXL matrix class and related functions are under the mxl namespace.
-*/
-namespace mxl {
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#define MXL_HAS_AFFINITY 1
+#endif
+
+// Instrumentation and tracing hooks. They expand to nothing unless
+// MXL_INSTRUMENT or MXL_TRACE is defined, which must then be done for the
+// whole program (e.g. with the CMake options of the same names). See
+// mxl::instrumentation_snapshot and mxl::start_tracing.
+#if defined(MXL_INSTRUMENT) || defined(MXL_TRACE)
+#define MXL_HAS_PROBES 1
+#define MXL_PROBE(kind, flops, read, written) \
+    ::mxl::detail::op_probe mxl_probe_(::mxl::op_kind::kind, (flops), (read), (written))
+#define MXL_PROBE_WRITTEN(bytes) mxl_probe_.add_written(bytes)
+#else
+#define MXL_PROBE(kind, flops, read, written) ((void)0)
+#define MXL_PROBE_WRITTEN(bytes) ((void)0)
+#endif
+#ifdef MXL_INSTRUMENT
+#define MXL_COUNT_ALLOCATION(bytes) ::mxl::detail::count_allocation(bytes)
+#else
+#define MXL_COUNT_ALLOCATION(bytes) ((void)0)
+#endif
+#ifdef MXL_TRACE
+// Each span gets a name of its own line, so nested spans do not shadow.
+#define MXL_SPAN_NAME_(line) mxl_span_##line
+#define MXL_SPAN_NAME(line) MXL_SPAN_NAME_(line)
+#define MXL_TRACE_SPAN(...) ::mxl::detail::trace_span MXL_SPAN_NAME(__LINE__)(__VA_ARGS__)
+#else
+#define MXL_TRACE_SPAN(...) ((void)0)
+#endif
+
+//! MXL namespace  
+/*!
+    The MXL matrix class and related functions are under the mxl namespace.
+*/
+namespace mxl {
+
+    //! Implementation details that are not part of the public interface.
+    namespace detail {
+
+        //! SplitMix64 step, used to expand a single seed into generator state.
+        inline std::uint64_t splitmix64(std::uint64_t& x) {
+            std::uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            return z ^ (z >> 31);
+        }
+
+        //! A bank of independent xoshiro256** generators advanced in lockstep.
+        /*!
+            Each call to next() produces one 64-bit word per lane. The lanes are
+            stored as separate arrays so that the update loop has no
+            cross-iteration dependencies and is auto-vectorized by the compiler.
+        */
+        class xoshiro_lanes {
+        public:
+            //! The number of independent streams (and words per block).
+            static const std::size_t lanes = 8;
+
+            explicit xoshiro_lanes(std::uint64_t seed) {
+                for (std::size_t l = 0; l != lanes; ++l) {
+                    s0[l] = splitmix64(seed);
+                    s1[l] = splitmix64(seed);
+                    s2[l] = splitmix64(seed);
+                    s3[l] = splitmix64(seed);
+                }
+            }
+
+            //! Writes one word per lane to out.
+            void next(std::uint64_t* out) {
+                for (std::size_t l = 0; l != lanes; ++l) {
+                    std::uint64_t x = s1[l] * 5;
+                    out[l] = ((x << 7) | (x >> 57)) * 9;
+                    std::uint64_t t = s1[l] << 17;
+                    s2[l] ^= s0[l];
+                    s3[l] ^= s1[l];
+                    s1[l] ^= s2[l];
+                    s0[l] ^= s3[l];
+                    s2[l] ^= t;
+                    s3[l] = (s3[l] << 45) | (s3[l] >> 19);
+                }
+            }
+
+        private:
+            std::uint64_t s0[lanes], s1[lanes], s2[lanes], s3[lanes];
+        };
+
+        //! Maps the top 53 bits of a word to a double in [0, 1).
+        inline double to_unit(std::uint64_t x) {
+            return static_cast<double>(x >> 11) * (1.0 / 9007199254740992.0);
+        }
+
+        //! Returns the high 64 bits of the 128-bit product a * b.
+        inline std::uint64_t mul_high(std::uint64_t a, std::uint64_t b) {
+#if defined(__SIZEOF_INT128__)
+            return static_cast<std::uint64_t>((static_cast<unsigned __int128>(a) * b) >> 64);
+#else
+            const std::uint64_t a0 = a & 0xffffffff, a1 = a >> 32, b0 = b & 0xffffffff, b1 = b >> 32;
+            const std::uint64_t mid = (a0 * b0 >> 32) + (a1 * b0 & 0xffffffff) + a0 * b1;
+            return a1 * b1 + (a1 * b0 >> 32) + (mid >> 32);
+#endif
+        }
+
+        //! Bit-sliced Bernoulli sampler: 64 draws per call, one per bit.
+        /*!
+            Compares a fresh random fraction in every bit position against
+            threshold (p scaled to 2^32), most significant bit first. Lanes are
+            settled as soon as their random bit differs from p's, so the loop
+            usually ends after a handful of words.
+            \param gen the generator to draw words from.
+            \param threshold p * 2^32, truncated.
+        */
+        inline std::uint64_t bernoulli_word(xoshiro_lanes& gen, std::uint64_t threshold) {
+            if (threshold > 0xffffffffULL)
+                return ~0ULL;
+            std::uint64_t result = 0, undecided = ~0ULL;
+            std::uint64_t words[xoshiro_lanes::lanes];
+            std::size_t w = xoshiro_lanes::lanes;
+            for (int bit = 31; bit >= 0 && undecided; --bit) {
+                if (w == xoshiro_lanes::lanes) {
+                    gen.next(words);
+                    w = 0;
+                }
+                std::uint64_t r = words[w++];
+                if ((threshold >> bit) & 1) {
+                    result |= undecided & ~r;
+                    undecided &= r;
+                } else {
+                    undecided &= ~r;
+                }
+            }
+            return result;
+        }
+
+        //! Scales p in [0, 1] to the 32-bit threshold used by bernoulli_word.
+        inline std::uint64_t bernoulli_threshold(double p) {
+            if (p <= 0) return 0;
+            if (p >= 1) return 0xffffffffULL + 1;
+            return static_cast<std::uint64_t>(p * 4294967296.0);
+        }
+
+        //! Base class used to recognise the distribution types below.
+        struct distribution_base {};
+
+        //! Copies the rows x cols row-major array src into dst as its
+        //! cols x rows row-major transpose, a tile at a time.
+        template <typename T>
+        void transpose_into(const T* src, std::size_t rows, std::size_t cols, T* dst) {
+            const std::size_t tile = 32;
+            for (std::size_t i0 = 0; i0 < rows; i0 += tile)
+                for (std::size_t j0 = 0; j0 < cols; j0 += tile) {
+                    std::size_t i1 = std::min(rows, i0 + tile), j1 = std::min(cols, j0 + tile);
+                    for (std::size_t i = i0; i != i1; ++i)
+                        for (std::size_t j = j0; j != j1; ++j)
+                            dst[j * rows + i] = src[i * cols + j];
+                }
+        }
+
+        template <typename...>
+        struct make_void { typedef void type; };
+
+        //! Checks whether It names an iterator (has iterator_traits).
+        template <typename It, typename = void>
+        struct is_iterator: std::false_type {};
+
+        template <typename It>
+        struct is_iterator<It, typename make_void<
+            typename std::iterator_traits<It>::iterator_category>::type>: std::true_type {};
+
+    }
+
+    //! Checks whether D is one of the MXL random distributions.
+    template <typename D>
+    struct is_distribution: std::is_base_of<detail::distribution_base, D> {};
+
+    //! The seed used by the distribution constructors when none is given.
+    const std::uint64_t default_seed = 5489u;
+
+    //! Uniform distribution over [low, high).
+    /*!
+        For integral types it is over the integers in [low, high], inclusive
+        of high as in std::uniform_int_distribution, so the default gives 0s
+        and 1s and uniform(-0.5, 2.5) gives 0, 1 and 2. Filling an integral
+        matrix throws a std::domain_error if [low, high] holds no integer or
+        reaches beyond the range of the element type.
+    */
+    struct uniform: detail::distribution_base {
+        double low, high;
+        uniform(double low=0.0, double high=1.0): low(low), high(high) {}
+
+        template <typename T>
+        void fill(T* out, std::size_t n, std::uint64_t seed) const {
+            std::uint64_t base = 0, range = 0;
+            integer_bounds<T>(base, range);
+            detail::xoshiro_lanes gen(seed);
+            std::uint64_t words[detail::xoshiro_lanes::lanes];
+            const std::size_t L = detail::xoshiro_lanes::lanes;
+            for (std::size_t i = 0; i < n; i += L) {
+                gen.next(words);
+                std::size_t len = std::min(L, n - i);
+                for (std::size_t l = 0; l != len; ++l)
+                    out[i + l] = sample<T>(words[l], base, range);
+            }
+        }
+
+    private:
+        template <typename T>
+        typename std::enable_if<std::is_floating_point<T>::value>::type
+        integer_bounds(std::uint64_t&, std::uint64_t&) const {}
+
+        //! Sets base to the smallest integer in [low, high], as a two's
+        //! complement word, and range to the number of integers there. Both
+        //! bounds fit T and high is below 2^digits, so range is below 2^64.
+        template <typename T>
+        typename std::enable_if<!std::is_floating_point<T>::value>::type
+        integer_bounds(std::uint64_t& base, std::uint64_t& range) const {
+            const double lo = std::ceil(low), hi = std::floor(high);
+            const double limit = std::ldexp(1.0, std::numeric_limits<T>::digits);
+            if (!(lo <= hi) || lo < (std::numeric_limits<T>::is_signed ? -limit : 0.0) || hi >= limit)
+                throw std::domain_error("uniform(" + std::to_string(low) + ", " + std::to_string(high) +
+                    ") holds no integers of the matrix type.");
+            auto word = [](double x) {
+                return x < 0 ? static_cast<std::uint64_t>(static_cast<std::int64_t>(x)) :
+                    static_cast<std::uint64_t>(x);
+            };
+            base = word(lo);
+            range = word(hi) - base + 1;
+        }
+
+        template <typename T>
+        typename std::enable_if<std::is_floating_point<T>::value, T>::type
+        sample(std::uint64_t w, std::uint64_t, std::uint64_t) const {
+            return static_cast<T>(low + (high - low) * detail::to_unit(w));
+        }
+
+        //! Maps w to base plus an offset below range by taking the high word
+        //! of w * range, which is unbiased to within range / 2^64.
+        template <typename T>
+        typename std::enable_if<!std::is_floating_point<T>::value, T>::type
+        sample(std::uint64_t w, std::uint64_t base, std::uint64_t range) const {
+            return static_cast<T>(base + detail::mul_high(w, range));
+        }
+    };
+
+    //! Normal (Gaussian) distribution, sampled with a blocked Box-Muller
+    //! transform.
+    /*!
+        Uniform words are produced a block at a time by independent generator
+        lanes, and each pair of them yields two normal variates. Only floating
+        point element types are supported.
+    */
+    struct normal: detail::distribution_base {
+        double mean, stddev;
+        normal(double mean=0.0, double stddev=1.0): mean(mean), stddev(stddev) {}
+
+        template <typename T>
+        void fill(T* out, std::size_t n, std::uint64_t seed) const {
+            static_assert(std::is_floating_point<T>::value,
+                "mxl::normal requires a floating point matrix type.");
+            const std::size_t L = detail::xoshiro_lanes::lanes;
+            const double two_pi = 6.283185307179586;
+            detail::xoshiro_lanes gen(seed);
+            std::uint64_t a[L], b[L];
+            double z0[L], z1[L];
+
+            for (std::size_t i = 0; i < n; i += 2 * L) {
+                gen.next(a);
+                gen.next(b);
+                for (std::size_t l = 0; l != L; ++l) {
+                    // 1 - u keeps the argument of log strictly positive.
+                    double r = std::sqrt(-2.0 * std::log(1.0 - detail::to_unit(a[l])));
+                    double theta = two_pi * detail::to_unit(b[l]);
+                    z0[l] = mean + stddev * r * std::cos(theta);
+                    z1[l] = mean + stddev * r * std::sin(theta);
+                }
+                std::size_t len = std::min(2 * L, n - i);
+                for (std::size_t l = 0; l != len; ++l)
+                    out[i + l] = static_cast<T>(l < L ? z0[l] : z1[l - L]);
+            }
+        }
+    };
+
+    //! Bernoulli distribution: 1 with probability p, otherwise 0.
+    /*!
+        Samples are generated 64 at a time with a bit-sliced comparison, so p
+        is resolved to 32 bits of precision.
+    */
+    struct bernoulli: detail::distribution_base {
+        double p;
+        bernoulli(double p=0.5): p(p) {}
+
+        template <typename T>
+        void fill(T* out, std::size_t n, std::uint64_t seed) const {
+            detail::xoshiro_lanes gen(seed);
+            const std::uint64_t threshold = detail::bernoulli_threshold(p);
+            for (std::size_t i = 0; i < n; i += 64) {
+                std::uint64_t bits = detail::bernoulli_word(gen, threshold);
+                std::size_t len = std::min<std::size_t>(64, n - i);
+                for (std::size_t j = 0; j != len; ++j)
+                    out[i + j] = static_cast<T>((bits >> j) & 1);
+            }
+        }
+    };
+
+    //! Sparse sign distribution: +scale or -scale (equally likely) with
+    //! probability density, otherwise 0.
+    /*!
+        This is the usual sparse random projection (Achlioptas) distribution.
+        Like bernoulli, the non-zero pattern is drawn 64 elements at a time.
+    */
+    struct sparse_sign: detail::distribution_base {
+        double density, scale;
+        sparse_sign(double density, double scale=1.0): density(density), scale(scale) {}
+
+        template <typename T>
+        void fill(T* out, std::size_t n, std::uint64_t seed) const {
+            static_assert(std::is_signed<T>::value,
+                "mxl::sparse_sign requires a signed matrix type.");
+            detail::xoshiro_lanes gen(seed);
+            const std::uint64_t threshold = detail::bernoulli_threshold(density);
+            const T pos = static_cast<T>(scale), neg = static_cast<T>(-scale);
+            std::uint64_t signs[detail::xoshiro_lanes::lanes];
+            std::size_t s = detail::xoshiro_lanes::lanes;
+            for (std::size_t i = 0; i < n; i += 64) {
+                std::uint64_t mask = detail::bernoulli_word(gen, threshold);
+                if (s == detail::xoshiro_lanes::lanes) {
+                    gen.next(signs);
+                    s = 0;
+                }
+                std::uint64_t sign = signs[s++];
+                std::size_t len = std::min<std::size_t>(64, n - i);
+                for (std::size_t j = 0; j != len; ++j) {
+                    T v = ((sign >> j) & 1) ? pos : neg;
+                    out[i + j] = ((mask >> j) & 1) ? v : T(0);
+                }
+            }
+        }
+    };
+
+    //! Controls how matrix elements are written by matrix::to_string,
+    //! matrix::print and operator<<.
+    /*!
+        Integral elements are always written in full; the notation and
+        precision only apply to floating point elements. The defaults reproduce
+        std::to_string (fixed notation with 6 decimals).
+    */
+    struct format_options {
+        //! Floating point notations, as in std::chars_format.
+        enum class notation { fixed, scientific, general, shortest };
+
+        //! The notation used for floating point elements.
+        notation style = notation::fixed;
+        //! Digits after the decimal point (fixed, scientific) or significant
+        //! digits (general). Ignored by shortest. Clamped to [0, 64].
+        int precision = 6;
+
+        format_options() {}
+        format_options(notation style, int precision=6): style(style), precision(precision) {}
+    };
+
+    namespace detail {
+
+        //! Large enough for any T written under format_options: in fixed
+        //! notation, the largest finite value has max_exponent10 + 1 digits
+        //! before the point and at most 64 after it, plus a sign and a point.
+        template <typename T>
+        constexpr std::size_t max_number_chars = std::numeric_limits<T>::max_exponent10 + 80;
+
+        //! Returns the end of the text std::to_chars wrote, and throws a
+        //! std::length_error if it did not fit.
+        inline char* formatted(std::to_chars_result r) {
+            if (r.ec != std::errc())
+                throw std::length_error("Matrix element does not fit its text buffer.");
+            return r.ptr;
+        }
+
+        //! Writes an integral value with std::to_chars.
+        template <typename T>
+        char* format_number(char* first, char* last, T value, const format_options&, std::false_type) {
+            return formatted(std::to_chars(first, last, value));
+        }
+
+        //! Writes a floating point value with std::to_chars.
+        template <typename T>
+        char* format_number(char* first, char* last, T value, const format_options& fmt, std::true_type) {
+            int precision = std::min(std::max(fmt.precision, 0), 64);
+            switch (fmt.style) {
+            case format_options::notation::fixed:
+                return formatted(std::to_chars(first, last, value, std::chars_format::fixed, precision));
+            case format_options::notation::scientific:
+                return formatted(std::to_chars(first, last, value, std::chars_format::scientific, precision));
+            case format_options::notation::general:
+                return formatted(std::to_chars(first, last, value, std::chars_format::general, precision));
+            default:
+                return formatted(std::to_chars(first, last, value));
+            }
+        }
+
+        //! Appends formatted text to a std::string.
+        class string_sink {
+        public:
+            explicit string_sink(std::string& out): out(out) {}
+            void append(const char* p, std::size_t n) { out.append(p, n); }
+        private:
+            std::string& out;
+        };
+
+        //! Collects formatted text in a fixed buffer and writes it to a stream
+        //! in large blocks.
+        class stream_sink {
+        public:
+            explicit stream_sink(std::ostream& os): os(os), len(0), total(0) {}
+            ~stream_sink() { flush(); }
+
+            void append(const char* p, std::size_t n) {
+                total += n;
+                if (len + n > sizeof(buf))
+                    flush();
+                if (n > sizeof(buf)) {
+                    os.write(p, n);
+                    return;
+                }
+                std::copy(p, p + n, buf + len);
+                len += n;
+            }
+
+            void flush() {
+                os.write(buf, len);
+                len = 0;
+            }
+
+            //! Returns the number of characters appended so far.
+            std::size_t written() const { return total; }
+
+        private:
+            std::ostream& os;
+            char buf[1 << 16];
+            std::size_t len;
+            std::size_t total;
+        };
+
+    }
+
+    //! Tag type for a matrix of 0s. Use the mxl::zeros constant.
+    struct zeros_t { explicit constexpr zeros_t() {} };
+    //! Tag type for a matrix of 1s. Use the mxl::ones constant.
+    struct ones_t { explicit constexpr ones_t() {} };
+    //! Tag type for an identity-like matrix. Use the mxl::identity constant.
+    struct identity_t { explicit constexpr identity_t() {} };
+
+    //! Selects the matrix(m, n, zeros_t) constructor.
+    constexpr zeros_t zeros{};
+    //! Selects the matrix(m, n, ones_t) constructor.
+    constexpr ones_t ones{};
+    //! Selects the matrix(m, n, identity_t) constructor.
+    constexpr identity_t identity{};
+
+    //! Tag type pairing a distribution with a seed. Use mxl::random() to
+    //! create one.
+    template <typename Distribution>
+    struct random_t {
+        std::uint64_t seed;
+        Distribution dist;
+    };
+
+    //! Creates a random initializer tag.
+    /*!
+        \param seed the seed for the generator.
+        \param dist the distribution to sample from (mxl::uniform by default).
+    */
+    template <typename Distribution=uniform>
+    random_t<Distribution> random(std::uint64_t seed=default_seed, const Distribution& dist=Distribution()) {
+        static_assert(is_distribution<Distribution>::value,
+            "mxl::random expects an MXL distribution.");
+        return random_t<Distribution>{seed, dist};
+    }
+
+    //! The operations counted by the instrumentation layer.
+    enum class op_kind {
+        multiply,             //!< operator*= with a matrix
+        add,                  //!< operator+=
+        scale,                //!< operator*= with a scalar
+        transpose_copy,       //!< transpose_copy
+        copy,                 //!< copy construction and assignment
+        initialize_value,     //!< constructors filling one value (or zeros, ones)
+        initialize_identity,  //!< identity constructors
+        initialize_random,    //!< random and distribution constructors
+        initialize_vector,    //!< constructors reshaping a vector or range
+        initialize_rows,      //!< constructors from rows (2-D vectors, lists)
+        format                //!< to_string and print
+    };
+
+    //! What the instrumentation layer counted for one operation.
+    struct op_stats {
+        //! The operation, e.g. "multiply".
+        const char* name;
+        //! Number of calls.
+        std::uint64_t calls;
+        //! Floating point (or integer) arithmetic operations.
+        std::uint64_t flops;
+        //! Bytes of elements read, counting each operand once.
+        std::uint64_t bytes_read;
+        //! Bytes written: elements, or characters for format.
+        std::uint64_t bytes_written;
+        //! Heap allocations of matrix storage and scratch buffers.
+        std::uint64_t allocations;
+        //! Bytes of those allocations.
+        std::uint64_t bytes_allocated;
+        //! Wall time, including nested operations.
+        std::uint64_t time_ns;
+        //! CPU cycles on the calling thread; see enable_perf_instrumentation().
+        std::uint64_t cycles;
+        //! Instructions retired on the calling thread.
+        std::uint64_t instructions;
+        //! Last-level cache misses on the calling thread.
+        std::uint64_t cache_misses;
+        //! Mispredicted branches on the calling thread.
+        std::uint64_t branch_misses;
+    };
+
+    namespace detail {
+
+        const std::size_t num_op_kinds = static_cast<std::size_t>(op_kind::format) + 1;
+
+        inline const char* op_name(std::size_t k) {
+            static const char* const names[num_op_kinds] = {"multiply", "add", "scale", "transpose_copy",
+                "copy", "initialize_value", "initialize_identity", "initialize_random", "initialize_vector",
+                "initialize_rows", "format"};
+            return names[k];
+        }
+
+        //! Lock-free counters for one operation.
+        struct op_counters {
+            std::atomic<std::uint64_t> calls{0}, flops{0}, bytes_read{0}, bytes_written{0}, allocations{0},
+                bytes_allocated{0}, time_ns{0}, cycles{0}, instructions{0}, cache_misses{0}, branch_misses{0};
+        };
+
+        //! The hardware counters an op_probe can sample: cycles,
+        //! instructions, cache misses and branch misses, in that order.
+        const std::size_t num_hw_counters = 4;
+
+        //! Reads the calling thread's hardware counters into its argument, or
+        //! returns false if they are not available.
+        using hardware_sampler_fn = bool (*)(std::uint64_t*);
+
+        //! The sampler op_probe uses, or null. Set by perf.hpp.
+        inline std::atomic<hardware_sampler_fn>& hardware_sampler() {
+            static std::atomic<hardware_sampler_fn> sampler{nullptr};
+            return sampler;
+        }
+
+        inline op_counters* instrumentation_counters() {
+            static op_counters counters[num_op_kinds];
+            return counters;
+        }
+
+        //! The counters of the innermost operation running on this thread.
+        inline op_counters*& current_op() {
+            thread_local op_counters* op = nullptr;
+            return op;
+        }
+
+        //! Returns the name of the operation whose counters are op.
+        inline const char* op_name(const op_counters* op) {
+            return op ? op_name(static_cast<std::size_t>(op - instrumentation_counters())) : "parallel_for";
+        }
+
+        //! One finished span of a trace.
+        struct trace_event {
+            const char* name;
+            const char* category;
+            const char* arg_names[2];
+            std::uint64_t args[2];
+            std::uint64_t start_ns;
+            std::uint64_t duration_ns;
+        };
+
+        //! The spans recorded by one thread.
+        /*!
+            Only the owning thread writes, so pushing takes no lock; when the
+            ring is full the oldest spans are overwritten.
+        */
+        struct trace_ring {
+            static const std::size_t capacity = std::size_t(1) << 16;
+
+            explicit trace_ring(std::size_t tid): tid(tid), events(new trace_event[capacity]), head(0) {}
+
+            void push(const trace_event& e) {
+                std::uint64_t h = head.load(std::memory_order_relaxed);
+                events[h & (capacity - 1)] = e;
+                head.store(h + 1, std::memory_order_release);
+            }
+
+            std::size_t tid;
+            std::unique_ptr<trace_event[]> events;
+            std::atomic<std::uint64_t> head;
+        };
+
+        //! Every thread's ring, and whether tracing is on.
+        struct trace_registry {
+            std::mutex m;
+            std::vector<std::shared_ptr<trace_ring>> rings;
+            std::atomic<bool> enabled{false};
+            std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+        };
+
+        inline trace_registry& tracer() {
+            static trace_registry registry;
+            return registry;
+        }
+
+        //! Returns the calling thread's ring, registering it on first use. The
+        //! registry keeps it after the thread exits.
+        inline trace_ring* this_thread_ring() {
+            thread_local std::shared_ptr<trace_ring> ring;
+            if (!ring) {
+                trace_registry& t = tracer();
+                std::lock_guard<std::mutex> lock(t.m);
+                ring = std::make_shared<trace_ring>(t.rings.size() + 1);
+                t.rings.push_back(ring);
+            }
+            return ring.get();
+        }
+
+        //! Records a span from construction to destruction while tracing is
+        //! on. Names must be string literals (or otherwise outlive the trace).
+        class trace_span {
+        public:
+            explicit trace_span(const char* name, const char* category="op", const char* key0=nullptr,
+                                std::uint64_t arg0=0, const char* key1=nullptr, std::uint64_t arg1=0):
+                ring(tracer().enabled.load(std::memory_order_relaxed) ? this_thread_ring() : nullptr) {
+                if (ring)
+                    e = trace_event{name, category, {key0, key1}, {arg0, arg1}, now(), 0};
+            }
+
+            ~trace_span() {
+                if (ring) {
+                    e.duration_ns = now() - e.start_ns;
+                    ring->push(e);
+                }
+            }
+
+            trace_span(const trace_span&) = delete;
+            trace_span& operator=(const trace_span&) = delete;
+
+        private:
+            static std::uint64_t now() {
+                return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - tracer().epoch).count();
+            }
+
+            trace_ring* ring;
+            trace_event e;
+        };
+
+        //! Marks an operation for the instrumentation counters and the trace
+        //! for its lifetime. Work it hands to other threads is charged to it.
+        class op_probe {
+        public:
+            op_probe(op_kind kind, std::uint64_t flops, std::uint64_t read, std::uint64_t written):
+                counters(&instrumentation_counters()[static_cast<std::size_t>(kind)]), previous(current_op())
+#ifdef MXL_TRACE
+                , span(op_name(static_cast<std::size_t>(kind)))
+#endif
+            {
+#ifdef MXL_INSTRUMENT
+                start = std::chrono::steady_clock::now();
+                counters->calls.fetch_add(1, std::memory_order_relaxed);
+                counters->flops.fetch_add(flops, std::memory_order_relaxed);
+                counters->bytes_read.fetch_add(read, std::memory_order_relaxed);
+                counters->bytes_written.fetch_add(written, std::memory_order_relaxed);
+                sampler = hardware_sampler().load(std::memory_order_relaxed);
+                if (sampler && !sampler(hw))
+                    sampler = nullptr;
+#else
+                (void)flops, (void)read, (void)written;
+#endif
+                current_op() = counters;
+            }
+
+            ~op_probe() {
+#ifdef MXL_INSTRUMENT
+                std::chrono::nanoseconds t = std::chrono::steady_clock::now() - start;
+                counters->time_ns.fetch_add(t.count(), std::memory_order_relaxed);
+                std::uint64_t end[num_hw_counters];
+                if (sampler && sampler(end)) {
+                    std::atomic<std::uint64_t>* totals[num_hw_counters] = {&counters->cycles, &counters->instructions,
+                        &counters->cache_misses, &counters->branch_misses};
+                    for (std::size_t k = 0; k != num_hw_counters; ++k)
+                        totals[k]->fetch_add(end[k] - hw[k], std::memory_order_relaxed);
+                }
+#endif
+                current_op() = previous;
+            }
+
+            op_probe(const op_probe&) = delete;
+            op_probe& operator=(const op_probe&) = delete;
+
+            void add_written(std::uint64_t bytes) {
+#ifdef MXL_INSTRUMENT
+                counters->bytes_written.fetch_add(bytes, std::memory_order_relaxed);
+#else
+                (void)bytes;
+#endif
+            }
+
+        private:
+            op_counters* counters;
+            op_counters* previous;
+            std::chrono::steady_clock::time_point start;
+            hardware_sampler_fn sampler = nullptr;
+            std::uint64_t hw[num_hw_counters];
+#ifdef MXL_TRACE
+            trace_span span;
+#endif
+        };
+
+        //! Charges an allocation to the operation running on this thread.
+        inline void count_allocation(std::size_t bytes) {
+            if (op_counters* op = current_op()) {
+                op->allocations.fetch_add(1, std::memory_order_relaxed);
+                op->bytes_allocated.fetch_add(bytes, std::memory_order_relaxed);
+            }
+        }
+
+    }
+
+    //! Returns whether MXL was compiled with MXL_INSTRUMENT.
+    inline constexpr bool instrumentation_enabled() {
+#ifdef MXL_INSTRUMENT
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    //! Returns the counters of every operation since the start of the
+    //! program (or the last reset_instrumentation()).
+    /*!
+        Counting is compiled in only when MXL_INSTRUMENT is defined; otherwise
+        every counter reads 0. Counters are updated with relaxed atomics, so a
+        snapshot taken while operations run may mix counts from before and
+        after an operation. Work done by worker threads is charged to the
+        operation that started it.
+    */
+    inline std::vector<op_stats> instrumentation_snapshot() {
+        std::vector<op_stats> out;
+        const detail::op_counters* c = detail::instrumentation_counters();
+        for (std::size_t k = 0; k != detail::num_op_kinds; ++k)
+            out.push_back(op_stats{detail::op_name(k), c[k].calls.load(), c[k].flops.load(), c[k].bytes_read.load(),
+                c[k].bytes_written.load(), c[k].allocations.load(), c[k].bytes_allocated.load(),
+                c[k].time_ns.load(), c[k].cycles.load(), c[k].instructions.load(), c[k].cache_misses.load(),
+                c[k].branch_misses.load()});
+        return out;
+    }
+
+    //! Sets every instrumentation counter to 0.
+    inline void reset_instrumentation() {
+        detail::op_counters* c = detail::instrumentation_counters();
+        for (std::size_t k = 0; k != detail::num_op_kinds; ++k)
+            for (std::atomic<std::uint64_t>* v: {&c[k].calls, &c[k].flops, &c[k].bytes_read, &c[k].bytes_written,
+                                                 &c[k].allocations, &c[k].bytes_allocated, &c[k].time_ns,
+                                                 &c[k].cycles, &c[k].instructions, &c[k].cache_misses,
+                                                 &c[k].branch_misses})
+                v->store(0);
+    }
+
+    //! Starts recording trace spans, discarding earlier ones.
+    /*!
+        Spans are recorded only when MXL is compiled with MXL_TRACE: one per
+        operation (multiply, add, ...) and one per chunk, task or tile step
+        that operation runs, on whichever thread ran it. Each thread keeps
+        its last 65536 spans. Call it while no MXL work is running.
+    */
+    inline void start_tracing() {
+        detail::trace_registry& t = detail::tracer();
+        std::lock_guard<std::mutex> lock(t.m);
+        for (const std::shared_ptr<detail::trace_ring>& r: t.rings)
+            r->head.store(0);
+        t.enabled = true;
+    }
+
+    //! Stops recording trace spans.
+    inline void stop_tracing() { detail::tracer().enabled = false; }
+
+    //! Returns whether MXL was compiled with MXL_TRACE.
+    inline constexpr bool tracing_enabled() {
+#ifdef MXL_TRACE
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    //! Writes the recorded spans in the Chrome trace event format.
+    /*!
+        Load the output in chrome://tracing or https://ui.perfetto.dev. Each
+        MXL thread is a track; timestamps are microseconds since the program
+        started. Call it after stop_tracing(), once the traced work is done.
+        \param os the stream to write to.
+    */
+    inline void write_chrome_trace(std::ostream& os) {
+        detail::trace_registry& t = detail::tracer();
+        std::lock_guard<std::mutex> lock(t.m);
+        os << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [";
+        const char* sep = "\n";
+        char num[64];
+        for (const std::shared_ptr<detail::trace_ring>& r: t.rings) {
+            std::uint64_t head = r->head.load(std::memory_order_acquire);
+            std::uint64_t first = head > detail::trace_ring::capacity ? head - detail::trace_ring::capacity : 0;
+            for (std::uint64_t i = first; i != head; ++i) {
+                const detail::trace_event& e = r->events[i & (detail::trace_ring::capacity - 1)];
+                os << sep << "{\"name\": \"" << e.name << "\", \"cat\": \"" << e.category
+                   << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << r->tid;
+                std::snprintf(num, sizeof(num), "%.3f", e.start_ns / 1e3);
+                os << ", \"ts\": " << num;
+                std::snprintf(num, sizeof(num), "%.3f", e.duration_ns / 1e3);
+                os << ", \"dur\": " << num << ", \"args\": {";
+                for (int a = 0; a != 2 && e.arg_names[a]; ++a)
+                    os << (a ? ", " : "") << "\"" << e.arg_names[a] << "\": " << e.args[a];
+                os << "}}";
+                sep = ",\n";
+            }
+        }
+        os << "\n]}\n";
+    }
+
+    //! Writes the recorded spans to a file. See write_chrome_trace(std::ostream&).
+    /*!
+        Throws a std::runtime_error if the file cannot be written.
+        \param path the file to write.
+    */
+    inline void write_chrome_trace(const std::string& path) {
+        std::ofstream os(path);
+        write_chrome_trace(os);
+        if (!os)
+            throw std::runtime_error("Cannot write trace file " + path + ".");
+    }
+
+    //! Runs the tasks of MXL's parallel operations.
+    /*!
+        Implement this interface to run MXL's work on your own thread pool, and
+        pass it to MXL through a context. MXL never blocks inside a task waiting
+        for another task, and the thread that starts an operation takes part
+        in it, so an executor that runs tasks late (or inline) is fine.
+    */
+    class executor {
+    public:
+        virtual ~executor() {}
+
+        //! Runs task, now or later, on any thread.
+        virtual void submit(std::function<void()> task) = 0;
+
+        //! Returns the number of tasks the executor can run at once.
+        virtual std::size_t concurrency() const = 0;
+    };
+
+    //! Returns the CPUs the calling thread may run on, in increasing order.
+    /*!
+        Returns an empty vector where thread affinity is not supported.
+    */
+    inline std::vector<int> available_cpus() {
+        std::vector<int> cpus;
+#ifdef MXL_HAS_AFFINITY
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (!pthread_getaffinity_np(pthread_self(), sizeof(set), &set))
+            for (int c = 0; c != CPU_SETSIZE; ++c)
+                if (CPU_ISSET(c, &set))
+                    cpus.push_back(c);
+#endif
+        return cpus;
+    }
+
+    //! Pins the calling thread to one CPU.
+    /*!
+        \param cpu the CPU to run on.
+        \return false if the CPU was refused or affinity is not supported.
+    */
+    inline bool pin_thread(int cpu) {
+#ifdef MXL_HAS_AFFINITY
+        if (cpu < 0 || cpu >= CPU_SETSIZE)
+            return false;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        return !pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+        (void)cpu;
+        return false;
+#endif
+    }
+
+    //! A fixed-size pool of worker threads; the default executor.
+    class thread_pool: public executor {
+    public:
+        //! Constructor that starts the worker threads.
+        /*!
+            With pin set, worker t is pinned to the (t + 1)-th available CPU
+            (wrapping around), leaving the first for the thread that calls into
+            MXL. Pinned workers keep touching the same memory from the same
+            core, so pages placed by first touch stay local to their NUMA node.
+            Pinning is skipped where affinity is not supported.
+            \param threads the number of workers.
+            \param pin whether to pin each worker to its own CPU.
+        */
+        explicit thread_pool(std::size_t threads, bool pin=false): q(std::make_shared<queue>()) {
+            std::vector<int> cpus;
+            if (pin)
+                cpus = available_cpus();
+            for (std::size_t t = 0; t != threads; ++t) {
+                int cpu = cpus.empty() ? -1 : cpus[(t + 1) % cpus.size()];
+                std::shared_ptr<queue> shared = q;
+                workers.emplace_back([shared, cpu] {
+                    if (cpu >= 0)
+                        pin_thread(cpu);
+                    run(*shared);
+                });
+            }
+        }
+
+        //! Finishes the queued tasks and stops the workers.
+        /*!
+            The pool may be destroyed by one of its own tasks (for example when
+            a task holds the last context using it); that worker is detached
+            and exits once the queue is empty.
+        */
+        ~thread_pool() {
+            {
+                std::lock_guard<std::mutex> lock(q->m);
+                q->stopping = true;
+            }
+            q->ready.notify_all();
+            for (std::thread& w: workers)
+                if (w.get_id() == std::this_thread::get_id())
+                    w.detach();
+                else
+                    w.join();
+        }
+
+        thread_pool(const thread_pool&) = delete;
+        thread_pool& operator=(const thread_pool&) = delete;
+
+        void submit(std::function<void()> task) override {
+            {
+                std::lock_guard<std::mutex> lock(q->m);
+                q->tasks.push_back(std::move(task));
+            }
+            q->ready.notify_one();
+        }
+
+        std::size_t concurrency() const override { return workers.size(); }
+
+    private:
+        //! The task queue, shared with the workers so it outlives the pool.
+        struct queue {
+            std::mutex m;
+            std::condition_variable ready;
+            std::deque<std::function<void()>> tasks;
+            bool stopping = false;
+        };
+
+        static void run(queue& q) {
+            while (true) {
+                std::function<void()> task;
+                {
+                    std::unique_lock<std::mutex> lock(q.m);
+                    q.ready.wait(lock, [&q] { return q.stopping || !q.tasks.empty(); });
+                    if (q.tasks.empty())
+                        return;
+                    task = std::move(q.tasks.front());
+                    q.tasks.pop_front();
+                }
+                task();
+            }
+        }
+
+        std::shared_ptr<queue> q;
+        std::vector<std::thread> workers;
+    };
+
+    //! A thread-safe pool of reusable scratch buffers for kernels.
+    /*!
+        Buffers handed out by acquire() go back to the pool when released, so
+        repeated operations reuse memory instead of allocating it each time.
+    */
+    class workspace {
+    public:
+        //! Alignment of every buffer, in bytes.
+        static const std::size_t alignment = 64;
+
+        //! A scratch buffer; returned to its workspace on destruction.
+        class buffer {
+        public:
+            buffer(): owner(nullptr), size(0) {}
+            buffer(buffer&& other): owner(other.owner), mem(std::move(other.mem)), size(other.size) {
+                other.owner = nullptr;
+            }
+            buffer& operator=(buffer&& other) {
+                release();
+                owner = other.owner;
+                mem = std::move(other.mem);
+                size = other.size;
+                other.owner = nullptr;
+                return *this;
+            }
+            ~buffer() { release(); }
+
+            //! Returns the buffer as an array of T, aligned to 64 bytes.
+            template <typename T>
+            T* as() const {
+                std::uintptr_t p = reinterpret_cast<std::uintptr_t>(mem.get());
+                return reinterpret_cast<T*>((p + alignment - 1) & ~std::uintptr_t(alignment - 1));
+            }
+
+            //! Returns the usable size in bytes.
+            std::size_t bytes() const { return size; }
+
+        private:
+            friend class workspace;
+            buffer(workspace* owner, std::unique_ptr<unsigned char[]> mem, std::size_t size):
+                owner(owner), mem(std::move(mem)), size(size) {}
+
+            void release() {
+                if (owner && mem)
+                    owner->give_back(std::move(mem), size);
+                owner = nullptr;
+            }
+
+            workspace* owner;
+            std::unique_ptr<unsigned char[]> mem;
+            std::size_t size;
+        };
+
+        workspace(): held(0) {}
+        workspace(const workspace&) = delete;
+        workspace& operator=(const workspace&) = delete;
+
+        //! Returns a buffer of at least bytes bytes, reusing a free one if
+        //! possible.
+        buffer acquire(std::size_t bytes) {
+            std::lock_guard<std::mutex> lock(m);
+            for (std::size_t b = 0; b != free_list.size(); ++b)
+                if (free_list[b].first >= bytes) {
+                    std::pair<std::size_t, std::unique_ptr<unsigned char[]>> block = std::move(free_list[b]);
+                    free_list.erase(free_list.begin() + b);
+                    return buffer(this, std::move(block.second), block.first);
+                }
+            held += bytes;
+            MXL_COUNT_ALLOCATION(bytes + alignment);
+            return buffer(this, std::unique_ptr<unsigned char[]>(new unsigned char[bytes + alignment]), bytes);
+        }
+
+        //! Returns the total size of the buffers created by this workspace.
+        std::size_t bytes_held() const {
+            std::lock_guard<std::mutex> lock(m);
+            return held;
+        }
+
+        //! Frees the buffers that are not in use.
+        void trim() {
+            std::lock_guard<std::mutex> lock(m);
+            for (const std::pair<std::size_t, std::unique_ptr<unsigned char[]>>& block: free_list)
+                held -= block.first;
+            free_list.clear();
+        }
+
+    private:
+        void give_back(std::unique_ptr<unsigned char[]> mem, std::size_t size) {
+            std::lock_guard<std::mutex> lock(m);
+            free_list.emplace_back(size, std::move(mem));
+        }
+
+        mutable std::mutex m;
+        std::vector<std::pair<std::size_t, std::unique_ptr<unsigned char[]>>> free_list;
+        std::size_t held;
+    };
+
+    //! Thrown by an operation that stopped because its context's
+    //! cancellation token was cancelled.
+    class operation_cancelled: public std::runtime_error {
+    public:
+        operation_cancelled(): std::runtime_error("MXL operation cancelled.") {}
+    };
+
+    //! Lets one thread ask running operations to stop.
+    /*!
+        Set it as the cancel member of a context. Operations check it between
+        chunks of work (a few microseconds to milliseconds apart), stop, and
+        throw mxl::operation_cancelled, leaving their output unchanged.
+    */
+    class cancellation_token {
+    public:
+        //! Asks every operation watching this token to stop.
+        void cancel() noexcept { flag.store(true, std::memory_order_relaxed); }
+
+        //! Returns whether cancel() has been called since the last reset().
+        bool cancelled() const noexcept { return flag.load(std::memory_order_relaxed); }
+
+        //! Makes the token usable again.
+        void reset() noexcept { flag.store(false, std::memory_order_relaxed); }
+
+    private:
+        std::atomic<bool> flag{false};
+    };
+
+    namespace detail {
+
+        //! The executor behind default_executor(). Forwards tasks to the one
+        //! given to set_default_executor(), or else to a thread_pool that it
+        //! starts when the first task is submitted.
+        class default_pool: public executor {
+        public:
+            void submit(std::function<void()> task) override {
+                executor* e = target.load(std::memory_order_acquire);
+                if (!e) {
+                    std::lock_guard<std::mutex> lock(m);
+                    e = target.load(std::memory_order_relaxed);
+                    if (!e)
+                        e = install(std::make_shared<thread_pool>(concurrency()));
+                }
+                e->submit(std::move(task));
+            }
+
+            std::size_t concurrency() const override {
+                if (executor* e = target.load(std::memory_order_acquire))
+                    return e->concurrency();
+                return std::max(1u, std::thread::hardware_concurrency()) - 1;
+            }
+
+            //! Sends later tasks to exec. Executors it replaces are kept
+            //! alive, since other threads may still be submitting to them.
+            void set(std::shared_ptr<executor> exec) {
+                std::lock_guard<std::mutex> lock(m);
+                install(std::move(exec));
+            }
+
+        private:
+            //! Makes exec the target; m must be held.
+            executor* install(std::shared_ptr<executor> exec) {
+                owned.push_back(std::move(exec));
+                target.store(owned.back().get(), std::memory_order_release);
+                return owned.back().get();
+            }
+
+            std::mutex m;
+            std::atomic<executor*> target{nullptr};
+            std::vector<std::shared_ptr<executor>> owned;
+        };
+
+    }
+
+    //! Returns the process-wide executor used when no executor is given.
+    /*!
+        It runs tasks on the executor given to set_default_executor(), if
+        any. Otherwise it starts a thread pool, with one worker per core minus
+        one for the thread that calls into MXL, when the first task arrives;
+        returning it or building a context on it starts no threads.
+    */
+    inline std::shared_ptr<executor> default_executor() {
+        static std::shared_ptr<executor> pool = std::make_shared<detail::default_pool>();
+        return pool;
+    }
+
+    //! Settings for MXL's parallel operations.
+    /*!
+        Operations take a context explicitly (e.g. multiply_assign), or use
+        current_context(): the innermost context_scope on the calling thread,
+        or else default_context().
+    */
+    struct context {
+        //! The most threads an operation may use, including the caller.
+        std::size_t threads;
+        //! Runs the parallel tasks.
+        std::shared_ptr<executor> exec;
+        //! Scratch memory for kernels.
+        std::shared_ptr<workspace> arena;
+        //! Run blocking I/O (e.g. tile prefetches) here instead of on MXL's
+        //! own reader threads, if set.
+        std::shared_ptr<executor> io;
+        //! Split work into the same chunks regardless of the number of 
+        //! threads, so results are bitwise reproducible across machines.
+        bool deterministic;
+        //! If set, operations stop once it is cancelled. See
+        //! cancellation_token.
+        std::shared_ptr<cancellation_token> cancel;
+        //! If set, called with the number of chunks (or tiles, or tasks) done
+        //! and the total as an operation progresses. Calls are serialized but
+        //! may come from any worker thread, so keep them short.
+        std::function<void(std::size_t, std::size_t)> progress;
+
+        //! Constructor for a context on default_executor(), using as many
+        //! threads as it has workers plus the calling thread.
+        context(): threads(default_executor()->concurrency() + 1), exec(default_executor()),
+            arena(std::make_shared<workspace>()), deterministic(false) {}
+
+        //! Constructor for a context on an executor.
+        /*!
+            \param exec the executor to run tasks on.
+            \param threads the most threads an operation may use; 0 uses the
+            executor's concurrency plus the calling thread.
+        */
+        explicit context(std::shared_ptr<executor> exec, std::size_t threads=0):
+            threads(threads ? threads : exec->concurrency() + 1), exec(std::move(exec)),
+            arena(std::make_shared<workspace>()), deterministic(false) {}
+
+        //! Throws operation_cancelled if the cancellation token is cancelled.
+        void throw_if_cancelled() const {
+            if (cancel && cancel->cancelled())
+                throw operation_cancelled();
+        }
+
+        //! Calls f(begin, end) on chunks of [0, n), in parallel.
+        /*!
+            Chunks hold at least grain indexes. In deterministic mode, chunks
+            are exactly grain indexes long (the last may be shorter) whatever
+            the number of threads; so are they when the context has a
+            cancellation token or a progress callback, which are checked and
+            called between chunks. The calling thread runs chunks too and
+            returns once all have finished. The first exception thrown by f
+            (or operation_cancelled) is rethrown, and chunks not yet started
+            are skipped.
+            \param n the number of indexes.
+            \param grain the smallest chunk worth running as a task.
+            \param f the function to call on each chunk.
+        */
+        template <typename F>
+        void parallel_for(std::size_t n, std::size_t grain, F f) const {
+            parallel_for(n, grain, std::move(f), true);
+        }
+
+        //! Same as parallel_for(n, grain, f), but unless observed is true,
+        //! ignores the cancellation token and the progress callback, and uses
+        //! at most max_threads threads, counting the caller.
+        /*!
+            Constructors and copies run this way: they are not operations a
+            caller tracks, so they neither throw operation_cancelled nor
+            report progress.
+        */
+        template <typename F>
+        void parallel_for(std::size_t n, std::size_t grain, F f, bool observed,
+                          std::size_t max_threads=std::numeric_limits<std::size_t>::max()) const {
+            if (n == 0)
+                return;
+            grain = std::max<std::size_t>(grain, 1);
+            const std::size_t workers = std::min(threads, max_threads);
+            const std::function<void(std::size_t, std::size_t)>* report = observed && progress ? &progress : nullptr;
+            const cancellation_token* token = observed ? cancel.get() : nullptr;
+            auto check = [token] {
+                if (token && token->cancelled())
+                    throw operation_cancelled();
+            };
+            const bool fixed = deterministic || token || report;
+            std::size_t chunks = (n + grain - 1) / grain;
+            if (!fixed)
+                chunks = std::min(chunks, std::max<std::size_t>(workers, 1));
+            const std::size_t size = fixed ? grain : (n + chunks - 1) / chunks;
+            if (chunks <= 1 || workers <= 1 || !exec) {
+                for (std::size_t c = 0; c != chunks; ++c) {
+                    check();
+                    MXL_TRACE_SPAN(detail::op_name(detail::current_op()), "chunk", "begin", c * size, "end",
+                        std::min(n, (c + 1) * size));
+                    f(c * size, std::min(n, (c + 1) * size));
+                    if (report)
+                        (*report)(c + 1, chunks);
+                }
+                return;
+            }
+
+            struct state {
+                std::atomic<std::size_t> next{0};
+                std::atomic<bool> failed{false};
+                std::size_t done = 0;
+                std::exception_ptr error;
+                std::mutex m;
+                std::condition_variable finished;
+            };
+            std::shared_ptr<state> st = std::make_shared<state>();
+            // Claims chunks until none are left. Runs on workers and the caller.
+            // Charges instrumented work on the workers to the caller's operation.
+            detail::op_counters* op = detail::current_op();
+            std::function<void()> work = [st, chunks, size, n, &f, &check, report, op] {
+#ifdef MXL_HAS_PROBES
+                detail::op_counters* const outer = detail::current_op();
+                detail::current_op() = op;
+#else
+                (void)op;
+#endif
+                for (std::size_t c; (c = st->next++) < chunks; ) {
+                    std::exception_ptr e;
+                    const bool skip = st->failed.load(std::memory_order_relaxed);
+                    if (!skip) {
+                        try {
+                            check();
+                            MXL_TRACE_SPAN(detail::op_name(op), "chunk", "begin", c * size, "end",
+                                std::min(n, (c + 1) * size));
+                            f(c * size, std::min(n, (c + 1) * size));
+                        } catch (...) {
+                            e = std::current_exception();
+                            st->failed = true;
+                        }
+                    }
+                    std::lock_guard<std::mutex> lock(st->m);
+                    if (e && !st->error)
+                        st->error = e;
+                    ++st->done;
+                    if (report && !skip && !e)
+                        (*report)(st->done, chunks);
+                    if (st->done == chunks)
+                        st->finished.notify_all();
+                }
+#ifdef MXL_HAS_PROBES
+                detail::current_op() = outer;
+#endif
+            };
+            std::size_t helpers = std::min(chunks, workers) - 1;
+            for (std::size_t h = 0; h != helpers; ++h)
+                exec->submit([st, work] { work(); });
+            work();
+            std::unique_lock<std::mutex> lock(st->m);
+            st->finished.wait(lock, [&] { return st->done == chunks; });
+            if (st->error)
+                std::rethrow_exception(st->error);
+        }
+    };
+
+    //! Returns the context used when none is given and no context_scope is
+    //! active. It may be changed before starting parallel work.
+    inline context& default_context() {
+        static context ctx;
+        return ctx;
+    }
+
+    //! Makes default_executor() run its tasks on exec, e.g. a service's own
+    //! thread pool, instead of on threads of MXL's.
+    /*!
+        Called before any parallel work, MXL never starts threads of its own.
+        default_context() is resized to exec's concurrency if it still uses
+        default_executor(); so are contexts constructed afterwards. Throws a
+        std::domain_error if exec is null.
+        \param exec the executor to run MXL's tasks on.
+    */
+    inline void set_default_executor(std::shared_ptr<executor> exec) {
+        if (!exec)
+            throw std::domain_error("The default executor must not be null.");
+        const std::size_t threads = exec->concurrency() + 1;
+        static_cast<detail::default_pool&>(*default_executor()).set(std::move(exec));
+        context& ctx = default_context();
+        if (ctx.exec == default_executor())
+            ctx.threads = threads;
+    }
+
+    namespace detail {
+        //! The context installed by the innermost context_scope on this thread.
+        inline const context*& scoped_context() {
+            thread_local const context* ctx = nullptr;
+            return ctx;
+        }
+    }
+
+    //! Returns the context MXL operations use on this thread.
+    inline const context& current_context() {
+        const context* ctx = detail::scoped_context();
+        return ctx ? *ctx : default_context();
+    }
+
+    //! Makes a context current on this thread for the lifetime of the scope.
+    /*!
+        Scopes nest; the context must outlive the scope.
+    */
+    class context_scope {
+    public:
+        explicit context_scope(const context& ctx): previous(detail::scoped_context()) {
+            detail::scoped_context() = &ctx;
+        }
+        ~context_scope() { detail::scoped_context() = previous; }
+
+        context_scope(const context_scope&) = delete;
+        context_scope& operator=(const context_scope&) = delete;
+
+    private:
+        const context* previous;
+    };
+
+    //! The algorithms a matrix product can run with.
+    enum class multiply_algorithm {
+        naive,     //!< the row kernel, on one thread; for tiny products
+        unrolled,  //!< fully unrolled inner products, for an inner dimension of at most 4
+        gemv,      //!< matrix-vector kernel, for a single row or column of output
+        blocked,   //!< the blocked kernel on one thread
+        parallel,  //!< the blocked kernel on the context's threads
+        strassen   //!< Strassen's recursion over the other algorithms
+    };
+
+    //! Returns the name of an algorithm, e.g. "blocked".
+    inline const char* algorithm_name(multiply_algorithm a) {
+        static const char* const names[] = {"naive", "unrolled", "gemv", "blocked", "parallel", "strassen"};
+        return names[static_cast<std::size_t>(a)];
+    }
+
+    //! Costs the multiply dispatcher uses to pick an algorithm.
+    /*!
+        Times are in nanoseconds on one thread. calibrate_cost_model() (in
+        mxl/autotune.hpp) measures them on the host; a tuning profile can
+        hold them next to the blocking parameters.
+    */
+    struct multiply_cost_model {
+        double naive_ns;     //!< per multiply-add, row kernel, row-major right operand
+        double strided_ns;   //!< per multiply-add, row kernel, column-major right operand
+        double loop_ns;      //!< per inner loop the row kernel starts (one per element of the left operand)
+        double unrolled_ns;  //!< per multiply-add, unrolled kernel
+        double gemv_ns;      //!< per multiply-add, matrix-vector kernel
+        double blocked_ns;   //!< per multiply-add, blocked kernel
+        double pack_ns;      //!< per element copied into packing buffers (or added by Strassen)
+        double setup_ns;     //!< fixed cost of a blocked product (buffers, packing set-up)
+        double task_ns;      //!< per extra thread a product runs on
+        //! Smallest dimension Strassen's recursion splits, or 0 (the
+        //! default) to never use it. Strassen rounds differently from the
+        //! other algorithms, so it is only used for floating point types.
+        std::size_t strassen_min;
+
+        //! Returns whether every cost is positive.
+        bool valid() const {
+            return naive_ns > 0 && strided_ns > 0 && loop_ns > 0 && unrolled_ns > 0 && gemv_ns > 0 && blocked_ns > 0 &&
+                pack_ns > 0 && setup_ns > 0 && task_ns > 0;
+        }
+    };
+
+    //! Returns rough costs for elements of elem_size bytes on a current
+    //! x86-64 core, for when the model has not been calibrated.
+    inline multiply_cost_model default_cost_model(std::size_t elem_size) {
+        const double scale = std::max<std::size_t>(elem_size, 4) / 8.0;
+        return multiply_cost_model{0.3 * scale, 0.45, 0.8, 0.15 * scale, 0.6 * scale, 0.2 * scale, 0.6, 150, 5000, 0};
+    }
+
+    //! The algorithm chosen for a product, and its predicted time.
+    struct multiply_plan {
+        multiply_algorithm algorithm;
+        std::size_t rows;     //!< rows of the left operand
+        std::size_t depth;    //!< columns of the left operand
+        std::size_t cols;     //!< columns of the right operand
+        std::size_t threads;  //!< threads the algorithm uses
+        double predicted_ns;  //!< predicted wall time
+    };
+
+    //! Cache sizes of the current machine, in bytes.
+    struct cache_sizes {
+        std::size_t l1d;  //!< level 1 data cache, per core
+        std::size_t l2;   //!< level 2 cache
+        std::size_t l3;   //!< last-level cache, shared
+    };
+
+    //! Returns the cache sizes of the first CPU.
+    /*!
+        Read from /sys/devices/system/cpu/cpu0/cache on Linux. Levels that
+        cannot be read default to 32 KiB, 1 MiB and 8 MiB.
+    */
+    inline cache_sizes detect_cache_sizes() {
+        cache_sizes sizes{32 << 10, 1 << 20, 8 << 20};
+        for (int index = 0; index != 8; ++index) {
+            std::string dir = "/sys/devices/system/cpu/cpu0/cache/index" + std::to_string(index) + "/";
+            int level = 0;
+            std::string type, size;
+            if (!(std::ifstream(dir + "level") >> level) || !(std::ifstream(dir + "type") >> type) ||
+                !(std::ifstream(dir + "size") >> size) || type == "Instruction")
+                continue;
+            std::size_t bytes = std::strtoull(size.c_str(), nullptr, 10);
+            if (size.back() == 'K')
+                bytes <<= 10;
+            else if (size.back() == 'M')
+                bytes <<= 20;
+            if (!bytes)
+                continue;
+            if (level == 1)
+                sizes.l1d = bytes;
+            else if (level == 2)
+                sizes.l2 = bytes;
+            else
+                sizes.l3 = bytes;
+        }
+        return sizes;
+    }
+
+    //! Blocking parameters of the blocked multiply kernel.
+    /*!
+        The kernel multiplies kc-deep slices of an mc x kc block of the left
+        operand and a kc x nc panel of the right one, both copied into
+        contiguous buffers, with an mr x nr register tile. mr x nr must be
+        one of 4 x 4, 4 x 8, 8 x 4 or 8 x 8.
+    */
+    struct blocking {
+        std::size_t mc;  //!< rows of the left block (kept in L2)
+        std::size_t kc;  //!< depth of both blocks
+        std::size_t nc;  //!< columns of the right panel (kept in L3)
+        std::size_t mr;  //!< rows of the register tile
+        std::size_t nr;  //!< columns of the register tile
+
+        //! Returns whether the kernel supports these parameters.
+        bool valid() const {
+            return mc && kc && nc && (mr == 4 || mr == 8) && (nr == 4 || nr == 8);
+        }
+
+        bool operator==(const blocking& o) const {
+            return mc == o.mc && kc == o.kc && nc == o.nc && mr == o.mr && nr == o.nr;
+        }
+    };
+
+    //! Returns blocking parameters for elements of elem_size bytes that fit
+    //! the given caches: the right operand's micro-panel in half of L1, the
+    //! left block in half of L2 and the right panel in half of L3.
+    inline blocking default_blocking(std::size_t elem_size, const cache_sizes& caches=detect_cache_sizes()) {
+        auto fit = [](std::size_t bytes, std::size_t per, std::size_t multiple, std::size_t low, std::size_t high) {
+            std::size_t n = std::min(std::max(bytes / std::max<std::size_t>(per, 1), low), high);
+            return std::max(multiple, n / multiple * multiple);
+        };
+        blocking b{0, 0, 0, 4, 8};
+        b.kc = fit(caches.l1d / 2, b.nr * elem_size, 8, 64, 512);
+        b.mc = fit(caches.l2 / 2, b.kc * elem_size, b.mr, 16, 512);
+        b.nc = fit(caches.l3 / 2, b.kc * elem_size, b.nr, 64, 8192);
+        return b;
+    }
+
+    namespace detail {
+
+        //! Names element types in tuning profiles: f32, f64, i32, i64, ...
+        template <typename T>
+        std::string tuning_key() {
+            if (!std::is_arithmetic<T>::value)
+                return "other";
+            return (std::is_floating_point<T>::value ? "f" : "i") + std::to_string(8 * sizeof(T));
+        }
+
+        //! Blocking parameters loaded from the profile or set at run time,
+        //! by tuning_key.
+        struct tuning_table {
+            std::mutex m;
+            //! Incremented, under m, whenever the entries change.
+            std::atomic<std::uint64_t> version{0};
+            bool loaded = false;
+            std::vector<std::pair<std::string, blocking>> entries;
+            std::vector<std::pair<std::string, multiply_cost_model>> models;
+        };
+
+        //! Sets the entry for key in entries to value.
+        template <typename V>
+        void set_entry(std::vector<std::pair<std::string, V>>& entries, const std::string& key, const V& value) {
+            for (std::pair<std::string, V>& e: entries)
+                if (e.first == key) {
+                    e.second = value;
+                    return;
+                }
+            entries.emplace_back(key, value);
+        }
+
+        //! Returns the entry for key in entries, or null.
+        template <typename V>
+        const V* find_entry(const std::vector<std::pair<std::string, V>>& entries, const std::string& key) {
+            for (const std::pair<std::string, V>& e: entries)
+                if (e.first == key)
+                    return &e.second;
+            return nullptr;
+        }
+
+        //! Removes the entry for key from entries.
+        template <typename V>
+        void erase_entry(std::vector<std::pair<std::string, V>>& entries, const std::string& key) {
+            entries.erase(std::remove_if(entries.begin(), entries.end(),
+                [&](const std::pair<std::string, V>& e) { return e.first == key; }), entries.end());
+        }
+
+        inline tuning_table& tuning() {
+            static tuning_table table;
+            return table;
+        }
+
+        //! Reads the entries of a profile into table. Lines that do not parse
+        //! are skipped.
+        inline bool read_tuning_profile(const std::string& path, tuning_table& table) {
+            std::ifstream in(path);
+            if (!in)
+                return false;
+            for (std::string line; std::getline(in, line);) {
+                std::istringstream fields(line);
+                std::string key;
+                blocking b{0, 0, 0, 0, 0};
+                multiply_cost_model cm{0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+                if (!(fields >> key) || key[0] == '#')
+                    continue;
+                for (std::string f; fields >> f;) {
+                    std::size_t eq = f.find('=');
+                    const char* text = eq == std::string::npos ? "0" : f.c_str() + eq + 1;
+                    std::size_t value = std::strtoull(text, nullptr, 10);
+                    double cost = std::strtod(text, nullptr);
+                    std::string name = f.substr(0, eq);
+                    if (name == "mc") b.mc = value;
+                    else if (name == "kc") b.kc = value;
+                    else if (name == "nc") b.nc = value;
+                    else if (name == "mr") b.mr = value;
+                    else if (name == "nr") b.nr = value;
+                    else if (name == "naive_ns") cm.naive_ns = cost;
+                    else if (name == "strided_ns") cm.strided_ns = cost;
+                    else if (name == "loop_ns") cm.loop_ns = cost;
+                    else if (name == "unrolled_ns") cm.unrolled_ns = cost;
+                    else if (name == "gemv_ns") cm.gemv_ns = cost;
+                    else if (name == "blocked_ns") cm.blocked_ns = cost;
+                    else if (name == "pack_ns") cm.pack_ns = cost;
+                    else if (name == "setup_ns") cm.setup_ns = cost;
+                    else if (name == "task_ns") cm.task_ns = cost;
+                    else if (name == "strassen_min") cm.strassen_min = value;
+                }
+                if (b.valid())
+                    set_entry(table.entries, key, b);
+                if (cm.valid())
+                    set_entry(table.models, key, cm);
+            }
+            return true;
+        }
+
+    }
+
+    //! Returns the path of this host's tuning profile.
+    /*!
+        The MXL_TUNING_PROFILE environment variable, if set; otherwise
+        mxl/tuning-<hostname>.txt under $XDG_CACHE_HOME or ~/.cache.
+    */
+    inline std::string tuning_profile_path() {
+        if (const char* path = std::getenv("MXL_TUNING_PROFILE"))
+            return path;
+        std::string dir;
+        if (const char* cache = std::getenv("XDG_CACHE_HOME"))
+            dir = cache;
+        else if (const char* home = std::getenv("HOME"))
+            dir = std::string(home) + "/.cache";
+        else
+            dir = ".";
+        char host[256] = "host";
+#if defined(__linux__)
+        if (gethostname(host, sizeof(host)) != 0)
+            std::strcpy(host, "host");
+        host[sizeof(host) - 1] = '\0';
+#endif
+        return dir + "/mxl/tuning-" + host + ".txt";
+    }
+
+    //! Loads blocking parameters from a tuning profile, replacing the entries
+    //! for the types it lists.
+    /*!
+        The profile at tuning_profile_path() is loaded automatically the first
+        time a multiply needs blocking parameters; call this to load another.
+        A profile has one line per element type, e.g.
+        "f64 mc=96 kc=256 nc=2048 mr=4 nr=8"; lines starting with # and lines
+        that do not parse are ignored.
+        \return false if the file cannot be opened.
+    */
+    inline bool load_tuning_profile(const std::string& path) {
+        detail::tuning_table& table = detail::tuning();
+        std::lock_guard<std::mutex> lock(table.m);
+        table.loaded = true;
+        table.version++;
+        return detail::read_tuning_profile(path, table);
+    }
+
+    //! Returns the blocking parameters used to multiply matrices of T.
+    /*!
+        These come from set_blocking(), else from the host's tuning profile,
+        else from default_blocking() for the detected cache sizes.
+    */
+    template <typename T>
+    blocking get_blocking() {
+        detail::tuning_table& table = detail::tuning();
+        std::lock_guard<std::mutex> lock(table.m);
+        if (!table.loaded) {
+            table.loaded = true;
+            table.version++;
+            detail::read_tuning_profile(tuning_profile_path(), table);
+        }
+        if (const blocking* b = detail::find_entry(table.entries, detail::tuning_key<T>()))
+            return *b;
+        static const blocking defaults = default_blocking(sizeof(T));
+        return defaults;
+    }
+
+    //! Sets the blocking parameters used to multiply matrices of T in this
+    //! process. Throws a std::domain_error if b is not valid().
+    template <typename T>
+    void set_blocking(const blocking& b) {
+        if (!b.valid())
+            throw std::domain_error("Unsupported blocking parameters: mc=" + std::to_string(b.mc) + " kc=" +
+                std::to_string(b.kc) + " nc=" + std::to_string(b.nc) + " mr=" + std::to_string(b.mr) +
+                " nr=" + std::to_string(b.nr) + ".");
+        get_blocking<T>();  // load the profile first, so it does not override b
+        detail::tuning_table& table = detail::tuning();
+        std::lock_guard<std::mutex> lock(table.m);
+        detail::set_entry(table.entries, detail::tuning_key<T>(), b);
+        table.version++;
+    }
+
+    //! Forgets the blocking parameters of T set at run time or loaded from a
+    //! profile, so that default_blocking() applies.
+    template <typename T>
+    void reset_blocking() {
+        get_blocking<T>();
+        detail::tuning_table& table = detail::tuning();
+        std::lock_guard<std::mutex> lock(table.m);
+        detail::erase_entry(table.entries, detail::tuning_key<T>());
+        table.version++;
+    }
+
+    //! Returns the cost model used to pick algorithms for matrices of T.
+    /*!
+        This comes from set_cost_model(), else from the host's tuning
+        profile, else from default_cost_model().
+    */
+    template <typename T>
+    multiply_cost_model get_cost_model() {
+        get_blocking<T>();  // loads the profile
+        detail::tuning_table& table = detail::tuning();
+        std::lock_guard<std::mutex> lock(table.m);
+        if (const multiply_cost_model* cm = detail::find_entry(table.models, detail::tuning_key<T>()))
+            return *cm;
+        return default_cost_model(sizeof(T));
+    }
+
+    //! Sets the cost model used to pick algorithms for matrices of T in this
+    //! process. Throws a std::domain_error if cm is not valid().
+    template <typename T>
+    void set_cost_model(const multiply_cost_model& cm) {
+        if (!cm.valid())
+            throw std::domain_error("Cost model costs must be positive.");
+        get_blocking<T>();
+        detail::tuning_table& table = detail::tuning();
+        std::lock_guard<std::mutex> lock(table.m);
+        detail::set_entry(table.models, detail::tuning_key<T>(), cm);
+        table.version++;
+    }
+
+    //! Forgets the cost model of T set at run time or loaded from a profile,
+    //! so that default_cost_model() applies.
+    template <typename T>
+    void reset_cost_model() {
+        get_blocking<T>();
+        detail::tuning_table& table = detail::tuning();
+        std::lock_guard<std::mutex> lock(table.m);
+        detail::erase_entry(table.models, detail::tuning_key<T>());
+        table.version++;
+    }
+
+    namespace detail {
+
+        //! The blocking parameters and cost model of an element type, as of a
+        //! version of the tuning table.
+        struct tuning_snapshot {
+            std::uint64_t version;
+            blocking bl;
+            multiply_cost_model cm;
+        };
+
+        //! Returns this thread's copy of the blocking parameters and cost
+        //! model of T, refreshed only when the tuning table has changed, so
+        //! that each product does not lock the table.
+        template <typename T>
+        const tuning_snapshot& tuning_of() {
+            thread_local tuning_snapshot snapshot{~std::uint64_t(0), blocking{0, 0, 0, 0, 0},
+                multiply_cost_model{0, 0, 0, 0, 0, 0, 0, 0, 0, 0}};
+            // The version is read first: a change made while the copy is
+            // taken leaves the copy outdated and refreshes it next time.
+            const std::uint64_t version = tuning().version.load();
+            if (snapshot.version != version) {
+                snapshot.bl = get_blocking<T>();
+                snapshot.cm = get_cost_model<T>();
+                snapshot.version = version;
+            }
+            return snapshot;
+        }
+
+        //! The function set_multiply_hook() installed.
+        struct multiply_hook_state {
+            std::mutex m;
+            std::atomic<bool> set{false};
+            std::function<void(const multiply_plan&)> hook;
+        };
+
+        inline multiply_hook_state& multiply_hook() {
+            static multiply_hook_state state;
+            return state;
+        }
+
+        //! Passes plan to the hook, if there is one.
+        inline void report_plan(const multiply_plan& plan) {
+            multiply_hook_state& h = multiply_hook();
+            if (!h.set.load(std::memory_order_acquire))
+                return;
+            std::function<void(const multiply_plan&)> hook;
+            {
+                std::lock_guard<std::mutex> lock(h.m);
+                hook = h.hook;
+            }
+            if (hook)
+                hook(plan);
+        }
+
+    }
+
+    //! Calls hook with the plan of every matrix product before it runs, on
+    //! the thread that runs it; an empty hook removes it.
+    /*!
+        Meant for debugging and tests, e.g. to log which algorithm each
+        product takes:
+        \code
+        mxl::set_multiply_hook([](const mxl::multiply_plan& p) {
+            std::cerr << mxl::algorithm_name(p.algorithm) << "\n";
+        });
+        \endcode
+    */
+    inline void set_multiply_hook(std::function<void(const multiply_plan&)> hook) {
+        detail::multiply_hook_state& h = detail::multiply_hook();
+        std::lock_guard<std::mutex> lock(h.m);
+        h.set.store(bool(hook), std::memory_order_release);
+        h.hook = std::move(hook);
+    }
+
+    namespace detail {
+
+        //! Computes rows [i0, i1) of the row-major m x n product C = A * B,
+        //! where A(i, k) = a[i * a_rs + k * a_cs] and B(k, j) = b[k * b_rs + 
+        //! j * b_cs].
+        /*!
+            Sums run over k in increasing order, as in the textbook loop, so
+            every layout gives the same result. When neither operand has 
+            unit-stride rows, each row of A is first copied into scratch (K
+            elements).
+        */
+        template <typename T>
+        void multiply_rows(const T* a, std::size_t a_rs, std::size_t a_cs, const T* b, std::size_t b_rs,
+                           std::size_t b_cs, T* c, std::size_t n, std::size_t K, std::size_t i0, std::size_t i1,
+                           T* scratch) {
+            for (std::size_t i = i0; i != i1; ++i) {
+                T* crow = c + i * n;
+                const T* arow = a + i * a_rs;
+                if (b_cs == 1) {
+                    std::fill(crow, crow + n, T(0));
+                    for (std::size_t k = 0; k != K; ++k) {
+                        const T aik = arow[k * a_cs];
+                        const T* brow = b + k * b_rs;
+                        for (std::size_t j = 0; j != n; ++j)
+                            crow[j] += aik * brow[j];
+                    }
+                    continue;
+                }
+                if (a_cs != 1) {
+                    for (std::size_t k = 0; k != K; ++k)
+                        scratch[k] = arow[k * a_cs];
+                    arow = scratch;
+                }
+                for (std::size_t j = 0; j != n; ++j) {
+                    const T* bcol = b + j * b_cs;
+                    T sum = T(0);
+                    for (std::size_t k = 0; k != K; ++k)
+                        sum += arow[k] * bcol[k * b_rs];
+                    crow[j] = sum;
+                }
+            }
+        }
+
+        //! Copies the mc x kc block of A at (i0, k0) into strips of MR rows,
+        //! each stored column after column: strip s holds A(i0 + s * MR + r,
+        //! k0 + k) at out[s * MR * kc + k * MR + r]. Rows past mc are zero.
+        template <typename T, std::size_t MR>
+        void pack_left(const T* a, std::size_t a_rs, std::size_t a_cs, std::size_t i0, std::size_t mc,
+                       std::size_t k0, std::size_t kc, T* out) {
+            for (std::size_t s = 0; s < mc; s += MR) {
+                const std::size_t rows = std::min(MR, mc - s);
+                const T* src = a + (i0 + s) * a_rs + k0 * a_cs;
+                for (std::size_t k = 0; k != kc; ++k, out += MR) {
+                    for (std::size_t r = 0; r != rows; ++r)
+                        out[r] = src[r * a_rs + k * a_cs];
+                    for (std::size_t r = rows; r != MR; ++r)
+                        out[r] = T(0);
+                }
+            }
+        }
+
+        //! Copies the kc x nc panel of B at (k0, j0) into strips of NR
+        //! columns, each stored row after row: strip s holds B(k0 + k, j0 +
+        //! s * NR + c) at out[s * NR * kc + k * NR + c]. Columns past nc are
+        //! zero.
+        template <typename T, std::size_t NR>
+        void pack_right(const T* b, std::size_t b_rs, std::size_t b_cs, std::size_t k0, std::size_t kc,
+                        std::size_t j0, std::size_t nc, T* out) {
+            for (std::size_t s = 0; s < nc; s += NR) {
+                const std::size_t cols = std::min(NR, nc - s);
+                const T* src = b + k0 * b_rs + (j0 + s) * b_cs;
+                for (std::size_t k = 0; k != kc; ++k, out += NR) {
+                    for (std::size_t c = 0; c != cols; ++c)
+                        out[c] = src[k * b_rs + c * b_cs];
+                    for (std::size_t c = cols; c != NR; ++c)
+                        out[c] = T(0);
+                }
+            }
+        }
+
+        //! Adds the product of a packed MR x kc strip and a packed kc x NR
+        //! strip to the m x n (at most MR x NR) tile of C at c.
+        /*!
+            The tile is loaded into registers first and the products are added
+            in increasing k, so each element sees the same additions, in the
+            same order, as in multiply_rows.
+        */
+        template <typename T, std::size_t MR, std::size_t NR>
+        void micro_kernel(std::size_t kc, const T* a, const T* b, T* c, std::size_t ldc, std::size_t m,
+                          std::size_t n) {
+            T acc[MR][NR];
+            for (std::size_t r = 0; r != MR; ++r)
+                for (std::size_t j = 0; j != NR; ++j)
+                    acc[r][j] = r < m && j < n ? c[r * ldc + j] : T(0);
+            for (std::size_t k = 0; k != kc; ++k, a += MR, b += NR)
+                for (std::size_t r = 0; r != MR; ++r) {
+                    const T ar = a[r];
+                    for (std::size_t j = 0; j != NR; ++j)
+                        acc[r][j] += ar * b[j];
+                }
+            for (std::size_t r = 0; r != m; ++r)
+                for (std::size_t j = 0; j != n; ++j)
+                    c[r * ldc + j] = acc[r][j];
+        }
+
+        //! Computes rows [i0, i1) of C = A * B like multiply_rows, with the
+        //! operands packed into blocks of bl and an MR x NR register tile.
+        /*!
+            packed_a needs room for round_up(mc, MR) * kc elements and
+            packed_b for round_up(nc, NR) * kc. The results are identical to
+            multiply_rows.
+        */
+        template <typename T, std::size_t MR, std::size_t NR>
+        void multiply_blocked_rows(const T* a, std::size_t a_rs, std::size_t a_cs, const T* b, std::size_t b_rs,
+                                   std::size_t b_cs, T* c, std::size_t n, std::size_t K, std::size_t i0,
+                                   std::size_t i1, const blocking& bl, T* packed_a, T* packed_b) {
+            for (std::size_t i = i0; i != i1; ++i)
+                std::fill(c + i * n, c + (i + 1) * n, T(0));
+            for (std::size_t jc = 0; jc < n; jc += bl.nc) {
+                const std::size_t nc = std::min(bl.nc, n - jc);
+                for (std::size_t pc = 0; pc < K; pc += bl.kc) {
+                    const std::size_t kc = std::min(bl.kc, K - pc);
+                    pack_right<T, NR>(b, b_rs, b_cs, pc, kc, jc, nc, packed_b);
+                    for (std::size_t ic = i0; ic < i1; ic += bl.mc) {
+                        const std::size_t mc = std::min(bl.mc, i1 - ic);
+                        pack_left<T, MR>(a, a_rs, a_cs, ic, mc, pc, kc, packed_a);
+                        for (std::size_t jr = 0; jr < nc; jr += NR)
+                            for (std::size_t ir = 0; ir < mc; ir += MR)
+                                micro_kernel<T, MR, NR>(kc, packed_a + ir * kc, packed_b + jr * kc,
+                                    c + (ic + ir) * n + jc + jr, n, std::min(MR, mc - ir), std::min(NR, nc - jr));
+                    }
+                }
+            }
+        }
+
+        //! Returns the elements of the two packing buffers
+        //! multiply_blocked_rows needs for bl.
+        inline std::pair<std::size_t, std::size_t> blocked_buffer_sizes(const blocking& bl) {
+            return {(bl.mc + bl.mr - 1) / bl.mr * bl.mr * bl.kc, (bl.nc + bl.nr - 1) / bl.nr * bl.nr * bl.kc};
+        }
+
+        //! Runs multiply_blocked_rows with the register tile of bl, taking
+        //! the packing buffers from arena.
+        template <typename T>
+        void multiply_blocked(const T* a, std::size_t a_rs, std::size_t a_cs, const T* b, std::size_t b_rs,
+                              std::size_t b_cs, T* c, std::size_t n, std::size_t K, std::size_t i0, std::size_t i1,
+                              const blocking& bl, workspace& arena) {
+            // Clamp the blocks to the problem, so small products do not pack
+            // (or allocate) more than they use.
+            blocking fit = bl;
+            fit.mc = std::min(bl.mc, (i1 - i0 + bl.mr - 1) / bl.mr * bl.mr);
+            fit.kc = std::min(bl.kc, std::max<std::size_t>(K, 1));
+            fit.nc = std::min(bl.nc, (n + bl.nr - 1) / bl.nr * bl.nr);
+            std::pair<std::size_t, std::size_t> sizes = blocked_buffer_sizes(fit);
+            workspace::buffer pa = arena.acquire(sizes.first * sizeof(T)), pb = arena.acquire(sizes.second * sizeof(T));
+            auto kernel = &multiply_blocked_rows<T, 4, 8>;
+            if (fit.mr == 4 && fit.nr == 4)
+                kernel = &multiply_blocked_rows<T, 4, 4>;
+            else if (fit.mr == 8 && fit.nr == 4)
+                kernel = &multiply_blocked_rows<T, 8, 4>;
+            else if (fit.mr == 8 && fit.nr == 8)
+                kernel = &multiply_blocked_rows<T, 8, 8>;
+            kernel(a, a_rs, a_cs, b, b_rs, b_cs, c, n, K, i0, i1, fit, pa.as<T>(), pb.as<T>());
+        }
+
+        //! Computes rows [i0, i1) of C = A * B, like multiply_rows, for an
+        //! inner dimension K known at compile time.
+        template <typename T, std::size_t K>
+        void multiply_unrolled_rows(const T* a, std::size_t a_rs, std::size_t a_cs, const T* b, std::size_t b_rs,
+                                    std::size_t b_cs, T* c, std::size_t n, std::size_t i0, std::size_t i1) {
+            for (std::size_t i = i0; i != i1; ++i) {
+                T arow[K];
+                for (std::size_t k = 0; k != K; ++k)
+                    arow[k] = a[i * a_rs + k * a_cs];
+                for (std::size_t j = 0; j != n; ++j) {
+                    T sum = T(0);
+                    for (std::size_t k = 0; k != K; ++k)
+                        sum += arow[k] * b[k * b_rs + j * b_cs];
+                    c[i * n + j] = sum;
+                }
+            }
+        }
+
+        //! Runs multiply_unrolled_rows for K from 1 to 4.
+        template <typename T>
+        void multiply_unrolled(const T* a, std::size_t a_rs, std::size_t a_cs, const T* b, std::size_t b_rs,
+                               std::size_t b_cs, T* c, std::size_t n, std::size_t K, std::size_t i0, std::size_t i1) {
+            switch (K) {
+            case 1: return multiply_unrolled_rows<T, 1>(a, a_rs, a_cs, b, b_rs, b_cs, c, n, i0, i1);
+            case 2: return multiply_unrolled_rows<T, 2>(a, a_rs, a_cs, b, b_rs, b_cs, c, n, i0, i1);
+            case 3: return multiply_unrolled_rows<T, 3>(a, a_rs, a_cs, b, b_rs, b_cs, c, n, i0, i1);
+            default: return multiply_unrolled_rows<T, 4>(a, a_rs, a_cs, b, b_rs, b_cs, c, n, i0, i1);
+            }
+        }
+
+        //! Computes elements [x0, x1) of y = A * v, where A(x, k) = a[x * rs +
+        //! k * cs] and v(k) = v[k * vs], summing over k in increasing order.
+        /*!
+            Serves both a single output column (A is the left operand) and a
+            single output row (A is the transposed right operand). Walks A
+            row by row or column by column, whichever is contiguous.
+        */
+        template <typename T>
+        void multiply_gemv(const T* a, std::size_t rs, std::size_t cs, const T* v, std::size_t vs, T* y,
+                           std::size_t K, std::size_t x0, std::size_t x1) {
+            if (cs == 1 || rs != 1) {
+                for (std::size_t x = x0; x != x1; ++x) {
+                    const T* row = a + x * rs;
+                    T sum = T(0);
+                    for (std::size_t k = 0; k != K; ++k)
+                        sum += row[k * cs] * v[k * vs];
+                    y[x] = sum;
+                }
+                return;
+            }
+            std::fill(y + x0, y + x1, T(0));
+            for (std::size_t k = 0; k != K; ++k) {
+                const T vk = v[k * vs];
+                const T* col = a + k * cs;
+                for (std::size_t x = x0; x != x1; ++x)
+                    y[x] += col[x] * vk;
+            }
+        }
+
+        //! Chunks of element-wise work smaller than this run on one thread.
+        const std::size_t elementwise_grain = std::size_t(1) << 15;
+        //! Chunks of a product smaller than this many multiply-adds run on one
+        //! thread.
+        const std::size_t multiply_grain = std::size_t(1) << 16;
+
+        //! Rows per chunk of the blocked kernel: whole register tiles, and
+        //! enough of them that packing the right operand again in each chunk
+        //! is cheap.
+        inline std::size_t blocked_grain(std::size_t n, std::size_t K, const blocking& bl) {
+            const std::size_t grain = std::max<std::size_t>(1, multiply_grain / std::max<std::size_t>(1, n * K));
+            return std::max(grain, 4 * bl.mr) / bl.mr * bl.mr;
+        }
+
+        //! Picks the algorithm with the lowest predicted time for an m x K by
+        //! K x n product on up to threads threads.
+        /*!
+            \param rhs_rows whether the right operand is stored row after row.
+            \param floating whether the elements are floating point, which
+            Strassen's recursion needs.
+        */
+        inline multiply_plan plan_multiply(std::size_t m, std::size_t K, std::size_t n, bool rhs_rows,
+                                           std::size_t threads, bool floating, const multiply_cost_model& cm,
+                                           const blocking& bl) {
+            const double fma = double(m) * n * K;
+            multiply_plan best{multiply_algorithm::naive, m, K, n, 1,
+                (rhs_rows ? cm.naive_ns : cm.strided_ns) * fma + cm.loop_ns * double(m) * K};
+            auto consider = [&](multiply_algorithm algorithm, std::size_t t, double ns) {
+                if (ns < best.predicted_ns)
+                    best = multiply_plan{algorithm, m, K, n, t, ns};
+            };
+            if (K == 0)
+                return best;
+            if (K <= 4)
+                consider(multiply_algorithm::unrolled, 1, cm.unrolled_ns * fma);
+            if (m == 1 || n == 1) {
+                const std::size_t len = n == 1 ? m : n;
+                const std::size_t t = std::min(std::max<std::size_t>(threads, 1),
+                    (len + multiply_grain / K - 1) / std::max<std::size_t>(multiply_grain / K, 1));
+                consider(multiply_algorithm::gemv, t, cm.gemv_ns * fma / t + cm.task_ns * (t - 1));
+            }
+            const double packing = cm.pack_ns * (double(m) * K + double(K) * n);
+            consider(multiply_algorithm::blocked, 1, cm.setup_ns + cm.blocked_ns * fma + packing);
+            const std::size_t grain = blocked_grain(n, K, bl);
+            const std::size_t chunks = std::min(std::max<std::size_t>(threads, 1), (m + grain - 1) / grain);
+            if (chunks > 1)
+                // Each chunk packs its rows of the left operand and all of the
+                // right one.
+                consider(multiply_algorithm::parallel, chunks, cm.setup_ns + (cm.blocked_ns * fma +
+                    cm.pack_ns * double(m) * K) / chunks + cm.pack_ns * double(K) * n + cm.task_ns * (chunks - 1));
+            if (floating && cm.strassen_min && m % 2 == 0 && K % 2 == 0 && n % 2 == 0 &&
+                std::min(std::min(m, K), n) >= cm.strassen_min) {
+                // Seven half-size products, plus copying the quadrants and
+                // the 18 quadrant additions.
+                multiply_plan half = plan_multiply(m / 2, K / 2, n / 2, true, threads, floating, cm, bl);
+                consider(multiply_algorithm::strassen, half.threads, 7 * half.predicted_ns +
+                    cm.pack_ns * (2.25 * (double(m) * K + double(K) * n) + 3.0 * m * n));
+            }
+            return best;
+        }
+
+        //! An allocator whose containers leave new elements default-initialized.
+        /*!
+            Resizing a std::vector of arithmetic values with it does not write
+            to the new memory, so the pages are not placed on a NUMA node until
+            a thread first touches them.
+        */
+        template <typename T>
+        struct first_touch_allocator: std::allocator<T> {
+            template <typename U>
+            struct rebind { using other = first_touch_allocator<U>; };
+
+            first_touch_allocator() = default;
+            template <typename U>
+            first_touch_allocator(const first_touch_allocator<U>&) noexcept {}
+
+            T* allocate(std::size_t n) {
+                MXL_COUNT_ALLOCATION(n * sizeof(T));
+                return std::allocator<T>::allocate(n);
+            }
+
+            template <typename U>
+            void construct(U* p) noexcept(std::is_nothrow_default_constructible<U>::value) {
+                ::new(static_cast<void*>(p)) U;
+            }
+
+            template <typename U, typename... Args>
+            void construct(U* p, Args&&... args) {
+                ::new(static_cast<void*>(p)) U(std::forward<Args>(args)...);
+            }
+        };
+
+        //! Tag for the private matrix constructor that leaves elements unset.
+        struct uninitialized_t {};
+
+    }
+
+    template <typename T>
+    class matrix;
+
+    namespace detail {
+
+        template <typename T>
+        matrix<T> multiply_strassen(const matrix<T>& lhs, const matrix<T>& rhs, const context& ctx);
+
+        template <typename T>
+        matrix<T> adopt_storage(std::size_t m, std::size_t n, std::vector<T, first_touch_allocator<T>>&& v);
+
+    }
 
     template <typename T>
     class matrix {
@@ -36,9 +2230,9 @@ namespace mxl {
         //! Define iterator for matrix.
         /*! Iterates element-by-element from the top-left element to the 
         bottom-right element. */
-        using iterator = typename std::vector<T>::iterator;  
+        using iterator = typename std::vector<T, detail::first_touch_allocator<T>>::iterator;  
         //! Same as the matrix iterator but is const.
-        using const_iterator = typename std::vector<T>::const_iterator;
+        using const_iterator = typename std::vector<T, detail::first_touch_allocator<T>>::const_iterator;
         //! Defines a size type for the given data type T.
         using size_type = typename std::vector<T>::size_type;
         //! Defines a dimensions type as std::pair of size_types.
@@ -78,12 +2272,65 @@ namespace mxl {
             identity-like matrix). The random numbers are uniformly continuous
             distributed for "real" types (like doubles or floats), and uniformly 
             discretely distributed between (1 and 1000000) for integral types
-            (like int or long).
+            (like int or long). Any other string throws a std::domain_error.
+            The typed constructors below (mxl::zeros, mxl::ones, mxl::identity
+            and mxl::random()) do the same without matching strings at runtime.
             \sa initialize(size_type, size_type, std::string)
         */
         matrix(size_type m, size_type n, const std::string& initializer): 
             num_rows(m), num_cols(n), transpose_toggle(true)  { initialize(initializer); }
 
+        //! Constructor for an m x n matrix of 0s.
+        /*!
+            \param m the number of rows.
+            \param n the number of columns.
+        */
+        matrix(size_type m, size_type n, zeros_t):
+            num_rows(m), num_cols(n), transpose_toggle(true) { initialize(zeros); }
+
+        //! Constructor for an m x n matrix of 1s.
+        /*!
+            \param m the number of rows.
+            \param n the number of columns.
+        */
+        matrix(size_type m, size_type n, ones_t):
+            num_rows(m), num_cols(n), transpose_toggle(true) { initialize(ones); }
+
+        //! Constructor for an m x n identity-like matrix.
+        /*!
+            \param m the number of rows.
+            \param n the number of columns.
+        */
+        matrix(size_type m, size_type n, identity_t):
+            num_rows(m), num_cols(n), transpose_toggle(true) { initialize(identity); }
+
+        //! Constructor for an m x n matrix of random numbers, e.g.
+        //! matrix<double>(m, n, mxl::random(seed, mxl::normal())).
+        /*!
+            \param m the number of rows.
+            \param n the number of columns.
+            \param r the seed and distribution, see mxl::random().
+        */
+        template <typename Distribution>
+        matrix(size_type m, size_type n, const random_t<Distribution>& r):
+            num_rows(m), num_cols(n), transpose_toggle(true) { initialize(r.dist, r.seed); }
+
+        //! Constructor for an m x n matrix of random numbers drawn from a 
+        //! distribution.
+        /*!
+            \param m the number of rows.
+            \param n the number of columns.
+            \param dist one of mxl::uniform, mxl::normal, mxl::bernoulli or
+            mxl::sparse_sign.
+            \param seed the seed for the generator. Equal seeds give equal
+            matrices.
+            \sa initialize(const Distribution&, std::uint64_t)
+        */
+        template <typename Distribution, typename = typename std::enable_if<
+            is_distribution<Distribution>::value>::type>
+        matrix(size_type m, size_type n, const Distribution& dist, std::uint64_t seed=default_seed):
+            num_rows(m), num_cols(n), transpose_toggle(true) { initialize(dist, seed); }
+
         //! Constructor that reshapes an std::vector to create a matrix.
         /*!
             Note that the number of elements in the vector must equal m x n. If 
@@ -91,20 +2338,71 @@ namespace mxl {
             \param m the number of rows.
             \param n the number of columns.
             \param v std::vector that is reshaped to fill the matrix.
-            \sa initialize(const std::vector<std::vector<T>>&, size_type)
+            \sa initialize(size_type, size_type, const std::vector<T>&)
+        */
+        matrix(size_type m, size_type n, const std::vector<T>& v): transpose_toggle(true) { initialize(m, n, v); }
+
+        //! Same as above. The elements are still copied, in parallel, so that
+        //! the pages of the matrix are first touched by the threads using them.
+        matrix(size_type m, size_type n, std::vector<T>&& v): transpose_toggle(true) 
+            { initialize(m, n, v); }
+
+        //! Constructor that reshapes the elements of an iterator range, given
+        //! in row-major order, to create a matrix.
+        /*!
+            The number of elements in the range must equal m x n. If not, it will
+            throw a std::domain_error. Random-access ranges are copied straight
+            into the matrix in parallel, and other ranges are read into it once.
+            \param m the number of rows.
+            \param n the number of columns.
+            \param first the beginning of the range.
+            \param last one-past the end of the range.
         */
-        matrix(size_type m, size_type n, std::vector<T>& v): transpose_toggle(true) { initialize(m, n, v); }
+        template <typename InputIt, typename = typename std::enable_if<
+            detail::is_iterator<InputIt>::value>::type>
+        matrix(size_type m, size_type n, InputIt first, InputIt last): transpose_toggle(true) 
+            { initialize(m, n, first, last, typename std::iterator_traits<InputIt>::iterator_category()); }
 
         //! Constructor that takes in a 2-D std::vector (a vector of vectors) to
         //! create a matrix.
         /*!
             \param v the 2-D std::vector (vector of vectors).
             \param fill_value the value with which undefined indexes are filled.
-            \sa initialize(size_type, size_type, std::vector<T>&)
+            \sa initialize(RowIt, RowIt, T)
         */
         matrix(const std::vector<std::vector<T>>& v, T fill_value=0): transpose_toggle(true) 
-            { initialize(v, fill_value); }
+            { initialize(v.begin(), v.end(), fill_value); }
+
+        //! Constructor that takes an iterator range of rows, each of which is a
+        //! range itself (such as a std::vector, std::array or std::deque).
+        /*!
+            The number of columns is the length of the longest row; shorter rows
+            are padded with fill_value.
+            \param first the first row.
+            \param last one-past the last row.
+            \param fill_value the value with which undefined indexes are filled.
+            \sa initialize(RowIt, RowIt, T)
+        */
+        template <typename RowIt, typename = typename std::enable_if<
+            detail::is_iterator<RowIt>::value>::type>
+        matrix(RowIt first, RowIt last, T fill_value=0): transpose_toggle(true) 
+            { initialize(first, last, fill_value); }
+
+
+        //! Copy constructor. Copies the elements in parallel.
+        matrix(const matrix<T>& other): num_rows(other.num_rows), num_cols(other.num_cols),
+            transpose_toggle(other.transpose_toggle) {
+            MXL_PROBE(copy, 0, other.data.size() * sizeof(T), other.data.size() * sizeof(T));
+            copy_parallel(other.data.data());
+        }
 
+        //! Move constructor. Leaves other as an empty matrix.
+        matrix(matrix<T>&& other): data(std::move(other.data)), num_rows(other.num_rows),
+            num_cols(other.num_cols), transpose_toggle(other.transpose_toggle) {
+            other.data.clear();
+            other.num_rows = other.num_cols = 0;
+            other.transpose_toggle = true;
+        }
 
         //! Overloaded = operator.
         /*!
@@ -112,10 +2410,25 @@ namespace mxl {
         */
         matrix<T>& operator=(const matrix<T>& rhs) {
             if (&rhs != this) {
-                data = rhs.data;
+                MXL_PROBE(copy, 0, rhs.data.size() * sizeof(T), rhs.data.size() * sizeof(T));
+                num_rows = rhs.num_rows;
+                num_cols = rhs.num_cols;
+                transpose_toggle = rhs.transpose_toggle;
+                copy_parallel(rhs.data.data());
+            }
+            return *this;
+        }
+
+        //! Overloaded move = operator. Leaves rhs as an empty matrix.
+        matrix<T>& operator=(matrix<T>&& rhs) {
+            if (&rhs != this) {
+                data = std::move(rhs.data);
                 num_rows = rhs.num_rows;
                 num_cols = rhs.num_cols;
                 transpose_toggle = rhs.transpose_toggle;
+                rhs.data.clear();
+                rhs.num_rows = rhs.num_cols = 0;
+                rhs.transpose_toggle = true;
             }
             return *this;
         }
@@ -147,7 +2460,7 @@ namespace mxl {
         iterator begin() { return data.begin(); }
         
         //! Returns a const iterator to the beginning (top-left) of the matrix.
-        const iterator begin() const { return data.cbegin(); }
+        const_iterator begin() const { return data.cbegin(); }
 
         //! Returns an iterator refering to one-past the end of the underlying
         //! matrix container.
@@ -157,60 +2470,189 @@ namespace mxl {
         //! matrix container.
         const_iterator end() const { return data.cend(); }
 
+        //! Returns a pointer to the underlying container.
+        /*!
+            Elements are stored row after row, unless is_transposed() is true,
+            in which case they are stored column after column.
+        */
+        T* raw_data() { return data.data(); }
+
+        //! Returns a const pointer to the underlying container.
+        const T* raw_data() const { return data.data(); }
+
+        //! Returns true if the underlying container is laid out column after
+        //! column, i.e. after an odd number of calls to transpose().
+        bool is_transposed() const { return !transpose_toggle; }
+
         //! Overloaded *= operator for matrix multiplication.
         /*!
             Throws a std::domain_error if the matrices don't have appropriate sizes.
+            Runs on current_context().
             \param rhs the matrix with the multiplication is done.
         */
         matrix<T>& operator*=(const matrix<T>& rhs) {
+            return multiply_assign(rhs, current_context());
+        }
+
+        //! Overloaded *= operator for scalar-matrix multiplication.
+        /*!
+            Runs on current_context().
+            \param scalar the scalar with the multiplication is done.
+        */
+        matrix<T>& operator*=(const T& scalar) {
+            return multiply_assign(scalar, current_context());
+        }
+
+        //! Overloaded += operator for matrix addition.
+        /*!
+            Throws a std::domain_error if the matrices don't have appropriate sizes.
+            Runs on current_context().
+            \param rhs the matrix with the addition is done.
+        */
+        matrix<T>& operator+=(const matrix<T>& rhs) {
+            return add_assign(rhs, current_context());
+        }
+
+        //! Same as operator*=(const matrix<T>&), but runs on the given context.
+        /*!
+            The algorithm (see multiply_algorithm) is the one the cost model
+            of get_cost_model<T>() predicts to be fastest for the shapes,
+            layouts and ctx's threads; set_multiply_hook() reports it. Every
+            algorithm but Strassen's, which is off by default, gives the same
+            result. The result is stored row after row. If ctx's cancellation
+            token is cancelled, throws mxl::operation_cancelled and leaves the
+            matrix unchanged.
+            \param rhs the matrix with the multiplication is done.
+            \param ctx the threads, executor and workspace to use.
+        */
+        matrix<T>& multiply_assign(const matrix<T>& rhs, const context& ctx) {
             if (!check_shape_mult(rhs)) {
                 std::string err = generate_error_message("multiplied", rhs);
                 throw std::domain_error(err);
             }
             // Number of columns in rhs
             size_type ncols = rhs.shape().second;
-            matrix<T> out(num_rows, ncols);
+            MXL_PROBE(multiply, 2 * num_rows * ncols * num_cols, (data.size() + rhs.data.size()) * sizeof(T),
+                num_rows * ncols * sizeof(T));
+
+            const T* a = data.data();
+            const T* b = rhs.data.data();
+            size_type a_rs = transpose_toggle ? num_cols : 1, a_cs = transpose_toggle ? 1 : num_rows;
+            size_type b_rs = rhs.transpose_toggle ? ncols : 1, b_cs = rhs.transpose_toggle ? 1 : rhs.num_rows;
+            size_type K = num_cols;
+
+            const detail::tuning_snapshot& tuning = detail::tuning_of<T>();
+            const blocking bl = tuning.bl;
+            const multiply_plan plan = detail::plan_multiply(num_rows, K, ncols, b_cs == 1,
+                ctx.exec ? ctx.threads : 1, std::is_floating_point<T>::value, tuning.cm, bl);
+            detail::report_plan(plan);
+            MXL_TRACE_SPAN(algorithm_name(plan.algorithm), "algorithm", "threads", plan.threads);
+            if (plan.algorithm == multiply_algorithm::strassen) {
+                *this = detail::multiply_strassen(*this, rhs, ctx);
+                return *this;
+            }
+
+            matrix<T> out(num_rows, ncols, detail::uninitialized_t());
+            T* c = out.raw_data();
+            // Single-threaded algorithms still run in chunks when cancelled or
+            // reporting progress, but all on the calling thread.
+            const std::size_t threads = plan.threads;
+            size_type grain = std::max<size_type>(1, detail::multiply_grain / std::max<size_type>(1, ncols * K));
 
-            for (size_type i = 0; i != num_rows; ++i)
-                for (size_type j = 0; j != ncols; ++j)
-                    for (size_type k = 0; k != num_cols; ++k)
-                        out(i, j) += (*this)(i, k) * rhs(k, j);
-            *this = out;
+            switch (plan.algorithm) {
+            case multiply_algorithm::unrolled:
+                ctx.parallel_for(num_rows, grain, [&](size_type i0, size_type i1) {
+                    detail::multiply_unrolled(a, a_rs, a_cs, b, b_rs, b_cs, c, ncols, K, i0, i1);
+                }, true, threads);
+                break;
+            case multiply_algorithm::gemv:
+                // One output column is A * b; one output row is B^T * a.
+                ctx.parallel_for(ncols == 1 ? num_rows : ncols, std::max<size_type>(1, detail::multiply_grain / K),
+                    [&](size_type x0, size_type x1) {
+                        if (ncols == 1)
+                            detail::multiply_gemv(a, a_rs, a_cs, b, b_rs, c, K, x0, x1);
+                        else
+                            detail::multiply_gemv(b, b_cs, b_rs, a, a_cs, c, K, x0, x1);
+                    }, true, threads);
+                break;
+            case multiply_algorithm::blocked:
+            case multiply_algorithm::parallel:
+                ctx.parallel_for(num_rows, detail::blocked_grain(ncols, K, bl), [&](size_type i0, size_type i1) {
+                    detail::multiply_blocked(a, a_rs, a_cs, b, b_rs, b_cs, c, ncols, K, i0, i1, bl, *ctx.arena);
+                }, true, threads);
+                break;
+            default: {
+                const bool needs_scratch = b_cs != 1 && a_cs != 1;
+                ctx.parallel_for(num_rows, grain, [&](size_type i0, size_type i1) {
+                    workspace::buffer scratch;
+                    if (needs_scratch)
+                        scratch = ctx.arena->acquire(K * sizeof(T));
+                    detail::multiply_rows(a, a_rs, a_cs, b, b_rs, b_cs, c, ncols, K, i0, i1, scratch.as<T>());
+                }, true, threads);
+            }
+            }
+            *this = std::move(out);
 
-            return *this;        
+            return *this;
         }
 
-        //! Overloaded *= operator for scalar-matrix multiplication.
+        //! Same as operator*=(const T&), but runs on the given context.
         /*!
-            Throws a std::domain_error if the matrices don't have appropriate sizes.
+            With a cancellation token, the result is written to new storage
+            first, so that a cancelled call leaves the matrix unchanged.
             \param scalar the scalar with the multiplication is done.
+            \param ctx the threads and executor to use.
         */
-        matrix<T>& operator*=(const T& scalar) {
-
-            for (size_type i = 0; i != num_rows; ++i)
-                for (size_type j = 0; j != num_cols; ++j)
-                    (*this)(i, j) *= scalar;
-
-            return *this;        
+        matrix<T>& multiply_assign(const T& scalar, const context& ctx) {
+            MXL_PROBE(scale, data.size(), data.size() * sizeof(T), data.size() * sizeof(T));
+            const T* p = data.data();
+            storage staged = staging(ctx);
+            T* dst = ctx.cancel ? staged.data() : data.data();
+            ctx.parallel_for(data.size(), detail::elementwise_grain, [&](size_type b, size_type e) {
+                for (size_type x = b; x != e; ++x)
+                    dst[x] = p[x] * scalar;
+            });
+            if (ctx.cancel)
+                data.swap(staged);
+            return *this;
         }
 
-        //! Overloaded += operator for matrix addition.
+        //! Same as operator+=, but runs on the given context.
         /*!
-            Throws a std::domain_error if the matrices don't have appropriate sizes.
+            With a cancellation token, the result is written to new storage
+            first, so that a cancelled call leaves the matrix unchanged.
             \param rhs the matrix with the addition is done.
+            \param ctx the threads and executor to use.
         */
-        matrix<T>& operator+=(const matrix<T>& rhs) {
+        matrix<T>& add_assign(const matrix<T>& rhs, const context& ctx) {
             if (!check_shape_add(rhs)) {
                 std::string err = generate_error_message("added", rhs);
                 throw std::domain_error(err);
             }
+            MXL_PROBE(add, data.size(), 2 * data.size() * sizeof(T), data.size() * sizeof(T));
 
-            matrix<T> out(num_rows, num_cols);
+            if (transpose_toggle == rhs.transpose_toggle) {
+                const T* p = data.data();
+                const T* q = rhs.data.data();
+                storage staged = staging(ctx);
+                T* dst = ctx.cancel ? staged.data() : data.data();
+                ctx.parallel_for(data.size(), detail::elementwise_grain, [&](size_type b, size_type e) {
+                    for (size_type x = b; x != e; ++x)
+                        dst[x] = p[x] + q[x];
+                });
+                if (ctx.cancel)
+                    data.swap(staged);
+                return *this;
+            }
 
-            for (size_type i = 0; i != num_rows; ++i)
-                for (size_type j = 0; j != num_cols; ++j)
-                    out(i, j) = (*this)(i, j) + rhs(i, j);
-            *this = out;
+            matrix<T> out(num_rows, num_cols, detail::uninitialized_t());
+            size_type grain = std::max<size_type>(1, detail::elementwise_grain / std::max<size_type>(1, num_cols));
+            ctx.parallel_for(num_rows, grain, [&](size_type i0, size_type i1) {
+                for (size_type i = i0; i != i1; ++i)
+                    for (size_type j = 0; j != num_cols; ++j)
+                        out(i, j) = (*this)(i, j) + rhs(i, j);
+            });
+            *this = std::move(out);
 
             return *this;
         }
@@ -237,30 +2679,41 @@ namespace mxl {
         }
 
         //! Returns a (const) std::string representation of the matrix.
-        std::string to_string() const {
+        /*!
+            Rows are written on separate lines, as in [[1, 2]\n [3, 4]]\n.
+            \param fmt the notation and precision of floating point elements.
+        */
+        std::string to_string(const format_options& fmt=format_options()) const {
             std::string out;
-            for (size_type i = 0; i < num_rows; ++i) {
-                for (size_type j = 0; j < num_cols; ++j) {
-                    if (j == 0 && num_cols == 1)
-                        out += "[[" + std::to_string((*this)(i, j)) + "]]\n";
-                    else if (i == 0 && j == 0)
-                        out += "[[" + std::to_string((*this)(i, j)) + ", ";
-                    else if (i == (num_rows - 1) && j == (num_cols - 1))
-                        out += std::to_string((*this)(i, j)) + "]]\n";
-                    else if (j == 0)
-                        out += " [" + std::to_string((*this)(i, j)) + ", ";
-                    else if (j == (num_cols - 1))
-                        out += std::to_string((*this)(i, j)) + "]\n";
-                    else
-                        out += std::to_string((*this)(i, j)) + ", ";
-                }
-            }
+            const std::size_t per_element = std::is_floating_point<T>::value ? 
+                static_cast<std::size_t>(std::max(fmt.precision, 0)) + 8 : 8;
+            out.reserve(num_rows * num_cols * per_element + num_rows * 4);
+            MXL_PROBE(format, 0, data.size() * sizeof(T), 0);
+            detail::string_sink sink(out);
+            write_to(sink, fmt);
+            MXL_PROBE_WRITTEN(out.size());
             return out;
         }
 
+        //! Writes the std::string matrix representation to a stream without
+        //! building the whole string first.
+        /*!
+            \param os the stream to write to.
+            \param fmt the notation and precision of floating point elements.
+        */
+        void print(std::ostream& os, const format_options& fmt=format_options()) const {
+            MXL_PROBE(format, 0, data.size() * sizeof(T), 0);
+            detail::stream_sink sink(os);
+            write_to(sink, fmt);
+            MXL_PROBE_WRITTEN(sink.written());
+        }
+
         //! Prints the std::string matrix representation to stdout.
-        void display() const {
-            std::cout << to_string();
+        /*!
+            \param fmt the notation and precision of floating point elements.
+        */
+        void display(const format_options& fmt=format_options()) const {
+            print(std::cout, fmt);
         }
 
         //! Returns a 2-D std::vector (vector of vectors) representation of the
@@ -288,16 +2741,41 @@ namespace mxl {
         }
 
         //! Returns a copy of the transposed matrix.
-        matrix<T> transpose_copy() {
-            transpose();
-            matrix<T> out(*this);
-            transpose();
+        matrix<T> transpose_copy() const {
+            MXL_PROBE(transpose_copy, 0, data.size() * sizeof(T), data.size() * sizeof(T));
+            // Same elements in the same order, read with the other layout.
+            matrix<T> out(num_cols, num_rows, detail::uninitialized_t());
+            out.transpose_toggle = !transpose_toggle;
+            out.copy_parallel(data.data());
             return out;            
         }
 
     private:
+        //! Constructor for an m x n matrix whose elements are left unset, for
+        //! outputs that a kernel writes in full. The kernel's threads then
+        //! first touch the pages they write.
+        matrix(size_type m, size_type n, detail::uninitialized_t): data(m * n), num_rows(m), num_cols(n),
+            transpose_toggle(true) {}
+
+        //! The container type, which leaves new elements unwritten
+        using storage = std::vector<T, detail::first_touch_allocator<T>>;
+
+        //! Constructor for an m x n matrix that takes over v, whose size the
+        //! caller has checked, without copying it.
+        matrix(storage&& v, size_type m, size_type n): data(std::move(v)), num_rows(m), num_cols(n),
+            transpose_toggle(true) {}
+
+        friend matrix<T> detail::adopt_storage<T>(std::size_t, std::size_t, storage&&);
+
+        //! Returns a container for an in-place operation to write to instead
+        //! of data when it may be cancelled part way, so that a cancelled
+        //! operation leaves the matrix unchanged. Empty otherwise.
+        storage staging(const context& ctx) const {
+            return ctx.cancel ? storage(data.size()) : storage();
+        }
+
         //! The underlying container
-        std::vector<T> data;
+        storage data;
         //! The number of rows in the matrix
         size_type num_rows;
         //! The number of columns in the matrix
@@ -305,13 +2783,44 @@ namespace mxl {
         //! The toggle which enables constant-time transpose
         bool transpose_toggle;
 
+        //! Formats every element into sink, which provides 
+        //! append(const char*, std::size_t).
+        /*!
+            \param sink the destination of the text.
+            \param fmt the notation and precision of floating point elements.
+        */
+        template <typename Sink>
+        void write_to(Sink& sink, const format_options& fmt) const {
+            char num[detail::max_number_chars<T>];
+            for (size_type i = 0; i < num_rows; ++i) {
+                for (size_type j = 0; j < num_cols; ++j) {
+                    if (num_cols == 1 || (i == 0 && j == 0))
+                        sink.append("[[", 2);
+                    else if (j == 0)
+                        sink.append(" [", 2);
+
+                    char* end = detail::format_number(num, num + sizeof(num), (*this)(i, j), fmt,
+                        std::is_floating_point<T>());
+                    sink.append(num, end - num);
+
+                    if (num_cols == 1 || (i == (num_rows - 1) && j == (num_cols - 1)))
+                        sink.append("]]\n", 3);
+                    else if (j == (num_cols - 1))
+                        sink.append("]\n", 2);
+                    else
+                        sink.append(", ", 2);
+                }
+            }
+        }
+
         //! Initializes the underlying container for the matrix constructor
         /*!
             \param init_val the value to fill the container with.
             \sa matrix(size_type, size_type, T)
         */
         void initialize(T init_val=0) {
-            data = std::vector<T>(num_rows * num_cols, init_val);
+            MXL_PROBE(initialize_value, 0, 0, num_rows * num_cols * sizeof(T));
+            fill_parallel(init_val);
         }
 
         //! Intializes the underlying container for the matrix constructed from
@@ -321,70 +2830,87 @@ namespace mxl {
             constructed.
         */
         void initialize(const std::initializer_list<std::initializer_list<T>>& il) { 
-            num_rows = il.size();
-            num_cols = il.begin()->size();
-            data = std::vector<T>(num_rows * num_cols);
-
-            using row_il_iter = typename std::initializer_list<std::initializer_list<T>>::iterator;
-            using col_il_iter = typename std::initializer_list<T>::iterator;
-
-            size_type i = 0, j = 0;
-            row_il_iter rb = il.begin();
-
-            while (rb != il.end()) {
-                col_il_iter cb = rb->begin();
-                j = 0;
-                while (cb != rb->end()) {
-                    (*this)(i, j) = *cb;
-                    j++; cb++;
-                }
-                i++; rb++;
-            }
+            initialize(il.begin(), il.end(), T(0));
         }
         
         //! Initializes the underlying container for the matrix constructor
         /*!
-            \param m the number of rows.
-            \param n the number of columns.
             \param initializer a string that can take one of four values: 
                 "zeros" (m x n matrix of 0s), "ones" (m x n matrix of 1s), 
                 "random" (m x n matrix of random numbers), "identity" (m x n
-                identity-like matrix).
-            \sa matrix(size_type, size_type, T)
+                identity-like matrix). Throws a std::domain_error otherwise.
+            \sa matrix(size_type, size_type, const std::string&)
         */
         void initialize(const std::string& initializer) {
             if (initializer == "zeros")
-                data = std::vector<T>(num_rows * num_cols, 0);
+                initialize(zeros);
             else if (initializer == "ones")
-                data = std::vector<T>(num_rows * num_cols, 1);
-            else if (initializer == "random" && std::is_floating_point<T>::value) {
-                data = std::vector<T>(num_rows * num_cols);
-                const int nrolls = num_rows * num_cols;
-                std::default_random_engine generator;
-                std::uniform_real_distribution<double> distribution(0.0, 1.0);
-
-                for (iterator b = data.begin(); b != data.end(); b++) {
-                    T number = distribution(generator);
-                    *b = number;
-                }
+                initialize(ones);
+            else if (initializer == "random")
+                initialize_random(std::is_floating_point<T>());
+            else if (initializer == "identity")
+                initialize(identity);
+            else
+                throw std::domain_error("Unknown matrix initializer \"" + initializer + "\".");
+        }
 
-            } else if (initializer == "random") {
-                data = std::vector<T>(num_rows * num_cols);
-                const int nrolls = num_rows * num_cols;
-                std::default_random_engine generator;
-                std::uniform_int_distribution<int> distribution(0, 1000000);
-                
-                for (iterator b = data.begin(); b != data.end(); b++) {
-                    T number = distribution(generator);
-                    *b = number;
-                }
+        //! Initializes the underlying container with 0s.
+        void initialize(zeros_t) {
+            MXL_PROBE(initialize_value, 0, 0, num_rows * num_cols * sizeof(T));
+            fill_parallel(T(0));
+        }
 
-            } else if (initializer == "identity") {
-                data = std::vector<T>(num_rows * num_cols, 0);
-                size_type k = std::min(num_rows, num_cols);
-                for (size_type i = 0; i != k; i++)
-                    (*this)(i, i) = 1;
-            }
+        //! Initializes the underlying container with 1s.
+        void initialize(ones_t) {
+            MXL_PROBE(initialize_value, 0, 0, num_rows * num_cols * sizeof(T));
+            fill_parallel(T(1));
+        }
+
+        //! Initializes the underlying container as an identity-like matrix.
+        void initialize(identity_t) {
+            MXL_PROBE(initialize_identity, 0, 0, num_rows * num_cols * sizeof(T));
+            fill_parallel(T(0));
+            size_type k = std::min(num_rows, num_cols);
+            for (size_type i = 0; i != k; i++)
+                data[i * num_cols + i] = T(1);
+        }
+
+        //! Fills the underlying container for the "random" string initializer
+        //! of a floating point matrix: uniform over [0, 1).
+        void initialize_random(std::true_type) {
+            MXL_PROBE(initialize_random, 0, 0, num_rows * num_cols * sizeof(T));
+            data = storage(num_rows * num_cols);
+            std::default_random_engine generator;
+            std::uniform_real_distribution<double> distribution(0.0, 1.0);
+
+            for (iterator b = data.begin(); b != data.end(); b++)
+                *b = distribution(generator);
+        }
+
+        //! Fills the underlying container for the "random" string initializer
+        //! of an integral matrix: uniform over [0, 1000000].
+        void initialize_random(std::false_type) {
+            MXL_PROBE(initialize_random, 0, 0, num_rows * num_cols * sizeof(T));
+            data = storage(num_rows * num_cols);
+            std::default_random_engine generator;
+            std::uniform_int_distribution<int> distribution(0, 1000000);
+
+            for (iterator b = data.begin(); b != data.end(); b++)
+                *b = distribution(generator);
+        }
+
+        //! Initializes the underlying container with samples from a
+        //! distribution.
+        /*!
+            \param dist the distribution to sample from.
+            \param seed the seed for the generator.
+            \sa matrix(size_type, size_type, const Distribution&, std::uint64_t)
+        */
+        template <typename Distribution>
+        void initialize(const Distribution& dist, std::uint64_t seed) {
+            MXL_PROBE(initialize_random, 0, 0, num_rows * num_cols * sizeof(T));
+            data = storage(num_rows * num_cols);
+            dist.fill(data.data(), data.size(), seed);
         }
 
         //! Initializes the underlying container for the matrix reshaped from an 
@@ -395,38 +2921,106 @@ namespace mxl {
             \param m the number of rows.
             \param n the number of columns.
             \param v std::vector that is reshaped to fill the matrix.
-            \sa matrix(size_type, size_type, std::vector<T>&)
+            \sa matrix(size_type, size_type, const std::vector<T>&)
+        */
+        void initialize(size_type m, size_type n, const std::vector<T>& v) {
+            initialize(m, n, v.begin(), v.end(), std::random_access_iterator_tag());
+        }
+
+        //! Initializes the underlying container for the matrix reshaped from a
+        //! random-access range, copied straight into it in parallel.
+        /*!
+            \sa matrix(size_type, size_type, InputIt, InputIt)
         */
-        void initialize(size_type m, size_type n, std::vector<T>& v) {
-            if (m * n != v.size()) {
-                std::string err = "Cannot convert given vector of size " + std::to_string(v.size()) +
+        template <typename It>
+        void initialize(size_type m, size_type n, It first, It last, std::random_access_iterator_tag) {
+            const size_type size = static_cast<size_type>(last - first);
+            check_reshape(m, n, size);
+            MXL_PROBE(initialize_vector, 0, size * sizeof(T), size * sizeof(T));
+            num_rows = m;
+            num_cols = n;
+            copy_parallel(first);
+        }
+
+        //! Initializes the underlying container for the matrix reshaped from a
+        //! single-pass range, which is read into it once.
+        template <typename It>
+        void initialize(size_type m, size_type n, It first, It last, std::input_iterator_tag) {
+            storage v(first, last);
+            check_reshape(m, n, v.size());
+            MXL_PROBE(initialize_vector, 0, v.size() * sizeof(T), v.size() * sizeof(T));
+            data = std::move(v);
+            num_rows = m;
+            num_cols = n;
+        }
+
+        //! Throws a std::domain_error unless size elements make an m x n matrix.
+        static void check_reshape(size_type m, size_type n, size_type size) {
+            if (m * n != size) {
+                std::string err = "Cannot convert given vector of size " + std::to_string(size) +
                     " to matrix of size (" + std::to_string(m) + ", " + std::to_string(n) + ").";
                 throw std::domain_error(err);
             }
-            data = v;
-            num_rows = m;
-            num_cols = n;
+        }
+
+        //! Sizes the container for the shape of the matrix and fills it with
+        //! value.
+        /*!
+            The new elements are written in the same chunks as the element-wise
+            kernels, so on NUMA machines each page lands on the node of the
+            thread that first touches it rather than all on the caller's. The
+            context's cancellation token and progress callback are ignored.
+        */
+        void fill_parallel(const T& value) {
+            data = storage(num_rows * num_cols);
+            T* p = data.data();
+            current_context().parallel_for(data.size(), detail::elementwise_grain, [&](size_type b, size_type e) {
+                std::fill(p + b, p + e, value);
+            }, false);
+        }
+
+        //! Same as fill_parallel(), but copies the elements from the
+        //! random-access range starting at src. Reuses
+        //! the container if it already has the right size.
+        template <typename It>
+        void copy_parallel(It src) {
+            if (data.size() != num_rows * num_cols)
+                data = storage(num_rows * num_cols);
+            T* p = data.data();
+            current_context().parallel_for(data.size(), detail::elementwise_grain, [&](size_type b, size_type e) {
+                std::copy(src + b, src + e, p + b);
+            }, false);
         }
 
         //! Intializes the underlying container for the matrix constructed from a
-        //! 2-D std::vector (a vector of vectors).
+        //! range of rows.
         /*!
-            \param v the 2-D std::vector (vector of vectors).
+            Makes one pass over the rows to find the widest, then appends each
+            row to the container in turn. Rows are appended with a range insert,
+            which copies contiguous rows of trivially copyable types in bulk, and
+            every element is written exactly once.
+            \param first the first row.
+            \param last one-past the last row.
             \param fill_value the value with which undefined indexes are filled.
-            \sa matrix(const std::vector<std::vector<T>>&, T)
-        */
-        void initialize(const std::vector<std::vector<T>>& v, size_type fill_value=0) {
-            size_type row_size = 0;
-            for (auto row: v)
-                if (row.size() > row_size)
-                    row_size = row.size();
-            num_rows = v.size();
+            \sa matrix(RowIt, RowIt, T)
+        */
+        template <typename RowIt>
+        void initialize(RowIt first, RowIt last, T fill_value) {
+            using std::begin;
+            using std::end;
+            size_type rows = 0, row_size = 0;
+            for (RowIt r = first; r != last; ++r, ++rows)
+                row_size = std::max<size_type>(row_size, std::distance(begin(*r), end(*r)));
+
+            num_rows = rows;
             num_cols = row_size;
-            data = std::vector<T>(num_rows * num_cols, fill_value);
-            
-            for (size_type i = 0; i < v.size(); i++) {
-                for (size_type j = 0; j < row_size; j++)
-                    (*this)(i, j) = v[i][j];
+            MXL_PROBE(initialize_rows, 0, 0, num_rows * num_cols * sizeof(T));
+            data.clear();
+            data.reserve(num_rows * num_cols);
+            for (RowIt r = first; r != last; ++r) {
+                size_type width = std::distance(begin(*r), end(*r));
+                data.insert(data.end(), begin(*r), end(*r));
+                data.insert(data.end(), num_cols - width, fill_value);
             }
         }
 
@@ -446,7 +3040,7 @@ namespace mxl {
         */
         bool check_shape_add(const matrix<T>& mat) {
             dimensions d = mat.shape();
-            return (d.first == mat.num_rows && d.second == mat.num_cols);
+            return (d.first == num_rows && d.second == num_cols);
         }
 
         //! A convenience function for generating error messages.
@@ -463,6 +3057,239 @@ namespace mxl {
 
     };
 
+    //! A read-only, non-owning view of matrix-shaped data.
+    /*!
+        The view reads from memory owned by someone else: a matrix, a buffer,
+        or a memory-mapped file (see mxl::load_mapped). An optional owner handle
+        keeps that memory alive for as long as any copy of the view exists.
+        Like matrix, it supports constant-time transposing.
+    */
+    template <typename T>
+    class matrix_view {
+    public:
+        //! Defines a size type, same as matrix<T>::size_type.
+        using size_type = typename matrix<T>::size_type;
+        //! Defines a dimensions type as std::pair of size_types.
+        using dimensions = typename matrix<T>::dimensions;
+        //! Defines the value_type as T.
+        using value_type = T;
+        //! Iterates over the underlying storage in memory order.
+        using const_iterator = const T*;
+
+        //! Default constructor, an empty view.
+        matrix_view(): ptr(nullptr), num_rows(0), num_cols(0), transpose_toggle(true) {}
+
+        //! Constructor for a view of m x n elements starting at data.
+        /*!
+            \param data the first element.
+            \param m the number of rows.
+            \param n the number of columns.
+            \param transposed whether the data is stored column after column.
+            \param owner an optional handle that keeps data alive.
+        */
+        matrix_view(const T* data, size_type m, size_type n, bool transposed=false,
+            std::shared_ptr<const void> owner=nullptr):
+            ptr(data), num_rows(m), num_cols(n), transpose_toggle(!transposed), owner(std::move(owner)) {}
+
+        //! Constructor for a view of a matrix. The matrix must outlive the view.
+        matrix_view(const matrix<T>& mat):
+            ptr(mat.raw_data()), num_rows(mat.shape().first), num_cols(mat.shape().second),
+            transpose_toggle(!mat.is_transposed()) {}
+
+        //! Returns a copy of the element in the i-th row and j-th column.
+        T operator()(size_type i, size_type j) const {
+            return transpose_toggle ? ptr[i * num_cols + j] : ptr[j * num_rows + i];
+        }
+
+        //! Returns the dimensions of the view as a std::pair.
+        dimensions shape() const { return std::make_pair(num_rows, num_cols); }
+
+        //! Returns a pointer to the viewed data.
+        const T* raw_data() const { return ptr; }
+
+        //! Returns true if the data is laid out column after column.
+        bool is_transposed() const { return !transpose_toggle; }
+
+        //! Returns a pointer to the first element in memory order.
+        const_iterator begin() const { return ptr; }
+
+        //! Returns a pointer one-past the last element in memory order.
+        const_iterator end() const { return ptr + num_rows * num_cols; }
+
+        //! Performs a constant-time transpose of the view.
+        matrix_view<T>& transpose() {
+            std::swap(num_cols, num_rows);
+            transpose_toggle ^= 1;
+            return *this;
+        }
+
+        //! Returns a matrix holding a copy of the viewed data, with the same
+        //! layout.
+        matrix<T> to_matrix() const {
+            if (transpose_toggle)
+                return matrix<T>(num_rows, num_cols, begin(), end());
+            matrix<T> out(num_cols, num_rows, begin(), end());
+            return out.transpose();
+        }
+
+    private:
+        //! The viewed data
+        const T* ptr;
+        //! The number of rows in the view
+        size_type num_rows;
+        //! The number of columns in the view
+        size_type num_cols;
+        //! The toggle which enables constant-time transpose
+        bool transpose_toggle;
+        //! Keeps the viewed data alive, if set
+        std::shared_ptr<const void> owner;
+    };
+
+    //! Writes the std::string matrix representation to a stream.
+    /*!
+        \param os the stream to write to.
+        \param mat the matrix to write.
+        \sa matrix::print
+    */
+    template<typename T>
+    std::ostream& operator<<(std::ostream& os, const matrix<T>& mat) {
+        mat.print(os);
+        return os;
+    }
+
+    //! Multiplies two matrices on the given context.
+    /*!
+        \param lhs the left matrix.
+        \param rhs the right matrix.
+        \param ctx the threads, executor and workspace to use.
+        \sa matrix::multiply_assign
+    */
+    template<typename T>
+    matrix<T> multiply(matrix<T> lhs, const matrix<T>& rhs, const context& ctx) {
+        return std::move(lhs.multiply_assign(rhs, ctx));
+    }
+
+    //! Multiplies two matrices with the textbook triple loop.
+    /*!
+        This is the original, unoptimized operator*=: one thread, element
+        access through operator(), no blocking or packing. It is kept as the
+        reference that the optimized kernels are checked against (see
+        test/regression.cpp) and is not meant for production use.
+        Throws a std::domain_error if the matrices don't have appropriate sizes.
+        \param lhs the left matrix.
+        \param rhs the right matrix.
+    */
+    template<typename T>
+    matrix<T> reference_multiply(const matrix<T>& lhs, const matrix<T>& rhs) {
+        if (lhs.shape().second != rhs.shape().first)
+            throw std::domain_error("Matrices with sizes (" + std::to_string(lhs.shape().first) + ", " +
+                std::to_string(lhs.shape().second) + ") and (" + std::to_string(rhs.shape().first) + ", " +
+                std::to_string(rhs.shape().second) + ") cannot be multiplied.");
+        const typename matrix<T>::size_type nrows = lhs.shape().first, ncols = rhs.shape().second,
+            K = lhs.shape().second;
+        matrix<T> out(nrows, ncols);
+        for (typename matrix<T>::size_type i = 0; i != nrows; ++i)
+            for (typename matrix<T>::size_type j = 0; j != ncols; ++j)
+                for (typename matrix<T>::size_type k = 0; k != K; ++k)
+                    out(i, j) += lhs(i, k) * rhs(k, j);
+        return out;
+    }
+
+    //! Returns the algorithm lhs * rhs would run with on ctx, without running
+    //! it. Throws a std::domain_error if the matrices don't have appropriate
+    //! sizes.
+    template<typename T>
+    multiply_plan plan_multiply(const matrix<T>& lhs, const matrix<T>& rhs, const context& ctx=current_context()) {
+        if (lhs.shape().second != rhs.shape().first)
+            throw std::domain_error("Matrices with sizes (" + std::to_string(lhs.shape().first) + ", " +
+                std::to_string(lhs.shape().second) + ") and (" + std::to_string(rhs.shape().first) + ", " +
+                std::to_string(rhs.shape().second) + ") cannot be multiplied.");
+        return detail::plan_multiply(lhs.shape().first, lhs.shape().second, rhs.shape().second,
+            rhs.shape().second == 1 || !rhs.is_transposed(), ctx.exec ? ctx.threads : 1,
+            std::is_floating_point<T>::value, get_cost_model<T>(), get_blocking<T>());
+    }
+
+    namespace detail {
+
+        //! Builds an m x n matrix from v, which holds its elements row after
+        //! row, without copying them; for readers that parse into the storage.
+        template <typename T>
+        matrix<T> adopt_storage(std::size_t m, std::size_t n, std::vector<T, first_touch_allocator<T>>&& v) {
+            if (m * n != v.size())
+                throw std::domain_error("Cannot convert given vector of size " + std::to_string(v.size()) +
+                    " to matrix of size (" + std::to_string(m) + ", " + std::to_string(n) + ").");
+            return matrix<T>(std::move(v), m, n);
+        }
+
+        //! Returns the (r, c) quadrant of mat, stored row after row.
+        template <typename T>
+        matrix<T> quadrant(const matrix<T>& mat, std::size_t r, std::size_t c) {
+            const std::size_t m = mat.shape().first / 2, n = mat.shape().second / 2;
+            matrix<T> q(m, n);
+            for (std::size_t i = 0; i != m; ++i)
+                for (std::size_t j = 0; j != n; ++j)
+                    q(i, j) = mat(r * m + i, c * n + j);
+            return q;
+        }
+
+        //! Returns x + sign * y for two matrices of the same shape stored
+        //! row after row.
+        template <typename T>
+        matrix<T> combine(const matrix<T>& x, const matrix<T>& y, int sign) {
+            matrix<T> out = x;
+            T* o = out.raw_data();
+            const T* q = y.raw_data();
+            for (std::size_t k = 0, size = out.shape().first * out.shape().second; k != size; ++k)
+                o[k] = sign > 0 ? o[k] + q[k] : o[k] - q[k];
+            return out;
+        }
+
+        //! Multiplies with one level of Strassen's recursion. The seven
+        //! half-size products go back through the dispatcher, so they may
+        //! recurse again.
+        template <typename T>
+        matrix<T> multiply_strassen(const matrix<T>& lhs, const matrix<T>& rhs, const context& ctx) {
+            const matrix<T> a11 = quadrant(lhs, 0, 0), a12 = quadrant(lhs, 0, 1), a21 = quadrant(lhs, 1, 0),
+                a22 = quadrant(lhs, 1, 1);
+            const matrix<T> b11 = quadrant(rhs, 0, 0), b12 = quadrant(rhs, 0, 1), b21 = quadrant(rhs, 1, 0),
+                b22 = quadrant(rhs, 1, 1);
+            const matrix<T> m1 = multiply(combine(a11, a22, 1), combine(b11, b22, 1), ctx);
+            const matrix<T> m2 = multiply(combine(a21, a22, 1), b11, ctx);
+            const matrix<T> m3 = multiply(a11, combine(b12, b22, -1), ctx);
+            const matrix<T> m4 = multiply(a22, combine(b21, b11, -1), ctx);
+            const matrix<T> m5 = multiply(combine(a11, a12, 1), b22, ctx);
+            const matrix<T> m6 = multiply(combine(a21, a11, -1), combine(b11, b12, 1), ctx);
+            const matrix<T> m7 = multiply(combine(a12, a22, -1), combine(b21, b22, 1), ctx);
+            const matrix<T> c11 = combine(combine(combine(m1, m4, 1), m5, -1), m7, 1);
+            const matrix<T> c12 = combine(m3, m5, 1), c21 = combine(m2, m4, 1);
+            const matrix<T> c22 = combine(combine(combine(m1, m2, -1), m3, 1), m6, 1);
+
+            const std::size_t m = c11.shape().first, n = c11.shape().second;
+            matrix<T> out(2 * m, 2 * n);
+            for (std::size_t i = 0; i != m; ++i)
+                for (std::size_t j = 0; j != n; ++j) {
+                    out(i, j) = c11(i, j);
+                    out(i, n + j) = c12(i, j);
+                    out(m + i, j) = c21(i, j);
+                    out(m + i, n + j) = c22(i, j);
+                }
+            return out;
+        }
+
+    }
+
+    //! Adds two matrices on the given context.
+    /*!
+        \param lhs the left matrix.
+        \param rhs the right matrix.
+        \param ctx the threads and executor to use.
+        \sa matrix::add_assign
+    */
+    template<typename T>
+    matrix<T> add(matrix<T> lhs, const matrix<T>& rhs, const context& ctx) {
+        return std::move(lhs.add_assign(rhs, ctx));
+    }
+
     //! Operator overloading for matrix multiplication.
     /*!
         \param lhs the left matrix.
@@ -470,7 +3297,7 @@ namespace mxl {
     */
     template<typename T>
     matrix<T> operator*(matrix<T> lhs, const matrix<T>& rhs) {
-        return lhs *= rhs;
+        return std::move(lhs *= rhs);
     }
 
     //! Operator overloading for matrix addition.
@@ -480,7 +3307,7 @@ namespace mxl {
     */
     template<typename T>
     matrix<T> operator+(matrix<T> lhs, const matrix<T>& rhs) {
-        return lhs += rhs;
+        return std::move(lhs += rhs);
     }
 
     //! Operator overloading for matrix-scalar multiplication.
@@ -490,7 +3317,7 @@ namespace mxl {
     */
     template<typename T>
     matrix<T> operator*(matrix<T> lhs, const T& scalar) {
-        return lhs *= scalar;
+        return std::move(lhs *= scalar);
     }
 
     //! Operator overloading for scalar-matrix multiplication.
@@ -500,7 +3327,7 @@ namespace mxl {
     */
     template<typename T>
     matrix<T> operator*(const T& scalar, matrix<T> rhs) {
-        return rhs *= scalar;
+        return std::move(rhs *= scalar);
     }
 
 }
\ No newline at end of file
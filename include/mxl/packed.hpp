@@ -0,0 +1,265 @@
+/*! \file packed.hpp
+    \brief Right operands packed once for many multiplications.
+
+    Every multiplication by the blocked kernel copies the right operand into
+    strips of nr columns (see mxl::blocking) before multiplying. When the
+    same matrix is multiplied by many different left operands, as a weight
+    matrix is in inference, a packed_matrix does that copy once:
+
+    \code
+    mxl::packed_matrix<float> w(weights);   // packs weights
+    for (const mxl::matrix<float>& x: inputs)
+        outputs.push_back(x * w);           // no packing of weights
+    \endcode
+
+    The packed strips hold every row of the operand, so they serve any kc
+    and nc, and products are identical to those of operator*. The packed
+    copy is independent of the matrix it was made from; bytes() reports its
+    size.
+*/
+#pragma once
+
+#include "mxl.hpp"
+
+namespace mxl {
+
+    namespace detail {
+
+        //! Computes rows [i0, i1) of C = A * B like multiply_blocked_rows,
+        //! with B packed by packed_matrix: column j of B is in strip j / NR,
+        //! so B(k, j) is at b[j / NR * NR * K + k * NR + j % NR].
+        /*!
+            packed_a needs room for round_up(mc, MR) * kc elements. bl.nc
+            must be a multiple of NR.
+        */
+        template <typename T, std::size_t MR, std::size_t NR>
+        void multiply_packed_rows(const T* a, std::size_t a_rs, std::size_t a_cs, const T* b, T* c, std::size_t n,
+                                  std::size_t K, std::size_t i0, std::size_t i1, const blocking& bl, T* packed_a) {
+            for (std::size_t i = i0; i != i1; ++i)
+                std::fill(c + i * n, c + (i + 1) * n, T(0));
+            for (std::size_t jc = 0; jc < n; jc += bl.nc) {
+                const std::size_t nc = std::min(bl.nc, n - jc);
+                for (std::size_t pc = 0; pc < K; pc += bl.kc) {
+                    const std::size_t kc = std::min(bl.kc, K - pc);
+                    for (std::size_t ic = i0; ic < i1; ic += bl.mc) {
+                        const std::size_t mc = std::min(bl.mc, i1 - ic);
+                        pack_left<T, MR>(a, a_rs, a_cs, ic, mc, pc, kc, packed_a);
+                        for (std::size_t jr = 0; jr < nc; jr += NR)
+                            for (std::size_t ir = 0; ir < mc; ir += MR)
+                                micro_kernel<T, MR, NR>(kc, packed_a + ir * kc, b + (jc + jr) * K + pc * NR,
+                                    c + (ic + ir) * n + jc + jr, n, std::min(MR, mc - ir), std::min(NR, nc - jr));
+                    }
+                }
+            }
+        }
+
+        //! Computes rows [i0, i1) and strips [s0, s1) of C = A * B, with B
+        //! packed by packed_matrix, one row of C at a time: for fewer rows
+        //! than a register tile.
+        /*!
+            Each element sees the same additions, in the same order, as in
+            multiply_rows. Full groups of strips are summed 64 columns at a
+            time, which keeps enough independent sums in flight; the strips
+            left over, one at a time.
+        */
+        template <typename T, std::size_t NR>
+        void multiply_packed_strips(const T* a, std::size_t a_rs, std::size_t a_cs, const T* b, T* c,
+                                    std::size_t n, std::size_t K, std::size_t i0, std::size_t i1, std::size_t s0,
+                                    std::size_t s1) {
+            const std::size_t G = 64 / NR;
+            for (std::size_t i = i0; i != i1; ++i) {
+                std::size_t s = s0;
+                for (; s + G <= s1 && (s + G) * NR <= n; s += G) {
+                    T* crow = c + i * n + s * NR;
+                    std::fill(crow, crow + G * NR, T(0));
+                    const T* ai = a + i * a_rs;
+                    const T* bk = b + s * NR * K;
+                    for (std::size_t k = 0; k != K; ++k, ai += a_cs, bk += NR) {
+                        const T aik = *ai;
+                        for (std::size_t g = 0; g != G; ++g)
+                            for (std::size_t j = 0; j != NR; ++j)
+                                crow[g * NR + j] += aik * bk[g * NR * K + j];
+                    }
+                }
+                for (; s != s1; ++s) {
+                    T acc[NR] = {};
+                    const T* ai = a + i * a_rs;
+                    const T* bk = b + s * NR * K;
+                    for (std::size_t k = 0; k != K; ++k, ai += a_cs, bk += NR)
+                        for (std::size_t j = 0; j != NR; ++j)
+                            acc[j] += *ai * bk[j];
+                    std::copy(acc, acc + std::min(NR, n - s * NR), c + i * n + s * NR);
+                }
+            }
+        }
+
+        //! Runs multiply_packed_rows with the register tile of bl, taking
+        //! the packing buffer for A from arena.
+        template <typename T>
+        void multiply_packed(const T* a, std::size_t a_rs, std::size_t a_cs, const T* b, T* c, std::size_t n,
+                             std::size_t K, std::size_t i0, std::size_t i1, const blocking& bl, workspace& arena) {
+            blocking fit = bl;
+            fit.mc = std::min(bl.mc, (i1 - i0 + bl.mr - 1) / bl.mr * bl.mr);
+            fit.kc = std::min(bl.kc, std::max<std::size_t>(K, 1));
+            fit.nc = std::max(bl.nr, std::min(bl.nc, (n + bl.nr - 1) / bl.nr * bl.nr) / bl.nr * bl.nr);
+            workspace::buffer pa = arena.acquire(blocked_buffer_sizes(fit).first * sizeof(T));
+            auto kernel = &multiply_packed_rows<T, 4, 8>;
+            if (fit.mr == 4 && fit.nr == 4)
+                kernel = &multiply_packed_rows<T, 4, 4>;
+            else if (fit.mr == 8 && fit.nr == 4)
+                kernel = &multiply_packed_rows<T, 8, 4>;
+            else if (fit.mr == 8 && fit.nr == 8)
+                kernel = &multiply_packed_rows<T, 8, 8>;
+            kernel(a, a_rs, a_cs, b, c, n, K, i0, i1, fit, pa.as<T>());
+        }
+
+    }
+
+    //! A matrix packed once into the blocked kernel's format, to be the
+    //! right operand of many multiplications.
+    /*!
+        The blocking (and with it the strip width nr) is fixed when the
+        matrix is packed; later set_blocking() calls do not affect it.
+    */
+    template <typename T>
+    class packed_matrix {
+    public:
+        //! Defines a size type, same as matrix<T>::size_type.
+        using size_type = typename matrix<T>::size_type;
+        //! Defines a dimensions type as std::pair of size_types.
+        using dimensions = typename matrix<T>::dimensions;
+        //! Defines the value_type as T.
+        using value_type = T;
+
+        //! Default constructor, an empty packed matrix.
+        packed_matrix(): num_rows(0), num_cols(0), bl(get_blocking<T>()) {}
+
+        //! Packs mat, on the given context, with the blocking of
+        //! get_blocking<T>().
+        /*!
+            \param mat the matrix to pack, in either layout.
+            \param ctx the threads and executor to pack on.
+        */
+        explicit packed_matrix(const matrix<T>& mat, const context& ctx=current_context()):
+            packed_matrix(mat, get_blocking<T>(), ctx) {}
+
+        //! Packs mat, on the given context, with the given blocking.
+        /*!
+            Throws a std::domain_error if bl is not valid.
+            \param mat the matrix to pack, in either layout.
+            \param blocks the blocking products with this matrix use.
+            \param ctx the threads and executor to pack on.
+        */
+        packed_matrix(const matrix<T>& mat, const blocking& blocks, const context& ctx=current_context()):
+            num_rows(mat.shape().first), num_cols(mat.shape().second), bl(blocks) {
+            if (!bl.valid())
+                throw std::domain_error("Unsupported blocking parameters: mc=" + std::to_string(bl.mc) + " kc=" +
+                    std::to_string(bl.kc) + " nc=" + std::to_string(bl.nc) + " mr=" + std::to_string(bl.mr) +
+                    " nr=" + std::to_string(bl.nr) + ".");
+            const size_type strips = (num_cols + bl.nr - 1) / bl.nr;
+            MXL_PROBE(copy, 0, num_rows * num_cols * sizeof(T), strips * bl.nr * num_rows * sizeof(T));
+            MXL_TRACE_SPAN("pack", "op", "rows", num_rows, "cols", num_cols);
+            data.resize(strips * bl.nr * num_rows);
+            const T* b = mat.raw_data();
+            const size_type rs = mat.is_transposed() ? 1 : num_cols, cs = mat.is_transposed() ? num_rows : 1;
+            const size_type grain = std::max<size_type>(1,
+                detail::multiply_grain / std::max<size_type>(1, bl.nr * num_rows));
+            // Each task writes (and first touches) its own strips.
+            ctx.parallel_for(strips, grain, [&](size_type s0, size_type s1) {
+                const size_type j0 = s0 * bl.nr, nc = std::min(num_cols, s1 * bl.nr) - j0;
+                T* out = data.data() + j0 * num_rows;
+                if (bl.nr == 4)
+                    detail::pack_right<T, 4>(b, rs, cs, 0, num_rows, j0, nc, out);
+                else
+                    detail::pack_right<T, 8>(b, rs, cs, 0, num_rows, j0, nc, out);
+            });
+        }
+
+        //! Returns the element in row i and column j.
+        T operator()(size_type i, size_type j) const {
+            return data[j / bl.nr * bl.nr * num_rows + i * bl.nr + j % bl.nr];
+        }
+
+        //! Returns the dimensions of the packed matrix as a std::pair.
+        dimensions shape() const { return std::make_pair(num_rows, num_cols); }
+
+        //! Returns the blocking the matrix was packed for.
+        const blocking& block() const { return bl; }
+
+        //! Returns the memory the packed elements take, in bytes, including
+        //! the zeros padding the last strip to nr columns.
+        std::size_t bytes() const { return data.size() * sizeof(T); }
+
+        //! Returns a pointer to the packed elements (see
+        //! detail::multiply_packed_rows for the layout).
+        const T* raw_data() const { return data.data(); }
+
+    private:
+        size_type num_rows;
+        size_type num_cols;
+        blocking bl;
+        std::vector<T, detail::first_touch_allocator<T>> data;
+    };
+
+    //! Multiplies a matrix by a packed matrix on the given context.
+    /*!
+        Uses the blocked kernel with the packed matrix's blocking, split
+        into rows across ctx's threads, so that only lhs is packed; with
+        fewer rows than a register tile, rows are multiplied by each strip
+        directly, with the strips split across threads. The result
+        is identical to lhs * rhs with the unpacked matrix and Strassen's
+        algorithm off, and is stored row after row. If ctx's cancellation
+        token is cancelled, throws mxl::operation_cancelled.
+        Throws a std::domain_error if the matrices don't have appropriate
+        sizes.
+        \param lhs the left matrix.
+        \param rhs the packed right matrix.
+        \param ctx the threads, executor and workspace to use.
+    */
+    template <typename T>
+    matrix<T> multiply(const matrix<T>& lhs, const packed_matrix<T>& rhs, const context& ctx) {
+        using size_type = typename matrix<T>::size_type;
+        const size_type m = lhs.shape().first, K = lhs.shape().second, n = rhs.shape().second;
+        if (K != rhs.shape().first)
+            throw std::domain_error("Matrices with sizes (" + std::to_string(m) + ", " + std::to_string(K) +
+                ") and (" + std::to_string(rhs.shape().first) + ", " + std::to_string(n) +
+                ") cannot be multiplied.");
+        MXL_PROBE(multiply, 2 * m * n * K, (m * K * sizeof(T) + rhs.bytes()), m * n * sizeof(T));
+        MXL_TRACE_SPAN("multiply_packed", "op", "rows", m, "cols", n);
+
+        matrix<T> out(m, n);
+        T* c = out.raw_data();
+        const T* a = lhs.raw_data();
+        const size_type a_rs = lhs.is_transposed() ? 1 : K, a_cs = lhs.is_transposed() ? m : 1;
+        const blocking& bl = rhs.block();
+        if (m < bl.mr) {
+            // Too few rows to fill a register tile (a single input, say):
+            // split the strips of rhs across threads instead.
+            const size_type strips = (n + bl.nr - 1) / bl.nr;
+            const size_type grain = std::max<size_type>(1,
+                detail::multiply_grain / std::max<size_type>(1, m * K * bl.nr));
+            ctx.parallel_for(strips, grain, [&](size_type s0, size_type s1) {
+                if (bl.nr == 4)
+                    detail::multiply_packed_strips<T, 4>(a, a_rs, a_cs, rhs.raw_data(), c, n, K, 0, m, s0, s1);
+                else
+                    detail::multiply_packed_strips<T, 8>(a, a_rs, a_cs, rhs.raw_data(), c, n, K, 0, m, s0, s1);
+            });
+        } else {
+            ctx.parallel_for(m, detail::blocked_grain(n, K, bl), [&](size_type i0, size_type i1) {
+                detail::multiply_packed(a, a_rs, a_cs, rhs.raw_data(), c, n, K, i0, i1, bl, *ctx.arena);
+            });
+        }
+        return out;
+    }
+
+    //! Operator overloading for multiplication by a packed matrix.
+    /*!
+        \param lhs the left matrix.
+        \param rhs the packed right matrix.
+    */
+    template <typename T>
+    matrix<T> operator*(const matrix<T>& lhs, const packed_matrix<T>& rhs) {
+        return multiply(lhs, rhs, current_context());
+    }
+
+}
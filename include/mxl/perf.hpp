@@ -0,0 +1,264 @@
+/*! \file perf.hpp
+    \brief Hardware performance counters around MXL calls, via Linux
+    perf_event_open.
+
+    perf_counters opens a set of counters (cycles, instructions, cache and
+    branch misses, plus a few software events) for the calling thread or for
+    every thread of the process, and perf_sample holds their values; the
+    difference of two samples is what happened in between:
+
+    \code
+    mxl::perf_counters pc(mxl::perf_scope::process);
+    mxl::perf_sample before = pc.read();
+    c = a * b;
+    mxl::perf_sample d = pc.read() - before;
+    if (d.has(mxl::perf_event::cycles))
+        std::cout << "IPC " << d.ipc() << "\n";
+    \endcode
+
+    Counters that cannot be opened (no PMU in a VM, perf_event_paranoid too
+    strict, not Linux) are simply missing from the samples: has() returns
+    false and they read 0. Nothing here throws when counters are missing.
+
+    With MXL_INSTRUMENT, enable_perf_instrumentation() also adds cycle,
+    instruction and miss deltas to each operation's mxl::op_stats.
+*/
+#pragma once
+
+#include "mxl.hpp"
+
+#include <array>
+
+#if defined(__linux__)
+#include <dirent.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#define MXL_HAS_PERF 1
+#endif
+
+namespace mxl {
+
+    //! The counters perf_counters tries to open.
+    enum class perf_event {
+        cycles,            //!< CPU cycles
+        instructions,      //!< instructions retired
+        cache_references,  //!< last-level cache accesses
+        cache_misses,      //!< last-level cache misses
+        branches,          //!< branch instructions
+        branch_misses,     //!< mispredicted branches
+        page_faults,       //!< page faults (software)
+        context_switches,  //!< context switches (software)
+        task_clock         //!< nanoseconds on a CPU (software)
+    };
+
+    //! The number of perf_event values.
+    const std::size_t num_perf_events = static_cast<std::size_t>(perf_event::task_clock) + 1;
+
+    //! Returns the name of a counter, e.g. "cache_misses".
+    inline const char* perf_event_name(perf_event e) {
+        static const char* const names[num_perf_events] = {"cycles", "instructions", "cache_references",
+            "cache_misses", "branches", "branch_misses", "page_faults", "context_switches", "task_clock"};
+        return names[static_cast<std::size_t>(e)];
+    }
+
+    //! Counter values at one moment, or the difference between two moments.
+    struct perf_sample {
+        //! Counter values, indexed by perf_event.
+        std::array<std::uint64_t, num_perf_events> values{};
+        //! Whether each counter could be read.
+        std::array<bool, num_perf_events> valid{};
+
+        //! Returns whether counter e was available.
+        bool has(perf_event e) const { return valid[static_cast<std::size_t>(e)]; }
+
+        //! Returns the value of counter e, or 0 if it is not available.
+        std::uint64_t operator[](perf_event e) const { return values[static_cast<std::size_t>(e)]; }
+
+        //! Returns instructions per cycle, or 0 if either is unavailable.
+        double ipc() const {
+            return has(perf_event::cycles) && has(perf_event::instructions) && (*this)[perf_event::cycles] ?
+                double((*this)[perf_event::instructions]) / (*this)[perf_event::cycles] : 0;
+        }
+
+        //! Returns the counts between an earlier sample and this one.
+        perf_sample operator-(const perf_sample& earlier) const {
+            perf_sample d;
+            for (std::size_t k = 0; k != num_perf_events; ++k) {
+                d.valid[k] = valid[k] && earlier.valid[k];
+                d.values[k] = d.valid[k] && values[k] > earlier.values[k] ? values[k] - earlier.values[k] : 0;
+            }
+            return d;
+        }
+    };
+
+    //! Which threads perf_counters counts.
+    enum class perf_scope {
+        //! The thread that creates the perf_counters.
+        this_thread,
+        //! Every thread of the process that exists when the perf_counters is
+        //! created, including MXL's worker threads (start the pools first).
+        process
+    };
+
+    //! A set of open performance counters.
+    /*!
+        Counters count user-space events only, so they work with the default
+        perf_event_paranoid setting of 2. When the PMU is shared, values are
+        scaled up by the fraction of time each counter was scheduled.
+    */
+    class perf_counters {
+    public:
+        //! Opens every counter it can for the threads in scope.
+        explicit perf_counters(perf_scope scope=perf_scope::this_thread) {
+#ifdef MXL_HAS_PERF
+            std::vector<pid_t> tids;
+            if (scope == perf_scope::this_thread)
+                tids.push_back(static_cast<pid_t>(::syscall(SYS_gettid)));
+            else if (DIR* dir = ::opendir("/proc/self/task")) {
+                while (dirent* d = ::readdir(dir))
+                    if (d->d_name[0] != '.')
+                        tids.push_back(static_cast<pid_t>(std::atoi(d->d_name)));
+                ::closedir(dir);
+            }
+            for (std::size_t k = 0; k != num_perf_events; ++k)
+                for (pid_t tid: tids) {
+                    int fd = open_event(static_cast<perf_event>(k), tid);
+                    if (fd >= 0)
+                        fds[k].push_back(fd);
+                    else if (problem.empty())
+                        problem = std::string(perf_event_name(static_cast<perf_event>(k))) + ": " +
+                            std::strerror(errno);
+                }
+#else
+            (void)scope;
+            problem = "performance counters need Linux perf_event_open";
+#endif
+        }
+
+        ~perf_counters() {
+#ifdef MXL_HAS_PERF
+            for (std::vector<int>& event: fds)
+                for (int fd: event)
+                    ::close(fd);
+#endif
+        }
+
+        perf_counters(const perf_counters&) = delete;
+        perf_counters& operator=(const perf_counters&) = delete;
+
+        //! Returns whether the counter e is open.
+        bool has(perf_event e) const { return !fds[static_cast<std::size_t>(e)].empty(); }
+
+        //! Returns whether any hardware counter (cycles to branch misses) is open.
+        bool hardware_available() const {
+            for (std::size_t k = 0; k <= static_cast<std::size_t>(perf_event::branch_misses); ++k)
+                if (!fds[k].empty())
+                    return true;
+            return false;
+        }
+
+        //! Describes the first counter that could not be opened, or is empty.
+        const std::string& error() const { return problem; }
+
+        //! Returns the current totals, summed over the counted threads.
+        perf_sample read() const {
+            perf_sample s;
+#ifdef MXL_HAS_PERF
+            for (std::size_t k = 0; k != num_perf_events; ++k) {
+                s.valid[k] = !fds[k].empty();
+                for (int fd: fds[k]) {
+                    // value, time enabled, time running
+                    std::uint64_t v[3] = {0, 0, 0};
+                    if (::read(fd, v, sizeof(v)) != static_cast<ssize_t>(sizeof(v))) {
+                        s.valid[k] = false;
+                        continue;
+                    }
+                    s.values[k] += v[2] && v[2] < v[1] ? static_cast<std::uint64_t>(double(v[0]) * v[1] / v[2]) : v[0];
+                }
+            }
+#endif
+            return s;
+        }
+
+    private:
+#ifdef MXL_HAS_PERF
+        static int open_event(perf_event e, pid_t tid) {
+            static const std::uint32_t types[num_perf_events] = {PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE,
+                PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_SOFTWARE,
+                PERF_TYPE_SOFTWARE, PERF_TYPE_SOFTWARE};
+            static const std::uint64_t configs[num_perf_events] = {PERF_COUNT_HW_CPU_CYCLES,
+                PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_REFERENCES, PERF_COUNT_HW_CACHE_MISSES,
+                PERF_COUNT_HW_BRANCH_INSTRUCTIONS, PERF_COUNT_HW_BRANCH_MISSES, PERF_COUNT_SW_PAGE_FAULTS,
+                PERF_COUNT_SW_CONTEXT_SWITCHES, PERF_COUNT_SW_TASK_CLOCK};
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = types[static_cast<std::size_t>(e)];
+            attr.config = configs[static_cast<std::size_t>(e)];
+            attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            return static_cast<int>(::syscall(SYS_perf_event_open, &attr, tid, -1, -1, 0));
+        }
+#endif
+
+        std::array<std::vector<int>, num_perf_events> fds;
+        std::string problem;
+    };
+
+    //! Runs f and returns the counter deltas it caused.
+    /*!
+        \param f the work to measure.
+        \param scope the threads to count; use perf_scope::process to include
+        MXL's worker threads.
+    */
+    template <typename F>
+    perf_sample measure(F&& f, perf_scope scope=perf_scope::this_thread) {
+        perf_counters pc(scope);
+        perf_sample before = pc.read();
+        f();
+        return pc.read() - before;
+    }
+
+    namespace detail {
+
+        //! Samples the calling thread's cycles, instructions, cache misses
+        //! and branch misses for the instrumentation layer.
+        inline bool sample_thread_counters(std::uint64_t* out) {
+            thread_local perf_counters pc(perf_scope::this_thread);
+            if (!pc.hardware_available())
+                return false;
+            perf_sample s = pc.read();
+            out[0] = s[perf_event::cycles];
+            out[1] = s[perf_event::instructions];
+            out[2] = s[perf_event::cache_misses];
+            out[3] = s[perf_event::branch_misses];
+            return true;
+        }
+
+    }
+
+    //! Adds hardware counter deltas to the instrumentation counters.
+    /*!
+        After this call, each operation counted by MXL_INSTRUMENT also
+        accumulates the cycles, instructions, cache misses and branch misses
+        of the thread that called it (not of its worker threads) into its
+        op_stats. Each operation then makes a few extra system calls.
+        \return false if MXL was built without MXL_INSTRUMENT or the calling
+        thread has no hardware counters; the instrumentation is unchanged.
+    */
+    inline bool enable_perf_instrumentation() {
+        std::uint64_t probe[detail::num_hw_counters];
+        if (!instrumentation_enabled() || !detail::sample_thread_counters(probe))
+            return false;
+        detail::hardware_sampler() = &detail::sample_thread_counters;
+        return true;
+    }
+
+    //! Stops adding hardware counter deltas to the instrumentation counters.
+    inline void disable_perf_instrumentation() { detail::hardware_sampler() = nullptr; }
+
+}
@@ -0,0 +1,393 @@
+/*! \file tasks.hpp
+    \brief A work-stealing task graph runtime for tiled algorithms.
+
+    Blocked algorithms (LU, Cholesky, QR, tiled products) form irregular
+    dependency graphs: a tile task can start as soon as the tasks it depends
+    on are done, long before a whole fork-join phase finishes. mxl::task_graph
+    records tasks and their dependencies and runs each task as soon as it is
+    ready, on workers that keep ready tasks in lock-free work-stealing deques.
+    mxl::block_grid cuts a matrix into blocks for such tasks to work on.
+
+    Workers run on the executor of an mxl::context (the calling thread is one
+    of them), so the graph shares threads with the rest of the program.
+*/
+#pragma once
+
+#include "mxl.hpp"
+
+#include <deque>
+
+namespace mxl {
+
+    namespace detail {
+
+        //! A Chase-Lev work-stealing deque of pointers.
+        /*!
+            The owning worker pushes and pops at the bottom without locks;
+            other workers steal from the top. The ring grows when full; old
+            rings are kept until the deque is destroyed, since a thief may
+            still be reading one.
+        */
+        template <typename T>
+        class work_stealing_deque {
+        public:
+            explicit work_stealing_deque(std::size_t capacity=64): top(0), bottom(0) {
+                rings.emplace_back(new ring(capacity));
+                array.store(rings.back().get(), std::memory_order_relaxed);
+            }
+
+            work_stealing_deque(const work_stealing_deque&) = delete;
+            work_stealing_deque& operator=(const work_stealing_deque&) = delete;
+
+            //! Adds x at the bottom. Owner only.
+            void push(T* x) {
+                std::int64_t b = bottom.load(std::memory_order_relaxed);
+                std::int64_t t = top.load(std::memory_order_acquire);
+                ring* a = array.load(std::memory_order_relaxed);
+                if (b - t > static_cast<std::int64_t>(a->capacity) - 1) {
+                    rings.emplace_back(a->grow(b, t));
+                    a = rings.back().get();
+                    array.store(a, std::memory_order_release);
+                }
+                a->put(b, x);
+                bottom.store(b + 1, std::memory_order_release);
+            }
+
+            //! Takes the bottom element, or returns nullptr. Owner only.
+            T* pop() {
+                std::int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+                ring* a = array.load(std::memory_order_relaxed);
+                bottom.store(b, std::memory_order_seq_cst);
+                std::int64_t t = top.load(std::memory_order_seq_cst);
+                if (t > b) {
+                    bottom.store(b + 1, std::memory_order_relaxed);
+                    return nullptr;
+                }
+                T* x = a->get(b);
+                if (t == b) {
+                    // Last element: race the thieves for it.
+                    if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                        x = nullptr;
+                    bottom.store(b + 1, std::memory_order_relaxed);
+                }
+                return x;
+            }
+
+            //! Takes the top element, or returns nullptr if the deque is empty
+            //! or another worker won the race for it. Any thread.
+            T* steal() {
+                std::int64_t t = top.load(std::memory_order_seq_cst);
+                std::int64_t b = bottom.load(std::memory_order_seq_cst);
+                if (t >= b)
+                    return nullptr;
+                ring* a = array.load(std::memory_order_acquire);
+                T* x = a->get(t);
+                if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                    return nullptr;
+                return x;
+            }
+
+        private:
+            struct ring {
+                std::size_t capacity;
+                std::unique_ptr<std::atomic<T*>[]> slots;
+
+                explicit ring(std::size_t capacity): capacity(capacity), slots(new std::atomic<T*>[capacity]) {}
+
+                T* get(std::int64_t i) const {
+                    return slots[static_cast<std::size_t>(i) & (capacity - 1)].load(std::memory_order_relaxed);
+                }
+
+                void put(std::int64_t i, T* x) {
+                    slots[static_cast<std::size_t>(i) & (capacity - 1)].store(x, std::memory_order_relaxed);
+                }
+
+                ring* grow(std::int64_t b, std::int64_t t) const {
+                    ring* r = new ring(capacity * 2);
+                    for (std::int64_t i = t; i != b; ++i)
+                        r->put(i, get(i));
+                    return r;
+                }
+            };
+
+            std::atomic<std::int64_t> top;
+            std::atomic<std::int64_t> bottom;
+            std::atomic<ring*> array;
+            std::vector<std::unique_ptr<ring>> rings;
+        };
+
+    }
+
+    //! A graph of tasks with dependencies, run by work-stealing workers.
+    /*!
+        Add tasks with add(), naming the tasks each one depends on; the
+        dependencies must already be in the graph, so the graph is acyclic by
+        construction. run() executes every task once its dependencies have
+        finished, and returns when all tasks are done. A graph can be run more
+        than once.
+
+        \code
+        mxl::task_graph g;
+        auto a = g.add([&] { ... });
+        auto b = g.add([&] { ... });
+        g.add([&] { ... }, {a, b});   // runs after a and b
+        g.run();
+        \endcode
+    */
+    class task_graph {
+    public:
+        //! Identifies a task within its graph.
+        using task_id = std::size_t;
+
+        //! Adds a task.
+        /*!
+            Throws a std::out_of_range if a dependency is not in the graph.
+            \param fn the work to do.
+            \param deps the tasks that must finish before fn starts.
+            \return the new task's id.
+        */
+        task_id add(std::function<void()> fn, const std::vector<task_id>& deps=std::vector<task_id>()) {
+            task_id id = nodes.size();
+            for (task_id d: deps)
+                if (d >= id)
+                    throw std::out_of_range("Task " + std::to_string(d) + " is not in the graph.");
+            nodes.emplace_back();
+            nodes.back().fn = std::move(fn);
+            nodes.back().num_deps = deps.size();
+            nodes.back().id = id;
+            for (task_id d: deps)
+                nodes[d].successors.push_back(id);
+            return id;
+        }
+
+        //! Same as above, for a braced list of dependencies.
+        task_id add(std::function<void()> fn, std::initializer_list<task_id> deps) {
+            return add(std::move(fn), std::vector<task_id>(deps));
+        }
+
+        //! Returns the number of tasks in the graph.
+        std::size_t size() const { return nodes.size(); }
+
+        //! Runs every task, each as soon as its dependencies have finished.
+        /*!
+            Up to ctx.threads workers take part: the calling thread, and helpers
+            submitted to ctx.exec. A task's newly ready successors go to the
+            bottom of its worker's deque, so chains of dependent tiles stay on
+            one core while idle workers steal from the top of other deques, or
+            sleep until a task releases new ones. If
+            a task throws, the remaining tasks are skipped and the first
+            exception is rethrown. The cancellation token of ctx is checked
+            before each task, and its progress callback is called after each.
+            \param ctx the threads and executor to run on.
+        */
+        void run(const context& ctx=current_context()) {
+            if (nodes.empty())
+                return;
+            MXL_TRACE_SPAN("task_graph", "op", "tasks", nodes.size());
+            std::size_t workers = std::max<std::size_t>(1, std::min(ctx.threads, nodes.size()));
+            std::shared_ptr<run_state> st = std::make_shared<run_state>(nodes, workers, ctx);
+            for (node& n: nodes)
+                n.pending.store(n.num_deps, std::memory_order_relaxed);
+            // Seed the caller's deque before any helper can look at it.
+            for (node& n: nodes)
+                if (!n.num_deps)
+                    st->deques[0]->push(&n);
+
+            for (std::size_t w = 1; w < workers && ctx.exec; ++w)
+                ctx.exec->submit([st, w] { work(*st, w); });
+            work(*st, 0);
+
+            std::unique_lock<std::mutex> lock(st->m);
+            st->finished.wait(lock, [&] { return st->remaining.load() == 0 && st->active == 0; });
+            if (st->error)
+                std::rethrow_exception(st->error);
+        }
+
+    private:
+        struct node {
+            std::function<void()> fn;
+            std::vector<task_id> successors;
+            std::size_t num_deps = 0;
+            task_id id = 0;
+            std::atomic<std::size_t> pending{0};
+        };
+
+        struct run_state {
+            std::deque<node>& nodes;
+            const context& ctx;
+            std::vector<std::unique_ptr<detail::work_stealing_deque<node>>> deques;
+            std::atomic<std::size_t> remaining;
+            std::atomic<bool> failed{false};
+            //! Workers currently inside work(), guarded by m.
+            std::size_t active = 0;
+            //! Tasks reported to the progress callback, guarded by m.
+            std::size_t reported = 0;
+            //! Incremented whenever a task releases successors.
+            std::atomic<std::size_t> released{0};
+            //! Workers waiting on ready for tasks to be released.
+            std::atomic<std::size_t> parked{0};
+            std::exception_ptr error;
+            std::mutex m;
+            std::condition_variable finished;
+            std::condition_variable ready;
+
+            run_state(std::deque<node>& nodes, std::size_t workers, const context& ctx):
+                nodes(nodes), ctx(ctx), remaining(nodes.size()) {
+                for (std::size_t w = 0; w != workers; ++w)
+                    deques.emplace_back(new detail::work_stealing_deque<node>());
+            }
+        };
+
+        //! The loop of worker w: pop own tasks, else steal, until all are done.
+        //! Helpers that start after the run has finished return at once.
+        static void work(run_state& st, std::size_t w) {
+            {
+                std::lock_guard<std::mutex> lock(st.m);
+                if (st.remaining.load() == 0)
+                    return;
+                ++st.active;
+            }
+            detail::work_stealing_deque<node>& own = *st.deques[w];
+            std::size_t victim = w, idle = 0;
+            while (st.remaining.load(std::memory_order_acquire) != 0) {
+                const std::size_t seen = st.released.load();
+                node* n = own.pop();
+                for (std::size_t tries = 0; !n && tries != st.deques.size(); ++tries) {
+                    victim = (victim + 1) % st.deques.size();
+                    if (victim != w)
+                        n = st.deques[victim]->steal();
+                }
+                if (!n) {
+                    if (++idle > 64)
+                        park(st, seen);
+                    continue;
+                }
+                idle = 0;
+                execute(st, *n, own);
+            }
+            std::lock_guard<std::mutex> lock(st.m);
+            --st.active;
+            st.finished.notify_all();
+        }
+
+        //! Waits until a task releases successors after the count seen, or
+        //! every task has finished.
+        static void park(run_state& st, std::size_t seen) {
+            std::unique_lock<std::mutex> lock(st.m);
+            ++st.parked;
+            st.ready.wait(lock, [&] { return st.released.load() != seen || st.remaining.load() == 0; });
+            --st.parked;
+        }
+
+        //! Runs one task and releases its successors onto own.
+        static void execute(run_state& st, node& n, detail::work_stealing_deque<node>& own) {
+            bool ran = false;
+            if (!st.failed.load(std::memory_order_relaxed)) {
+                try {
+                    st.ctx.throw_if_cancelled();
+                    MXL_TRACE_SPAN("task", "task", "id", n.id);
+                    n.fn();
+                    ran = true;
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(st.m);
+                    if (!st.error)
+                        st.error = std::current_exception();
+                    st.failed = true;
+                }
+            }
+            bool released = false;
+            for (task_id s: n.successors)
+                if (st.nodes[s].pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    own.push(&st.nodes[s]);
+                    released = true;
+                }
+            if (released) {
+                // A worker parks only after counting itself in parked and
+                // finding released unchanged, so either it sees this release
+                // or this thread sees it parked.
+                ++st.released;
+                if (st.parked.load() != 0) {
+                    std::lock_guard<std::mutex> lock(st.m);
+                    st.ready.notify_all();
+                }
+            }
+            std::size_t left = st.remaining.fetch_sub(1, std::memory_order_acq_rel) - 1;
+            if (ran && st.ctx.progress) {
+                std::lock_guard<std::mutex> lock(st.m);
+                st.ctx.progress(++st.reported, st.nodes.size());
+            }
+            if (!left) {
+                std::lock_guard<std::mutex> lock(st.m);
+                st.finished.notify_all();
+                st.ready.notify_all();
+            }
+        }
+
+        //! Tasks in order of addition; a deque keeps them in place as it grows.
+        std::deque<node> nodes;
+    };
+
+    //! A matrix cut into a grid of blocks, for tiled algorithms.
+    /*!
+        Blocks are ordinary matrices, so tasks can use the matrix operators on
+        them. Blocks on the right and bottom edges are smaller when the block
+        size does not divide the matrix.
+    */
+    template <typename T>
+    class block_grid {
+    public:
+        //! Defines a size type, same as matrix<T>::size_type.
+        using size_type = typename matrix<T>::size_type;
+        //! Defines a dimensions type as std::pair of size_types.
+        using dimensions = typename matrix<T>::dimensions;
+
+        //! Constructor that copies mat into blocks of block_rows x block_cols.
+        block_grid(const matrix<T>& mat, size_type block_rows, size_type block_cols):
+            rows(mat.shape().first), cols(mat.shape().second), block_rows(block_rows), block_cols(block_cols) {
+            if (!block_rows || !block_cols)
+                throw std::domain_error("Blocks must have at least one row and one column.");
+            for (size_type bi = 0; bi != grid().first; ++bi)
+                for (size_type bj = 0; bj != grid().second; ++bj) {
+                    size_type i0 = bi * block_rows, j0 = bj * block_cols;
+                    size_type m = std::min(block_rows, rows - i0), n = std::min(block_cols, cols - j0);
+                    matrix<T> b(m, n);
+                    for (size_type i = 0; i != m; ++i)
+                        for (size_type j = 0; j != n; ++j)
+                            b(i, j) = mat(i0 + i, j0 + j);
+                    blocks.push_back(std::move(b));
+                }
+        }
+
+        //! Returns block (bi, bj).
+        matrix<T>& operator()(size_type bi, size_type bj) { return blocks[bi * grid().second + bj]; }
+
+        //! Returns block (bi, bj).
+        const matrix<T>& operator()(size_type bi, size_type bj) const { return blocks[bi * grid().second + bj]; }
+
+        //! Returns the number of blocks down and across.
+        dimensions grid() const {
+            return std::make_pair((rows + block_rows - 1) / block_rows, (cols + block_cols - 1) / block_cols);
+        }
+
+        //! Returns the dimensions of the whole matrix.
+        dimensions shape() const { return std::make_pair(rows, cols); }
+
+        //! Reassembles the blocks into a matrix.
+        matrix<T> to_matrix() const {
+            matrix<T> out(rows, cols);
+            for (size_type bi = 0; bi != grid().first; ++bi)
+                for (size_type bj = 0; bj != grid().second; ++bj) {
+                    const matrix<T>& b = (*this)(bi, bj);
+                    for (size_type i = 0; i != b.shape().first; ++i)
+                        for (size_type j = 0; j != b.shape().second; ++j)
+                            out(bi * block_rows + i, bj * block_cols + j) = b(i, j);
+                }
+            return out;
+        }
+
+    private:
+        size_type rows, cols, block_rows, block_cols;
+        std::vector<matrix<T>> blocks;
+    };
+
+}
@@ -0,0 +1,678 @@
+/*! \file tiled.hpp
+    \brief Out-of-core, disk-backed tiled matrices.
+
+    A tiled_matrix keeps its elements in a file, cut into fixed-size tiles
+    that are stored one after the other, each row after row. Only the tiles
+    in use are held in memory, in an LRU cache bounded by a memory budget, so
+    matrices far larger than RAM can be multiplied, added and transposed by
+    streaming tiles through the in-memory matrix kernels.
+
+    The file is a 64-byte header followed by the tiles:
+
+    | offset | size | field                                     |
+    |--------|------|-------------------------------------------|
+    | 0      | 6    | magic, "MXLTIL"                           |
+    | 6      | 1    | format version (1)                        |
+    | 7      | 1    | dtype code (see mxl::dtype)               |
+    | 8      | 4    | byte order mark, 0x01020304               |
+    | 12     | 4    | element size in bytes                     |
+    | 16     | 8    | number of rows                            |
+    | 24     | 8    | number of columns                         |
+    | 32     | 8    | rows per tile                             |
+    | 40     | 8    | columns per tile                          |
+    | 48     | 16   | reserved, 0                               |
+
+    Tiles on the right and bottom edges are stored at full size, padded with
+    zeros. This header requires POSIX file I/O (pread and pwrite).
+
+    Reads can be issued ahead of time with tiled_matrix::prefetch; a small
+    pool of reader threads (or the I/O executor of current_context(), if it
+    has one) loads them into the cache while the caller keeps computing.
+    multiply, add and transpose prefetch the tiles of their next steps
+    automatically, and tile_cache_stats reports how long the caller stalled
+    on reads, to tell I/O-bound jobs from compute-bound ones.
+*/
+#pragma once
+
+#include "io.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <future>
+#include <list>
+#include <unordered_map>
+
+namespace mxl {
+
+    //! Counters describing the tile cache of a tiled_matrix.
+    struct tile_cache_stats {
+        //! Tile reads served from memory.
+        std::size_t hits = 0;
+        //! Tile reads that went to the file.
+        std::size_t misses = 0;
+        //! Tiles dropped from the cache to stay within the budget.
+        std::size_t evictions = 0;
+        //! Bytes read from the file.
+        std::size_t bytes_read = 0;
+        //! Bytes written to the file.
+        std::size_t bytes_written = 0;
+        //! Tile reads issued ahead of time by prefetch().
+        std::size_t prefetches = 0;
+        //! Prefetched tiles that were in memory by the time they were needed.
+        std::size_t prefetch_hits = 0;
+        //! Nanoseconds the caller spent waiting for tiles to be read. Compare
+        //! with the job's wall time: close to it means I/O-bound.
+        std::uint64_t stall_ns = 0;
+        //! Nanoseconds spent reading tiles, on any thread.
+        std::uint64_t read_ns = 0;
+    };
+
+    namespace detail {
+
+        //! On-disk header of a tiled matrix file, see tiled.hpp.
+        struct tiled_header {
+            char magic[6];
+            std::uint8_t version;
+            std::uint8_t type;
+            std::uint32_t byte_order;
+            std::uint32_t element_size;
+            std::uint64_t rows;
+            std::uint64_t cols;
+            std::uint64_t tile_rows;
+            std::uint64_t tile_cols;
+            std::uint64_t reserved[2];
+        };
+
+        static_assert(sizeof(tiled_header) == 64, "tiled_header must be 64 bytes.");
+
+        const char tiled_magic[6] = {'M', 'X', 'L', 'T', 'I', 'L'};
+
+        //! Nanoseconds elapsed since start.
+        inline std::uint64_t elapsed_ns(std::chrono::steady_clock::time_point start) {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count();
+        }
+
+        //! Owns the file, the LRU cache and the prefetch readers of a 
+        //! tiled_matrix. All members are safe to call from several threads.
+        template <typename T>
+        class tile_store {
+        public:
+            using tile_ptr = std::shared_ptr<const matrix<T>>;
+
+            tile_store(int fd, const tiled_header& h, std::size_t budget):
+                fd(fd), h(h), budget(budget), cached_bytes(0), reader_threads(1), depth(2) {}
+
+            ~tile_store() {
+                std::vector<std::shared_future<tile_ptr>> reads;
+                {
+                    std::lock_guard<std::mutex> lock(m);
+                    for (const std::pair<const std::size_t, std::shared_future<tile_ptr>>& p: pending)
+                        reads.push_back(p.second);
+                }
+                for (const std::shared_future<tile_ptr>& f: reads)
+                    f.wait();
+                readers.reset();
+                ::close(fd);
+            }
+
+            tile_store(const tile_store&) = delete;
+            tile_store& operator=(const tile_store&) = delete;
+
+            //! The tiles per column and per row of the grid.
+            std::size_t grid_rows() const { return (h.rows + h.tile_rows - 1) / h.tile_rows; }
+            std::size_t grid_cols() const { return (h.cols + h.tile_cols - 1) / h.tile_cols; }
+
+            //! Returns tile (ti, tj), waiting for a pending prefetch or reading
+            //! it from the file if it is not cached. The tile stays valid after
+            //! it is evicted.
+            tile_ptr get(std::size_t ti, std::size_t tj) {
+                std::size_t key = ti * grid_cols() + tj;
+                std::unique_lock<std::mutex> lock(m);
+                typename std::unordered_map<std::size_t, entry>::iterator it = cache.find(key);
+                if (it != cache.end()) {
+                    ++stats.hits;
+                    if (it->second.prefetched) {
+                        ++stats.prefetch_hits;
+                        it->second.prefetched = false;
+                    }
+                    lru.splice(lru.begin(), lru, it->second.position);
+                    return it->second.tile;
+                }
+
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                typename std::unordered_map<std::size_t, std::shared_future<tile_ptr>>::iterator p = pending.find(key);
+                if (p != pending.end()) {
+                    std::shared_future<tile_ptr> f = p->second;
+                    lock.unlock();
+                    tile_ptr tile;
+                    {
+                        MXL_TRACE_SPAN("tile_wait", "io", "tile", key);
+                        tile = f.get();
+                    }
+                    lock.lock();
+                    it = cache.find(key);
+                    if (it != cache.end())
+                        it->second.prefetched = false;
+                    ++stats.hits;
+                    stats.stall_ns += elapsed_ns(start);
+                    return tile;
+                }
+
+                ++stats.misses;
+                lock.unlock();
+                tile_ptr tile = read(key);
+                lock.lock();
+                stats.stall_ns += elapsed_ns(start);
+                insert(key, tile, false);
+                return tile;
+            }
+
+            //! Starts reading tile (ti, tj) on a reader thread, unless it is
+            //! cached or already being read.
+            void prefetch(std::size_t ti, std::size_t tj) {
+                std::size_t key = ti * grid_cols() + tj;
+                std::shared_ptr<std::promise<tile_ptr>> promise = std::make_shared<std::promise<tile_ptr>>();
+                executor* io = current_context().io.get();
+                {
+                    std::lock_guard<std::mutex> lock(m);
+                    if (cache.count(key) || pending.count(key))
+                        return;
+                    pending[key] = promise->get_future().share();
+                    ++stats.prefetches;
+                    if (!io) {
+                        if (!readers)
+                            readers.reset(new thread_pool(std::max(1u, reader_threads)));
+                        io = readers.get();
+                    }
+                }
+                // Submitted without the lock, since an executor may run the
+                // read inline. The promise is fulfilled after unlocking too:
+                // once it is, the destructor may run and destroy the mutex.
+                io->submit([this, key, promise] {
+                    try {
+                        tile_ptr tile = read(key);
+                        {
+                            std::lock_guard<std::mutex> lock(m);
+                            insert(key, tile, true);
+                            pending.erase(key);
+                        }
+                        promise->set_value(tile);
+                    } catch (...) {
+                        {
+                            std::lock_guard<std::mutex> lock(m);
+                            pending.erase(key);
+                        }
+                        promise->set_exception(std::current_exception());
+                    }
+                });
+            }
+
+            //! Writes tile (ti, tj) to the file and caches it.
+            void put(std::size_t ti, std::size_t tj, matrix<T>&& tile) {
+                std::size_t key = ti * grid_cols() + tj;
+                MXL_TRACE_SPAN("tile_write", "io", "tile", key);
+                std::unique_lock<std::mutex> lock(m);
+                typename std::unordered_map<std::size_t, std::shared_future<tile_ptr>>::iterator p = pending.find(key);
+                if (p != pending.end()) {
+                    std::shared_future<tile_ptr> f = p->second;
+                    lock.unlock();
+                    f.wait();
+                    lock.lock();
+                }
+                erase(key);
+                lock.unlock();
+                write(key, tile.raw_data());
+                lock.lock();
+                insert(key, std::make_shared<const matrix<T>>(std::move(tile)), false);
+            }
+
+            //! Sets the number of reader threads (used from the next time the
+            //! readers start) and how many steps ahead operations prefetch.
+            void set_prefetch(unsigned threads, std::size_t steps) {
+                std::lock_guard<std::mutex> lock(m);
+                reader_threads = threads;
+                depth = steps;
+            }
+
+            std::size_t prefetch_depth() const {
+                std::lock_guard<std::mutex> lock(m);
+                return depth;
+            }
+
+            const tiled_header& header() const { return h; }
+            std::size_t memory_budget() const { return budget; }
+
+            tile_cache_stats cache_stats() const {
+                std::lock_guard<std::mutex> lock(m);
+                return stats;
+            }
+
+        private:
+            struct entry {
+                tile_ptr tile;
+                std::list<std::size_t>::iterator position;
+                //! Set until a prefetched tile is first used.
+                bool prefetched;
+            };
+
+            std::size_t tile_bytes() const { return h.tile_rows * h.tile_cols * sizeof(T); }
+
+            off_t offset(std::size_t key) const {
+                return static_cast<off_t>(sizeof(tiled_header) + key * tile_bytes());
+            }
+
+            //! Reads a tile from the file. Called without the lock held.
+            tile_ptr read(std::size_t key) {
+                MXL_TRACE_SPAN("tile_read", "io", "tile", key);
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                std::shared_ptr<matrix<T>> tile = std::make_shared<matrix<T>>(h.tile_rows, h.tile_cols);
+                char* p = reinterpret_cast<char*>(tile->raw_data());
+                std::size_t done = 0, len = tile_bytes();
+                while (done < len) {
+                    ssize_t r = ::pread(fd, p + done, len - done, offset(key) + done);
+                    if (r <= 0)
+                        throw std::runtime_error("Failed to read tile from tiled matrix file.");
+                    done += r;
+                }
+                std::lock_guard<std::mutex> lock(m);
+                stats.bytes_read += len;
+                stats.read_ns += elapsed_ns(start);
+                return tile;
+            }
+
+            //! Writes a tile to the file. Called without the lock held.
+            void write(std::size_t key, const T* data) {
+                const char* p = reinterpret_cast<const char*>(data);
+                std::size_t done = 0, len = tile_bytes();
+                while (done < len) {
+                    ssize_t r = ::pwrite(fd, p + done, len - done, offset(key) + done);
+                    if (r <= 0)
+                        throw std::runtime_error("Failed to write tile to tiled matrix file.");
+                    done += r;
+                }
+                std::lock_guard<std::mutex> lock(m);
+                stats.bytes_written += len;
+            }
+
+            //! Caches a tile, evicting the least recently used ones to stay
+            //! within the budget. Called with the lock held.
+            void insert(std::size_t key, const tile_ptr& tile, bool prefetched) {
+                if (cache.count(key))
+                    return;
+                while (!lru.empty() && cached_bytes + tile_bytes() > budget) {
+                    erase(lru.back());
+                    ++stats.evictions;
+                }
+                if (tile_bytes() > budget)
+                    return;
+                lru.push_front(key);
+                cache[key] = entry{tile, lru.begin(), prefetched};
+                cached_bytes += tile_bytes();
+            }
+
+            //! Drops a tile from the cache. Called with the lock held.
+            void erase(std::size_t key) {
+                typename std::unordered_map<std::size_t, entry>::iterator it = cache.find(key);
+                if (it == cache.end())
+                    return;
+                lru.erase(it->second.position);
+                cache.erase(it);
+                cached_bytes -= tile_bytes();
+            }
+
+            int fd;
+            tiled_header h;
+            std::size_t budget;
+            std::size_t cached_bytes;
+            //! Cached tile keys, most recently used first.
+            std::list<std::size_t> lru;
+            std::unordered_map<std::size_t, entry> cache;
+            //! Tiles being read by prefetch().
+            std::unordered_map<std::size_t, std::shared_future<tile_ptr>> pending;
+            tile_cache_stats stats;
+            unsigned reader_threads;
+            std::size_t depth;
+            mutable std::mutex m;
+            //! Started by the first prefetch, and stopped first on destruction.
+            std::unique_ptr<thread_pool> readers;
+        };
+
+        //! Issues prefetches for the tiles at step s + depth of an operation, 
+        //! or for steps 0 to depth when s is 0, through tiles(s).
+        template <typename Tiles>
+        void prefetch_ahead(std::size_t s, std::size_t steps, std::size_t depth, Tiles tiles) {
+            if (!depth)
+                return;
+            for (std::size_t t = s ? s + depth : 0; t <= s + depth && t < steps; ++t)
+                tiles(t);
+        }
+
+        //! Runs step(s) for each step of a tiled operation that writes the
+        //! file at path.
+        /*!
+            Checks the cancellation token of current_context() and reports
+            progress between steps; the in-memory operations inside a step
+            still watch the token but do not report progress. If a step throws
+            (or the operation is cancelled), the incomplete file is removed.
+            name labels the operation and its steps in traces.
+        */
+        template <typename Step>
+        void run_steps(const char* name, std::size_t steps, const std::string& path, Step step) {
+            MXL_TRACE_SPAN(name);
+            (void)name;
+            const context& ctx = current_context();
+            context inner = ctx;
+            inner.progress = nullptr;
+            context_scope scope(inner);
+            try {
+                for (std::size_t s = 0; s != steps; ++s) {
+                    ctx.throw_if_cancelled();
+                    MXL_TRACE_SPAN(name, "tile", "step", s);
+                    step(s);
+                    if (ctx.progress)
+                        ctx.progress(s + 1, steps);
+                }
+            } catch (...) {
+                std::remove(path.c_str());
+                throw;
+            }
+        }
+
+    }
+
+    //! A disk-backed matrix, stored and processed in tiles.
+    /*!
+        Elements live in a file (see tiled.hpp for the format); at most
+        memory_budget bytes of tiles are cached in memory at once, evicting the
+        least recently used. Tiles are ordinary row-major matrix<T> objects, so
+        the operations below work by streaming tiles through the in-memory
+        matrix operators. A tiled_matrix can be moved but not copied.
+    */
+    template <typename T>
+    class tiled_matrix {
+    public:
+        //! Defines a size type, same as matrix<T>::size_type.
+        using size_type = typename matrix<T>::size_type;
+        //! Defines a dimensions type as std::pair of size_types.
+        using dimensions = typename matrix<T>::dimensions;
+        //! Defines the value_type as T.
+        using value_type = T;
+        //! A shared, read-only handle to a cached tile.
+        using tile_ptr = std::shared_ptr<const matrix<T>>;
+
+        //! The memory budget used when none is given: 256 MiB.
+        static const std::size_t default_budget = std::size_t(256) << 20;
+
+        //! Constructor that creates (or overwrites) a file for an m x n matrix
+        //! of 0s.
+        /*!
+            The file is sized up front without writing the tiles, so creating it
+            is fast on file systems with sparse files.
+            \param path the file to create.
+            \param m the number of rows.
+            \param n the number of columns.
+            \param tile_rows the number of rows per tile.
+            \param tile_cols the number of columns per tile.
+            \param memory_budget the most bytes of tiles kept in memory.
+        */
+        tiled_matrix(const std::string& path, size_type m, size_type n, size_type tile_rows=1024,
+                     size_type tile_cols=1024, std::size_t memory_budget=default_budget) {
+            if (!tile_rows || !tile_cols)
+                throw std::domain_error("Tiles must have at least one row and one column.");
+            detail::tiled_header h;
+            std::memset(&h, 0, sizeof(h));
+            std::memcpy(h.magic, detail::tiled_magic, sizeof(h.magic));
+            h.version = 1;
+            h.type = static_cast<std::uint8_t>(detail::dtype_of<T>::value);
+            h.byte_order = detail::byte_order_mark;
+            h.element_size = sizeof(T);
+            h.rows = m;
+            h.cols = n;
+            h.tile_rows = tile_rows;
+            h.tile_cols = tile_cols;
+
+            int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0)
+                throw std::runtime_error("Cannot open " + path + " for writing.");
+            store.reset(new detail::tile_store<T>(fd, h, memory_budget));
+            off_t size = static_cast<off_t>(sizeof(h) + store->grid_rows() * store->grid_cols() *
+                tile_rows * tile_cols * sizeof(T));
+            if (::pwrite(fd, &h, sizeof(h), 0) != sizeof(h) || ::ftruncate(fd, size) != 0)
+                throw std::runtime_error("Cannot size tiled matrix file " + path + ".");
+        }
+
+        //! Opens an existing tiled matrix file.
+        /*!
+            Throws a std::runtime_error if the file does not hold a tiled
+            matrix of T.
+            \param path the file to open.
+            \param memory_budget the most bytes of tiles kept in memory.
+        */
+        static tiled_matrix open(const std::string& path, std::size_t memory_budget=default_budget) {
+            int fd = ::open(path.c_str(), O_RDWR);
+            if (fd < 0)
+                throw std::runtime_error("Cannot open " + path + " for reading.");
+            detail::tiled_header h;
+            if (::pread(fd, &h, sizeof(h), 0) != sizeof(h) ||
+                std::memcmp(h.magic, detail::tiled_magic, sizeof(h.magic)) != 0 || h.version != 1 ||
+                h.byte_order != detail::byte_order_mark || !h.tile_rows || !h.tile_cols) {
+                ::close(fd);
+                throw std::runtime_error(path + " is not a tiled matrix file.");
+            }
+            if (h.type != static_cast<std::uint8_t>(detail::dtype_of<T>::value) || h.element_size != sizeof(T)) {
+                ::close(fd);
+                throw std::runtime_error(path + " holds dtype " + std::to_string(h.type) + ", expected " +
+                    std::to_string(static_cast<int>(detail::dtype_of<T>::value)) + ".");
+            }
+            return tiled_matrix(new detail::tile_store<T>(fd, h, memory_budget));
+        }
+
+        //! Writes an in-memory matrix to a new tiled matrix file.
+        /*!
+            \param mat the matrix to copy.
+            \param path the file to create.
+            \param tile_rows the number of rows per tile.
+            \param tile_cols the number of columns per tile.
+            \param memory_budget the most bytes of tiles kept in memory.
+        */
+        static tiled_matrix from_matrix(const matrix<T>& mat, const std::string& path, size_type tile_rows=1024,
+                                        size_type tile_cols=1024, std::size_t memory_budget=default_budget) {
+            tiled_matrix out(path, mat.shape().first, mat.shape().second, tile_rows, tile_cols, memory_budget);
+            for (size_type ti = 0; ti != out.tile_grid().first; ++ti)
+                for (size_type tj = 0; tj != out.tile_grid().second; ++tj) {
+                    matrix<T> tile(tile_rows, tile_cols);
+                    size_type i0 = ti * tile_rows, j0 = tj * tile_cols;
+                    size_type i1 = std::min(i0 + tile_rows, out.shape().first);
+                    size_type j1 = std::min(j0 + tile_cols, out.shape().second);
+                    for (size_type i = i0; i != i1; ++i)
+                        for (size_type j = j0; j != j1; ++j)
+                            tile(i - i0, j - j0) = mat(i, j);
+                    out.store_tile(ti, tj, std::move(tile));
+                }
+            return out;
+        }
+
+        //! Returns the whole matrix in memory.
+        matrix<T> to_matrix() const {
+            matrix<T> out(shape().first, shape().second);
+            for (size_type ti = 0; ti != tile_grid().first; ++ti)
+                for (size_type tj = 0; tj != tile_grid().second; ++tj) {
+                    tile_ptr t = tile(ti, tj);
+                    size_type i0 = ti * tile_shape().first, j0 = tj * tile_shape().second;
+                    size_type i1 = std::min(i0 + tile_shape().first, shape().first);
+                    size_type j1 = std::min(j0 + tile_shape().second, shape().second);
+                    for (size_type i = i0; i != i1; ++i)
+                        for (size_type j = j0; j != j1; ++j)
+                            out(i, j) = (*t)(i - i0, j - j0);
+                }
+            return out;
+        }
+
+        //! Returns the element in the i-th row and j-th column.
+        /*!
+            Reads the whole tile holding the element if it is not cached; use
+            tile() to work on many elements.
+        */
+        T operator()(size_type i, size_type j) const {
+            tile_ptr t = tile(i / tile_shape().first, j / tile_shape().second);
+            return (*t)(i % tile_shape().first, j % tile_shape().second);
+        }
+
+        //! Returns the dimensions of the matrix as a std::pair.
+        dimensions shape() const { return std::make_pair(store->header().rows, store->header().cols); }
+
+        //! Returns the dimensions of a tile as a std::pair.
+        dimensions tile_shape() const {
+            return std::make_pair(store->header().tile_rows, store->header().tile_cols);
+        }
+
+        //! Returns the number of tiles down and across the matrix.
+        dimensions tile_grid() const { return std::make_pair(store->grid_rows(), store->grid_cols()); }
+
+        //! Returns tile (ti, tj), a full tile_shape() matrix padded with 0s
+        //! on the edges.
+        tile_ptr tile(size_type ti, size_type tj) const { return store->get(ti, tj); }
+
+        //! Replaces tile (ti, tj) in the file.
+        /*!
+            Throws a std::domain_error unless tile has the shape tile_shape()
+            and is not transposed.
+        */
+        void store_tile(size_type ti, size_type tj, matrix<T> tile) {
+            if (tile.shape() != tile_shape() || tile.is_transposed())
+                throw std::domain_error("Tile must be a row-major " + std::to_string(tile_shape().first) +
+                    " x " + std::to_string(tile_shape().second) + " matrix.");
+            store->put(ti, tj, std::move(tile));
+        }
+
+        //! Starts reading tile (ti, tj) in the background, so that a later
+        //! tile() call finds it in memory.
+        void prefetch(size_type ti, size_type tj) const { store->prefetch(ti, tj); }
+
+        //! Configures prefetching.
+        /*!
+            \param reader_threads the number of background reader threads.
+            Takes effect if no prefetch has been issued yet. Unused when
+            current_context() has an I/O executor.
+            \param depth how many steps ahead multiply, add and transpose
+            prefetch this matrix's tiles; 0 turns prefetching off.
+        */
+        void set_prefetch(unsigned reader_threads, size_type depth) { store->set_prefetch(reader_threads, depth); }
+
+        //! Returns how many steps ahead operations prefetch this matrix's tiles.
+        size_type prefetch_depth() const { return store->prefetch_depth(); }
+
+        //! Returns a snapshot of the tile cache and prefetch counters.
+        tile_cache_stats cache_stats() const { return store->cache_stats(); }
+
+        //! Returns the most bytes of tiles kept in memory.
+        std::size_t memory_budget() const { return store->memory_budget(); }
+
+    private:
+        explicit tiled_matrix(detail::tile_store<T>* s): store(s) {}
+
+        //! The file and tile cache
+        std::unique_ptr<detail::tile_store<T>> store;
+    };
+
+    //! Multiplies two tiled matrices into a new tiled matrix file.
+    /*!
+        Each output tile is accumulated from tile products with the in-memory
+        matrix operators, so only three tiles (plus the cache) are needed at a
+        time. The operand tiles of the next prefetch_depth() steps are read in
+        the background while the current product is computed. Throws a
+        std::domain_error if the shapes or the tile sizes along the shared
+        dimension do not match. Cancellation and progress (see mxl::context)
+        are checked per tile product; a cancelled operation removes the result
+        file.
+        \param lhs the left matrix.
+        \param rhs the right matrix.
+        \param path the file for the result.
+        \param memory_budget the result's memory budget.
+    */
+    template <typename T>
+    tiled_matrix<T> multiply(const tiled_matrix<T>& lhs, const tiled_matrix<T>& rhs, const std::string& path,
+                             std::size_t memory_budget=tiled_matrix<T>::default_budget) {
+        if (lhs.shape().second != rhs.shape().first || lhs.tile_shape().second != rhs.tile_shape().first)
+            throw std::domain_error("Tiled matrices cannot be multiplied: shapes or tile sizes do not match.");
+        using size_type = typename tiled_matrix<T>::size_type;
+        tiled_matrix<T> out(path, lhs.shape().first, rhs.shape().second, lhs.tile_shape().first,
+            rhs.tile_shape().second, memory_budget);
+        const size_type gj = out.tile_grid().second, gk = lhs.tile_grid().second;
+        const size_type steps = out.tile_grid().first * gj * gk;
+        const size_type lhs_depth = lhs.prefetch_depth(), rhs_depth = rhs.prefetch_depth();
+        matrix<T> acc;
+        detail::run_steps("tiled_multiply", steps, path, [&](size_type s) {
+            const size_type ti = s / (gj * gk), tj = s / gk % gj, tk = s % gk;
+            if (!tk)
+                acc = matrix<T>(out.tile_shape().first, out.tile_shape().second);
+            detail::prefetch_ahead(s, steps, lhs_depth, [&](size_type t) {
+                lhs.prefetch(t / (gj * gk), t % gk);
+            });
+            detail::prefetch_ahead(s, steps, rhs_depth, [&](size_type t) {
+                rhs.prefetch(t % gk, t / gk % gj);
+            });
+            acc += *lhs.tile(ti, tk) * *rhs.tile(tk, tj);
+            if (tk == gk - 1)
+                out.store_tile(ti, tj, std::move(acc));
+        });
+        return out;
+    }
+
+    //! Adds two tiled matrices into a new tiled matrix file.
+    /*!
+        Throws a std::domain_error if the shapes or tile sizes differ.
+        \param lhs the left matrix.
+        \param rhs the right matrix.
+        \param path the file for the result.
+        \param memory_budget the result's memory budget.
+    */
+    template <typename T>
+    tiled_matrix<T> add(const tiled_matrix<T>& lhs, const tiled_matrix<T>& rhs, const std::string& path,
+                        std::size_t memory_budget=tiled_matrix<T>::default_budget) {
+        if (lhs.shape() != rhs.shape() || lhs.tile_shape() != rhs.tile_shape())
+            throw std::domain_error("Tiled matrices cannot be added: shapes or tile sizes do not match.");
+        using size_type = typename tiled_matrix<T>::size_type;
+        tiled_matrix<T> out(path, lhs.shape().first, lhs.shape().second, lhs.tile_shape().first,
+            lhs.tile_shape().second, memory_budget);
+        const size_type gj = out.tile_grid().second, steps = out.tile_grid().first * gj;
+        detail::run_steps("tiled_add", steps, path, [&](size_type s) {
+            detail::prefetch_ahead(s, steps, lhs.prefetch_depth(), [&](size_type t) {
+                lhs.prefetch(t / gj, t % gj);
+            });
+            detail::prefetch_ahead(s, steps, rhs.prefetch_depth(), [&](size_type t) {
+                rhs.prefetch(t / gj, t % gj);
+            });
+            out.store_tile(s / gj, s % gj, *lhs.tile(s / gj, s % gj) + *rhs.tile(s / gj, s % gj));
+        });
+        return out;
+    }
+
+    //! Transposes a tiled matrix into a new tiled matrix file.
+    /*!
+        Tile (i, j) of the input becomes tile (j, i) of the output, with its
+        elements transposed in memory.
+        \param mat the matrix to transpose.
+        \param path the file for the result.
+        \param memory_budget the result's memory budget.
+    */
+    template <typename T>
+    tiled_matrix<T> transpose(const tiled_matrix<T>& mat, const std::string& path,
+                              std::size_t memory_budget=tiled_matrix<T>::default_budget) {
+        using size_type = typename tiled_matrix<T>::size_type;
+        const size_type tr = mat.tile_shape().first, tc = mat.tile_shape().second;
+        tiled_matrix<T> out(path, mat.shape().second, mat.shape().first, tc, tr, memory_budget);
+        const size_type gj = mat.tile_grid().second, steps = mat.tile_grid().first * gj;
+        detail::run_steps("tiled_transpose", steps, path, [&](size_type s) {
+            detail::prefetch_ahead(s, steps, mat.prefetch_depth(), [&](size_type t) {
+                mat.prefetch(t / gj, t % gj);
+            });
+            matrix<T> t(tc, tr);
+            detail::transpose_into(mat.tile(s / gj, s % gj)->raw_data(), tr, tc, t.raw_data());
+            out.store_tile(s % gj, s / gj, std::move(t));
+        });
+        return out;
+    }
+
+}
@@ -0,0 +1,197 @@
+// Differential test of the optimized multiply against mxl::reference_multiply,
+// the original textbook loop. Runs randomized shapes, operand layouts, element
+// types and thread counts through both, checks that they agree, and records
+// how much faster the optimized path is.
+//
+// Usage: Regression [--cases 200] [--seed 1] [--max-size 96]
+//                   [--min-speedup 1.0] [--csv file.csv]
+//
+// Integer results must match exactly. Floating point results must agree to
+// within a few ulps of the largest possible partial sum, since the kernels may
+// group the additions differently. Products of at least 64^3 multiply-adds
+// are also timed; the run fails if one of them is slower than --min-speedup
+// times the reference. Registered with CTest under the "regression" label:
+// ctest -L regression.
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <mxl/mxl.hpp>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+using mxl::matrix;
+
+struct options {
+    size_t cases = 200;
+    uint64_t seed = 1;
+    size_t max_size = 96;
+    double min_speedup = 1.0;
+    string csv;
+};
+
+struct outcome {
+    string type, layout;
+    size_t m, k, n, threads;
+    double error, tolerance, reference_ns, optimized_ns;
+    bool timed;
+};
+
+// Keeps the compiler from discarding timed work.
+volatile double sink;
+
+// Returns the fastest of a few runs of op, in nanoseconds.
+template <typename F>
+double best_ns(F op) {
+    double best = 1e300;
+    for (int r = 0; r != 3; r++) {
+        auto start = chrono::steady_clock::now();
+        op();
+        chrono::duration<double, nano> ns = chrono::steady_clock::now() - start;
+        best = min(best, ns.count());
+    }
+    return best;
+}
+
+// An m x n matrix of values in [-4, 4], stored column after column if
+// transposed is set.
+template <typename T>
+matrix<T> operand(size_t m, size_t n, bool transposed, uint64_t seed) {
+    if (!transposed)
+        return matrix<T>(m, n, mxl::uniform(-4, 4), seed);
+    matrix<T> mat(n, m, mxl::uniform(-4, 4), seed);
+    mat.transpose();
+    return mat;
+}
+
+template <typename T>
+outcome run_case(size_t m, size_t k, size_t n, bool ta, bool tb, const mxl::context& ctx, uint64_t seed) {
+    matrix<T> a = operand<T>(m, k, ta, seed), b = operand<T>(k, n, tb, seed + 1);
+    matrix<T> expected = mxl::reference_multiply(a, b), actual = mxl::multiply(a, b, ctx);
+
+    outcome o{"", string(1, ta ? 'T' : 'N') + (tb ? 'T' : 'N'), m, k, n, ctx.threads, 0, 0, 0, 0, false};
+    if (actual.shape() != expected.shape()) {
+        o.error = numeric_limits<double>::infinity();
+        return o;
+    }
+    // Each of the k terms is at most 16 in magnitude.
+    if (!numeric_limits<T>::is_integer)
+        o.tolerance = 4.0 * k * numeric_limits<T>::epsilon() * 16.0 * k;
+    for (size_t i = 0; i != m; i++)
+        for (size_t j = 0; j != n; j++)
+            o.error = max(o.error, abs(double(actual(i, j)) - double(expected(i, j))));
+
+    if (m * k * n >= 64 * 64 * 64) {
+        o.timed = true;
+        o.reference_ns = best_ns([&] { sink = double(mxl::reference_multiply(a, b)(0, 0)); });
+        o.optimized_ns = best_ns([&] { sink = double(mxl::multiply(a, b, ctx)(0, 0)); });
+    }
+    return o;
+}
+
+int main(int argc, char** argv) {
+    options opts;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        string flag = argv[i], value = argv[i + 1];
+        if (flag == "--cases")
+            opts.cases = stoull(value);
+        else if (flag == "--seed")
+            opts.seed = stoull(value);
+        else if (flag == "--max-size")
+            opts.max_size = max<size_t>(1, stoull(value));
+        else if (flag == "--min-speedup")
+            opts.min_speedup = stod(value);
+        else if (flag == "--csv")
+            opts.csv = value;
+        else {
+            cerr << "Unknown option " << flag << "\n";
+            return 1;
+        }
+    }
+
+    const size_t workers = max(1u, thread::hardware_concurrency()) - 1;
+    mxl::context serial(make_shared<mxl::thread_pool>(0)), parallel(make_shared<mxl::thread_pool>(workers));
+    const string types[] = {"int", "long", "float", "double"};
+    mt19937_64 rng(opts.seed);
+    auto dim = [&] {
+        // Favour the edges: single rows and columns, and sizes around a chunk.
+        switch (rng() % 4) {
+            case 0: return size_t(1) + rng() % 3;
+            case 1: return opts.max_size;
+            default: return size_t(1) + rng() % opts.max_size;
+        }
+    };
+
+    vector<outcome> results;
+    size_t failures = 0;
+    for (size_t c = 0; c != opts.cases; c++) {
+        size_t m = dim(), k = dim(), n = dim();
+        bool ta = rng() & 1, tb = rng() & 2;
+        const mxl::context& ctx = rng() & 1 ? parallel : serial;
+        const string& type = types[c % 4];
+        uint64_t seed = opts.seed * 1000003 + c * 2;
+        outcome o = type == "int" ? run_case<int>(m, k, n, ta, tb, ctx, seed)
+                  : type == "long" ? run_case<long>(m, k, n, ta, tb, ctx, seed)
+                  : type == "float" ? run_case<float>(m, k, n, ta, tb, ctx, seed)
+                  : run_case<double>(m, k, n, ta, tb, ctx, seed);
+        o.type = type;
+        results.push_back(o);
+        if (o.error > o.tolerance) {
+            failures++;
+            cerr << "MISMATCH " << type << " " << m << "x" << k << " * " << k << "x" << n << " " << o.layout
+                 << " on " << o.threads << " threads: error " << o.error << " > " << o.tolerance << "\n";
+        }
+    }
+
+    // The timed cases all run again at the largest size, so that every type
+    // and layout has a speed check whatever the random draw.
+    const size_t s = max<size_t>(opts.max_size, 64);
+    for (const string& type: types)
+        for (int l = 0; l != 4; l++) {
+            outcome o = type == "int" ? run_case<int>(s, s, s, l & 1, l & 2, parallel, opts.seed)
+                      : type == "long" ? run_case<long>(s, s, s, l & 1, l & 2, parallel, opts.seed)
+                      : type == "float" ? run_case<float>(s, s, s, l & 1, l & 2, parallel, opts.seed)
+                      : run_case<double>(s, s, s, l & 1, l & 2, parallel, opts.seed);
+            o.type = type;
+            results.push_back(o);
+            if (o.error > o.tolerance)
+                failures++;
+        }
+
+    size_t slow = 0;
+    for (const outcome& o: results) {
+        if (!o.timed)
+            continue;
+        double speedup = o.reference_ns / o.optimized_ns;
+        cout << o.type << " " << o.m << "x" << o.k << "x" << o.n << " " << o.layout << " on " << o.threads
+             << " threads: " << speedup << "x faster than the reference\n";
+        if (speedup < opts.min_speedup) {
+            slow++;
+            cerr << "SLOW " << o.type << " " << o.m << "x" << o.k << "x" << o.n << " " << o.layout << ": "
+                 << speedup << "x < " << opts.min_speedup << "x\n";
+        }
+    }
+
+    if (!opts.csv.empty()) {
+        ofstream csv(opts.csv);
+        csv << "type,m,k,n,layout,threads,error,tolerance,reference_ns,optimized_ns,speedup\n";
+        for (const outcome& o: results) {
+            csv << o.type << "," << o.m << "," << o.k << "," << o.n << "," << o.layout << "," << o.threads << ","
+                << o.error << "," << o.tolerance << ",";
+            if (o.timed)
+                csv << o.reference_ns << "," << o.optimized_ns << "," << o.reference_ns / o.optimized_ns;
+            else
+                csv << ",,";
+            csv << "\n";
+        }
+    }
+
+    cout << results.size() << " cases, " << failures << " mismatched, " << slow << " slower than "
+         << opts.min_speedup << "x the reference\n";
+    return failures || slow ? 1 : 0;
+}
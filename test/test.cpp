@@ -1,10 +1,64 @@
 #define CATCH_CONFIG_MAIN  // This tells Catch to provide a main() - only do this in one cpp file
+#define CATCH_CONFIG_NO_POSIX_SIGNALS  // Catch 2.11 cannot size its signal stack on newer glibc
 #include "catch.hpp"
 #include <mxl/mxl.hpp>
+#include <mxl/io.hpp>
+#include <mxl/tiled.hpp>
+#include <mxl/tasks.hpp>
+#include <mxl/async.hpp>
+#include <mxl/perf.hpp>
+#include <mxl/autotune.hpp>
+#include <mxl/packed.hpp>
+#include <cstdio>
+#include <filesystem>
+#include <iterator>
+#include <sstream>
 
 using namespace std;
 using mxl::matrix;
 
+// Keeps the host's tuning profile, which Autotune writes, out of the tests:
+// MXL loads the profile this names, which does not exist, instead.
+static const bool hermetic_tuning = [] {
+    return setenv("MXL_TUNING_PROFILE", "mxl_test_no_profile.txt", 1) == 0;
+}();
+
+// Comes first so that nothing has started MXL's own pool yet.
+TEST_CASE("Testing a default executor installed before any work", "[context]") {
+    struct inline_executor: mxl::executor {
+        std::atomic<int> submitted{0};
+        void submit(std::function<void()> task) override { submitted++; task(); }
+        size_t concurrency() const override { return 3; }
+    };
+    // The number of threads in this process, where it can be read.
+    auto process_threads = [] {
+        size_t count = 0;
+#if defined(__linux__)
+        for (auto& entry: std::filesystem::directory_iterator("/proc/self/task")) {
+            (void)entry;
+            count++;
+        }
+#endif
+        return count;
+    };
+    const size_t before = process_threads();
+    auto custom = std::make_shared<inline_executor>();
+    mxl::set_default_executor(custom);
+    REQUIRE(mxl::default_context().threads == 4);
+    REQUIRE(mxl::context().threads == 4);
+
+    matrix<double> a(400, 300, mxl::normal(), 1), b(300, 200, mxl::normal(), 2);
+    matrix<double> sum = a + a;
+    matrix<double> product = a * b;
+    REQUIRE(custom->submitted > 0);
+    REQUIRE(process_threads() == before);
+    REQUIRE_THROWS_AS(mxl::set_default_executor(nullptr), std::domain_error);
+
+    // The rest of the suite runs on a pool like the one MXL would start.
+    mxl::set_default_executor(std::make_shared<mxl::thread_pool>(
+        std::max(1u, std::thread::hardware_concurrency()) - 1));
+}
+
 TEST_CASE("Verifying the simple constructors", "[matrix]") {
         
     SECTION("default constructor") {
@@ -57,6 +111,39 @@ TEST_CASE("Verifying the simple constructors", "[matrix]") {
         for (size_t i = 0; i != m5.shape().first; i++)
             for (size_t j = 0; j != m5.shape().second; j++)
                 REQUIRE(m5(i, j) == v5[i][j]);                            
+
+        vector<vector<int>> v6 = {{1, 2}, {3, 4, 5}, {}};
+        matrix<int> m6(v6, -1);
+        matrix<int> m6_expected = {{1, 2, -1}, {3, 4, 5}, {-1, -1, -1}};
+        REQUIRE((m6 == m6_expected) == true);
+    }
+
+    SECTION("iterator and range constructors") {
+        vector<double> flat = {1, 2, 3, 4, 5, 6};
+        matrix<double> mat1(2, 3, flat.begin(), flat.end());
+        matrix<double> mat2 = {{1, 2, 3}, {4, 5, 6}};
+        REQUIRE((mat1 == mat2) == true);
+        REQUIRE_THROWS_AS(matrix<double>(4, 2, flat.begin(), flat.end()), domain_error);
+
+        const double raw[] = {1, 2, 3, 4, 5, 6};
+        REQUIRE((matrix<double>(2, 3, begin(raw), end(raw)) == mat2) == true);
+        REQUIRE((matrix<double>(2, 3, vector<double>(flat)) == mat2) == true);
+
+        // Single-pass and converting ranges.
+        std::istringstream text("1 2 3 4 5 6");
+        REQUIRE((matrix<double>(2, 3, std::istream_iterator<double>(text), std::istream_iterator<double>()) ==
+            mat2) == true);
+        vector<int> ints = {1, 2, 3, 4, 5, 6};
+        REQUIRE((matrix<double>(2, 3, ints.begin(), ints.end()) == mat2) == true);
+        std::istringstream few("1 2 3");
+        REQUIRE_THROWS_AS(matrix<double>(2, 3, std::istream_iterator<double>(few), 
+            std::istream_iterator<double>()), domain_error);
+
+        vector<vector<double>> rows = {{1, 2, 3}, {4, 5, 6}};
+        REQUIRE((matrix<double>(rows.begin(), rows.end()) == mat2) == true);
+
+        matrix<long> mat3 = {{1, 2}, {3}};
+        REQUIRE((mat3 == matrix<long>({{1, 2}, {3, 0}})) == true);
     }
 }
 
@@ -90,6 +177,22 @@ TEST_CASE("Verifying the special constructors", "[matrix]") {
         }
     }
 
+    SECTION("typed initializers") {
+        REQUIRE((matrix<int>(5, 7, mxl::zeros) == matrix<int>(5, 7, "zeros")) == true);
+        REQUIRE((matrix<float>(5, 7, mxl::ones) == matrix<float>(5, 7, "ones")) == true);
+        REQUIRE((matrix<long>(4, 6, mxl::identity) == matrix<long>(4, 6, "identity")) == true);
+        REQUIRE((matrix<long>(6, 4, mxl::identity) == matrix<long>(6, 4, "identity")) == true);
+
+        matrix<double> mat1(6, 9, mxl::random(11, mxl::normal(0, 2)));
+        matrix<double> mat2(6, 9, mxl::normal(0, 2), 11);
+        REQUIRE((mat1 == mat2) == true);
+        REQUIRE((matrix<double>(6, 9, mxl::random()) == matrix<double>(6, 9, mxl::uniform())) == true);
+    }
+
+    SECTION("unknown initializer") {
+        REQUIRE_THROWS_AS(matrix<int>(2, 2, "eye"), std::domain_error);
+    }
+
     SECTION("identity") {
         matrix<long> mat1(7, 7, "identity");
         using size_type = matrix<long>::size_type;
@@ -105,6 +208,93 @@ TEST_CASE("Verifying the special constructors", "[matrix]") {
 }
 
 
+TEST_CASE("Verifying the distribution constructors", "[matrix]") {
+    using size_type = matrix<double>::size_type;
+
+    SECTION("uniform") {
+        matrix<double> mat1(50, 40, mxl::uniform(-2.0, 3.0), 7);
+        matrix<double> mat2(50, 40, mxl::uniform(-2.0, 3.0), 7);
+        REQUIRE((mat1 == mat2) == true);
+        for (auto x: mat1)
+            REQUIRE((x >= -2.0 && x < 3.0));
+
+        matrix<int> mat3(9, 11, mxl::uniform(1, 6));
+        for (auto x: mat3)
+            REQUIRE((x >= 1 && x <= 6));
+
+        // Integral bounds are rounded inward and high is included.
+        matrix<int> bits(20, 20, mxl::uniform());
+        REQUIRE(std::count(bits.begin(), bits.end(), 0) + std::count(bits.begin(), bits.end(), 1) == 400);
+        REQUIRE(std::count(bits.begin(), bits.end(), 1) > 100);
+        matrix<int> zeros(5, 5, mxl::uniform(-0.5, 0.5));
+        REQUIRE(std::count(zeros.begin(), zeros.end(), 0) == 25);
+        REQUIRE_THROWS_AS(matrix<int>(2, 2, mxl::uniform(0.2, 0.8)), std::domain_error);
+        REQUIRE_THROWS_AS(matrix<int>(2, 2, mxl::uniform(0, 1e10)), std::domain_error);
+        REQUIRE_THROWS_AS(matrix<unsigned>(2, 2, mxl::uniform(-1, 1)), std::domain_error);
+
+        // Ranges wider than 2^32, up to nearly every 64-bit value.
+        const double wide = std::ldexp(1.0, 40);
+        matrix<long long> big(30, 30, mxl::uniform(-wide, wide), 3);
+        long long above = 0;
+        for (auto x: big) {
+            REQUIRE((x >= -(1LL << 40) && x <= (1LL << 40)));
+            above += x > (1LL << 39);
+        }
+        REQUIRE((above > 150 && above < 300));
+        matrix<std::int64_t> full(4, 4, mxl::uniform(-std::ldexp(1.0, 63), std::ldexp(1.0, 63) - 1024), 4);
+        REQUIRE((full == matrix<std::int64_t>(4, 4, mxl::uniform(-std::ldexp(1.0, 63), 
+            std::ldexp(1.0, 63) - 1024), 4)) == true);
+    }
+
+    SECTION("normal") {
+        matrix<double> mat1(200, 250, mxl::normal(3.0, 2.0), 42);
+        double sum = 0, sq = 0;
+        for (auto x: mat1) {
+            sum += x;
+            sq += x * x;
+        }
+        double n = 200 * 250, mean = sum / n, var = sq / n - mean * mean;
+        REQUIRE(std::abs(mean - 3.0) < 0.05);
+        REQUIRE(std::abs(var - 4.0) < 0.1);
+
+        matrix<double> mat2(200, 250, mxl::normal(3.0, 2.0), 43);
+        REQUIRE((mat1 == mat2) == false);
+    }
+
+    SECTION("bernoulli") {
+        matrix<int> mat1(100, 300, mxl::bernoulli(0.2), 1);
+        size_type ones = 0;
+        for (auto x: mat1) {
+            REQUIRE((x == 0 || x == 1));
+            ones += x;
+        }
+        REQUIRE(std::abs(ones / 30000.0 - 0.2) < 0.01);
+
+        matrix<int> all(3, 5, mxl::bernoulli(1.0));
+        REQUIRE((all == matrix<int>(3, 5, 1)) == true);
+        matrix<int> none(3, 5, mxl::bernoulli(0.0));
+        REQUIRE((none == matrix<int>(3, 5, 0)) == true);
+    }
+
+    SECTION("sparse sign") {
+        matrix<float> mat1(100, 300, mxl::sparse_sign(0.1, 2.0f), 3);
+        size_type pos = 0, neg = 0;
+        for (auto x: mat1) {
+            REQUIRE((x == 0 || x == 2.0f || x == -2.0f));
+            pos += x > 0;
+            neg += x < 0;
+        }
+        REQUIRE(std::abs((pos + neg) / 30000.0 - 0.1) < 0.01);
+        REQUIRE(std::abs(double(pos) - double(neg)) < 0.1 * (pos + neg));
+    }
+
+    SECTION("string initializer still works") {
+        matrix<double> mat1(4, 4, "random");
+        matrix<double> mat2(4, 4, "random");
+        REQUIRE((mat1 == mat2) == true);
+    }
+}
+
 TEST_CASE("Testing matrix-matrix and matrix-scalar multiplication", "[matrix]") {
     matrix<double> mat1(3, 4, 7);
     matrix<double> mat2 = {{1, 2, 3},
@@ -147,6 +337,15 @@ TEST_CASE("Testing matrix-matrix and matrix-scalar multiplication", "[matrix]")
         } catch (std::domain_error e) {
             REQUIRE(true);
         }
+
+        REQUIRE_THROWS_AS(mxl::reference_multiply(mat4, mat5), std::domain_error);
+    }
+
+    SECTION("reference multiplication") {
+        matrix<double> mat4 = mat2.transpose_copy();
+        mat4.transpose();
+        REQUIRE((mxl::reference_multiply(mat3, mat2) == mat3 * mat2) == true);
+        REQUIRE((mxl::reference_multiply(mat3, mat4) == mat3 * mat2) == true);
     }
 }
 
@@ -170,4 +369,988 @@ TEST_CASE("Testing transpose methods", "[matrix]") {
         REQUIRE((mat1.transpose_copy() == mat2) == true);
         REQUIRE((mat1 == mat2.transpose_copy()) == true);
     }
-}
\ No newline at end of file
+}
+
+TEST_CASE("Testing string and stream output", "[matrix]") {
+    matrix<double> mat1 = {{1.5, -2, 3},
+                           {4, 5.25, 6}};
+    matrix<int> mat2 = {{1}, {-2}};
+
+    SECTION("default format matches std::to_string") {
+        string expected;
+        for (size_t i = 0; i != 2; i++)
+            for (size_t j = 0; j != 3; j++)
+                expected += (j == 0 ? (i == 0 ? "[[" : " [") : ", ") + std::to_string(mat1(i, j));
+        expected.insert(expected.find(" [4"), "]\n");
+        expected += "]]\n";
+        REQUIRE(mat1.to_string() == expected);
+        REQUIRE(mat2.to_string() == "[[1]]\n[[-2]]\n");
+        REQUIRE(matrix<int>().to_string() == "");
+
+        // Fixed notation writes every digit of the largest values.
+        matrix<long double> huge = {{1e300L * 1e300L, -std::numeric_limits<long double>::max()}};
+        REQUIRE(huge.to_string() == "[[" + std::to_string(huge(0, 0)) + ", " + std::to_string(huge(0, 1)) + 
+            "]]\n");
+        REQUIRE(huge.to_string({mxl::format_options::notation::fixed, 64}).size() > 4932 + 64);
+    }
+
+    SECTION("configurable formats") {
+        using notation = mxl::format_options::notation;
+        REQUIRE(mat1.to_string({notation::fixed, 1}) == "[[1.5, -2.0, 3.0]\n [4.0, 5.2, 6.0]]\n");
+        REQUIRE(mat1.to_string({notation::shortest}) == "[[1.5, -2, 3]\n [4, 5.25, 6]]\n");
+        REQUIRE(mat1.to_string({notation::scientific, 2}) ==
+            "[[1.50e+00, -2.00e+00, 3.00e+00]\n [4.00e+00, 5.25e+00, 6.00e+00]]\n");
+        REQUIRE(mat2.to_string({notation::scientific, 2}) == "[[1]]\n[[-2]]\n");
+    }
+
+    SECTION("stream output") {
+        std::ostringstream os;
+        os << mat1 << mat2.transpose();
+        REQUIRE(os.str() == mat1.to_string() + "[[1, -2]]\n");
+
+        matrix<float> big(300, 300, mxl::uniform(), 5);
+        std::ostringstream os2;
+        big.print(os2, {mxl::format_options::notation::general, 9});
+        REQUIRE(os2.str() == big.to_string({mxl::format_options::notation::general, 9}));
+    }
+}
+
+TEST_CASE("Testing binary save and load", "[io]") {
+    const string path = "mxl_test_binary.mxl";
+    matrix<double> mat1(37, 21, mxl::normal(), 9);
+    matrix<int> mat2 = {{1, 2, 3},
+                        {4, 5, 6}};
+    mat2.transpose();
+
+    SECTION("round trip") {
+        mxl::save(mat1, path);
+        REQUIRE((mxl::load<double>(path) == mat1) == true);
+
+        mxl::save(mat2, path);
+        matrix<int> loaded = mxl::load<int>(path);
+        REQUIRE(loaded.is_transposed() == true);
+        REQUIRE((loaded == mat2) == true);
+    }
+
+    SECTION("memory-mapped view") {
+        mxl::save(mat2, path);
+        mxl::matrix_view<int> view = mxl::load_mapped<int>(path);
+        REQUIRE(view.shape() == mat2.shape());
+        for (size_t i = 0; i != 3; i++)
+            for (size_t j = 0; j != 2; j++)
+                REQUIRE(view(i, j) == mat2(i, j));
+        REQUIRE((view.to_matrix() == mat2) == true);
+        REQUIRE((view.transpose().to_matrix() == mat2.transpose_copy()) == true);
+    }
+
+    SECTION("type and format errors") {
+        mxl::save(mat1, path);
+        REQUIRE_THROWS_AS(mxl::load<float>(path), std::runtime_error);
+        REQUIRE_THROWS_AS(mxl::load_mapped<long>(path), std::runtime_error);
+        REQUIRE_THROWS_AS(mxl::load<double>("does_not_exist.mxl"), std::runtime_error);
+
+        // Headers whose sizes overflow, or whose data is misaligned.
+        auto corrupt = [&](std::uint64_t rows, std::uint64_t cols, std::uint64_t offset) {
+            std::fstream f(path, std::ios::in | std::ios::out | std::ios::binary);
+            f.seekp(16);
+            f.write(reinterpret_cast<const char*>(&rows), 8);
+            f.write(reinterpret_cast<const char*>(&cols), 8);
+            f.write(reinterpret_cast<const char*>(&offset), 8);
+        };
+        corrupt(std::uint64_t(1) << 32, std::uint64_t(1) << 32, 64);
+        REQUIRE_THROWS_AS(mxl::load<double>(path), std::runtime_error);
+        corrupt(37, 21, ~std::uint64_t(0) - 100);
+        REQUIRE_THROWS_AS(mxl::load<double>(path), std::runtime_error);
+        corrupt(1 << 20, 1 << 20, 64);
+        std::ifstream in(path, std::ios::binary);
+        REQUIRE_THROWS_WITH(mxl::load<double>(in), "MXL binary matrix file is truncated.");
+        mxl::save(mat1, path);
+        corrupt(37, 20, 65);
+        REQUIRE_THROWS_AS(mxl::load_mapped<double>(path), std::runtime_error);
+    }
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE("Testing text parsing", "[io]") {
+    using notation = mxl::format_options::notation;
+
+    SECTION("inverse of to_string") {
+        matrix<double> mat1(300, 300, mxl::normal(), 4);
+        mxl::csv_options opts;
+        opts.threads = 4;
+        REQUIRE((mxl::parse<double>(mat1.to_string({notation::shortest}), opts) == mat1) == true);
+
+        matrix<int> mat2 = {{1}, {-2}, {3}};
+        REQUIRE((mxl::parse<int>(mat2.to_string()) == mat2) == true);
+        REQUIRE((mxl::parse<int>(mat2.transpose().to_string()) == mat2) == true);
+        REQUIRE(mxl::parse<int>("").shape() == matrix<int>().shape());
+    }
+
+    SECTION("csv streams") {
+        std::string csv = "a;b;c\n1;+2;3\n\n4; 5 ;6\r\n";
+        for (int i = 0; i != 500; i++)
+            csv += "7;8;9\n";
+        mxl::csv_options opts;
+        opts.delimiter = ';';
+        opts.skip_rows = 1;
+        opts.block_size = 16;
+
+        std::istringstream is(csv);
+        matrix<long> mat1 = mxl::read_csv<long>(is, opts);
+        REQUIRE(mat1.shape() == make_pair(size_t(502), size_t(3)));
+        REQUIRE(mat1(0, 1) == 2);
+        REQUIRE(mat1(1, 0) == 4);
+        REQUIRE(mat1(501, 2) == 9);
+    }
+
+    SECTION("errors") {
+        REQUIRE_THROWS_AS(mxl::parse<int>("1, 2\n3\n"), std::domain_error);
+        REQUIRE_THROWS_AS(mxl::parse<int>("1, x\n"), std::runtime_error);
+        REQUIRE_THROWS_AS(mxl::parse<int>("1.5\n"), std::runtime_error);
+        REQUIRE_THROWS_AS(mxl::read_csv<int>("does_not_exist.csv"), std::runtime_error);
+    }
+}
+
+TEST_CASE("Testing Matrix Market I/O", "[io]") {
+    matrix<double> mat1 = {{1.5, 0, 3},
+                           {0, -2, 0}};
+
+    SECTION("array and coordinate round trips") {
+        for (auto format: {mxl::mtx_format::array, mxl::mtx_format::coordinate}) {
+            std::stringstream ss;
+            mxl::save_mtx(mat1, ss, format);
+            matrix<double> loaded = mxl::load_mtx<double>(ss);
+            REQUIRE(loaded.is_transposed() == false);
+            REQUIRE((loaded == mat1) == true);
+        }
+
+        // Reading starts where the stream is, not at its beginning.
+        std::stringstream prefixed;
+        prefixed << "a line of another format\n";
+        mxl::save_mtx(mat1, prefixed);
+        std::string skipped;
+        std::getline(prefixed, skipped);
+        REQUIRE((mxl::load_mtx<double>(prefixed) == mat1) == true);
+
+        matrix<float> mat2(400, 300, mxl::normal(), 8);
+        const string path = "mxl_test_matrix.mtx";
+        mxl::save_mtx(mat2, path);
+        REQUIRE((mxl::load_mtx<float>(path, 4) == mat2) == true);
+        std::remove(path.c_str());
+    }
+
+    SECTION("reading foreign files") {
+        std::istringstream coord("%%MatrixMarket matrix coordinate integer symmetric\n"
+                                 "% a comment\n"
+                                 "3 3 3\n"
+                                 "1 1 4\n"
+                                 "3 1 -1\n"
+                                 "2 2 5\n");
+        matrix<int> expected1 = {{4, 0, -1}, {0, 5, 0}, {-1, 0, 0}};
+        REQUIRE((mxl::load_mtx<int>(coord) == expected1) == true);
+
+        std::istringstream pattern("%%MatrixMarket matrix coordinate pattern general\n2 3 2\n1 3\n2 1\n");
+        matrix<int> expected2 = {{0, 0, 1}, {1, 0, 0}};
+        REQUIRE((mxl::load_mtx<int>(pattern) == expected2) == true);
+
+        std::istringstream skew("%%MatrixMarket matrix array real skew-symmetric\n3 3\n1\n2\n3\n");
+        matrix<double> expected3 = {{0, -1, -2}, {1, 0, -3}, {2, 3, 0}};
+        REQUIRE((mxl::load_mtx<double>(skew) == expected3) == true);
+    }
+
+    SECTION("errors") {
+        std::istringstream complex("%%MatrixMarket matrix array complex general\n1 1\n1 0\n");
+        REQUIRE_THROWS_AS(mxl::load_mtx<double>(complex), std::runtime_error);
+        std::istringstream short_file("%%MatrixMarket matrix array real general\n2 2\n1\n2\n3\n");
+        REQUIRE_THROWS_AS(mxl::load_mtx<double>(short_file), std::runtime_error);
+        std::istringstream out_of_range("%%MatrixMarket matrix coordinate real general\n2 2 1\n3 1 1.0\n");
+        REQUIRE_THROWS_AS(mxl::load_mtx<double>(out_of_range), std::runtime_error);
+    }
+}
+
+TEST_CASE("Testing NumPy .npy I/O", "[io]") {
+    const string path = "mxl_test_array.npy";
+
+    SECTION("round trips") {
+        matrix<float> mat1(33, 17, mxl::uniform(), 2);
+        mxl::save_npy(mat1, path);
+        REQUIRE((mxl::load_npy<float>(path) == mat1) == true);
+
+        matrix<long> mat2 = {{1, 2, 3}, {4, 5, 6}};
+        mat2.transpose();
+        mxl::save_npy(mat2, path);
+        matrix<long> loaded = mxl::load_npy<long>(path);
+        REQUIRE(loaded.is_transposed() == true);
+        REQUIRE((loaded == mat2) == true);
+
+        mxl::matrix_view<long> view = mxl::load_npy_mapped<long>(path);
+        REQUIRE(view.is_transposed() == true);
+        REQUIRE((view.to_matrix() == mat2) == true);
+        REQUIRE_THROWS_AS(mxl::load_npy<int>(path), std::runtime_error);
+    }
+
+    SECTION("files written by NumPy") {
+        // np.save(f, np.array([[1, 2, 3], [4, 5, 6]], dtype='<i4'))
+        string header = "{'descr': '<i4', 'fortran_order': False, 'shape': (2, 3), }";
+        header.append(127 - 10 - header.size(), ' ');
+        header += '\n';
+        string file = string("\x93NUMPY\x01\x00", 8) + char(header.size()) + '\0' + header;
+        int values[] = {1, 2, 3, 4, 5, 6};
+        file.append(reinterpret_cast<const char*>(values), sizeof(values));
+
+        std::istringstream is(file);
+        matrix<int> expected = {{1, 2, 3}, {4, 5, 6}};
+        REQUIRE((mxl::load_npy<int>(is) == expected) == true);
+
+        std::istringstream bad("not numpy");
+        REQUIRE_THROWS_AS(mxl::load_npy<int>(bad), std::runtime_error);
+    }
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE("Testing out-of-core tiled matrices", "[tiled]") {
+    using mxl::tiled_matrix;
+    matrix<double> mat1(45, 30, mxl::uniform(-1, 1), 1);
+    matrix<double> mat2(30, 20, mxl::uniform(-1, 1), 2);
+    // A budget of three 8 x 8 tiles forces constant eviction.
+    const size_t budget = 3 * 8 * 8 * sizeof(double);
+    auto a = tiled_matrix<double>::from_matrix(mat1, "mxl_test_a.tiles", 16, 8, budget);
+    auto b = tiled_matrix<double>::from_matrix(mat2, "mxl_test_b.tiles", 8, 8, budget);
+
+    SECTION("conversion and element access") {
+        REQUIRE(a.tile_grid() == make_pair(size_t(3), size_t(4)));
+        REQUIRE((a.to_matrix() == mat1) == true);
+        REQUIRE(a(44, 29) == mat1(44, 29));
+
+        auto reopened = tiled_matrix<double>::open("mxl_test_b.tiles");
+        REQUIRE((reopened.to_matrix() == mat2) == true);
+        REQUIRE_THROWS_AS(tiled_matrix<float>::open("mxl_test_b.tiles"), std::runtime_error);
+    }
+
+    SECTION("multiply, add and transpose") {
+        auto product = mxl::multiply(a, b, "mxl_test_c.tiles", budget);
+        matrix<double> expected = mat1 * mat2, actual = product.to_matrix();
+        REQUIRE(actual.shape() == expected.shape());
+        for (size_t i = 0; i != 45; i++)
+            for (size_t j = 0; j != 20; j++)
+                REQUIRE(std::abs(actual(i, j) - expected(i, j)) < 1e-12);
+        REQUIRE(a.cache_stats().evictions > 0);
+
+        auto sum = mxl::add(a, a, "mxl_test_c.tiles");
+        REQUIRE((sum.to_matrix() == mat1 + mat1) == true);
+
+        auto transposed = mxl::transpose(a, "mxl_test_c.tiles");
+        REQUIRE(transposed.tile_shape() == make_pair(size_t(8), size_t(16)));
+        REQUIRE((transposed.to_matrix() == mat1.transpose_copy()) == true);
+
+        REQUIRE_THROWS_AS(mxl::multiply(b, a, "mxl_test_c.tiles"), std::domain_error);
+    }
+
+    SECTION("prefetching") {
+        a.set_prefetch(2, 3);
+        b.set_prefetch(2, 0);
+        auto product = mxl::multiply(a, b, "mxl_test_c.tiles", budget);
+        matrix<double> expected = mat1 * mat2, actual = product.to_matrix();
+        for (size_t i = 0; i != 45; i++)
+            for (size_t j = 0; j != 20; j++)
+                REQUIRE(std::abs(actual(i, j) - expected(i, j)) < 1e-12);
+
+        mxl::tile_cache_stats sa = a.cache_stats(), sb = b.cache_stats();
+        REQUIRE(sa.prefetches > 0);
+        REQUIRE(sb.prefetches == 0);
+        REQUIRE(sa.read_ns > 0);
+        REQUIRE(sa.hits + sa.misses >= 3 * 4 * 3);
+
+        auto big = tiled_matrix<double>::from_matrix(mat1, "mxl_test_d.tiles", 4, 4, 1 << 20);
+        for (size_t ti = 0; ti != big.tile_grid().first; ti++)
+            big.prefetch(ti, 0);
+        for (size_t ti = 0; ti != big.tile_grid().first; ti++)
+            REQUIRE((*big.tile(ti, 0))(0, 0) == mat1(4 * ti, 0));
+
+        // An I/O executor without threads reads the tile inside prefetch().
+        mxl::context inline_io;
+        inline_io.io = std::make_shared<mxl::thread_pool>(0);
+        mxl::context_scope scope(inline_io);
+        big.prefetch(1, 1);
+        REQUIRE((*big.tile(1, 1))(0, 0) == mat1(4, 4));
+    }
+
+    for (auto path: {"mxl_test_a.tiles", "mxl_test_b.tiles", "mxl_test_c.tiles", "mxl_test_d.tiles"})
+        std::remove(path);
+}
+
+TEST_CASE("Testing parallel execution contexts", "[context]") {
+    matrix<double> mat1(70, 45, mxl::uniform(-1, 1), 1);
+    matrix<double> mat2(45, 60, mxl::uniform(-1, 1), 2);
+    auto naive = [](const matrix<double>& a, const matrix<double>& b) {
+        matrix<double> out(a.shape().first, b.shape().second);
+        for (size_t i = 0; i != a.shape().first; i++)
+            for (size_t j = 0; j != b.shape().second; j++)
+                for (size_t k = 0; k != a.shape().second; k++)
+                    out(i, j) += a(i, k) * b(k, j);
+        return out;
+    };
+
+    mxl::context ctx(std::make_shared<mxl::thread_pool>(3));
+    REQUIRE(ctx.threads == 4);
+
+    SECTION("multiply in every layout") {
+        // Same values as mat1 and mat2, but stored column after column.
+        matrix<double> mat1_t(mat1.transpose_copy().to_2d_vec());
+        matrix<double> mat2_t(mat2.transpose_copy().to_2d_vec());
+        mat1_t.transpose();
+        mat2_t.transpose();
+
+        for (int t = 0; t != 4; t++) {
+            const matrix<double>& a = t & 1 ? mat1_t : mat1;
+            const matrix<double>& b = t & 2 ? mat2_t : mat2;
+            REQUIRE(a.is_transposed() == bool(t & 1));
+            REQUIRE(b.is_transposed() == bool(t & 2));
+            REQUIRE((mxl::multiply(a, b, ctx) == naive(mat1, mat2)) == true);
+        }
+    }
+
+    SECTION("element-wise operations and scopes") {
+        matrix<double> big(300, 400, mxl::normal(), 3);
+        matrix<double> expected = big;
+        for (auto& x: expected)
+            x *= 3.0;
+
+        mxl::context_scope scope(ctx);
+        REQUIRE(&mxl::current_context() == &ctx);
+        REQUIRE((big + big + big == expected) == true);
+        REQUIRE((big * 3.0 == expected) == true);
+        REQUIRE((big + big.transpose_copy().transpose_copy() == big * 2.0) == true);
+    }
+
+    SECTION("custom executors and deterministic chunks") {
+        struct counting_executor: mxl::executor {
+            std::atomic<int> submitted{0};
+            void submit(std::function<void()> task) override { submitted++; task(); }
+            size_t concurrency() const override { return 7; }
+        };
+        auto exec = std::make_shared<counting_executor>();
+        mxl::context custom(exec);
+        custom.deterministic = true;
+
+        std::vector<std::pair<size_t, size_t>> chunks(10);
+        std::atomic<size_t> count(0);
+        custom.parallel_for(95, 10, [&](size_t b, size_t e) { chunks[b / 10] = make_pair(b, e); count++; });
+        REQUIRE(count == 10);
+        REQUIRE(chunks[9] == make_pair(size_t(90), size_t(95)));
+        REQUIRE(exec->submitted > 0);
+        REQUIRE((mxl::multiply(mat1, mat2, custom) == naive(mat1, mat2)) == true);
+
+        // A thread cap of one keeps every chunk on the calling thread.
+        int before = exec->submitted;
+        custom.deterministic = false;
+        custom.parallel_for(95, 10, [&](size_t, size_t) { REQUIRE(exec->submitted == before); }, true, 1);
+        REQUIRE(exec->submitted == before);
+
+        REQUIRE_THROWS_AS(ctx.parallel_for(100, 1, [](size_t b, size_t) {
+            if (b > 50) throw std::runtime_error("task failed");
+        }), std::runtime_error);
+    }
+
+    SECTION("workspace reuse") {
+        mxl::workspace ws;
+        {
+            auto buf = ws.acquire(1000);
+            REQUIRE(reinterpret_cast<std::uintptr_t>(buf.as<double>()) % mxl::workspace::alignment == 0);
+        }
+        auto again = ws.acquire(500);
+        REQUIRE(ws.bytes_held() == 1000);
+        ws.trim();
+    }
+
+    SECTION("parallel first touch and pinned workers") {
+        mxl::context pinned(std::make_shared<mxl::thread_pool>(3, true));
+        mxl::context_scope scope(pinned);
+        matrix<double> big(300, 200, 1.5), copy(big), id(300, 200, mxl::identity);
+        REQUIRE(std::all_of(big.begin(), big.end(), [](double x) { return x == 1.5; }));
+        REQUIRE((copy == big) == true);
+        copy = mat1;
+        REQUIRE((copy == mat1) == true);
+        REQUIRE(id(199, 199) == 1);
+        REQUIRE(id(199, 198) == 0);
+        REQUIRE((mxl::multiply(mat1, mat2, pinned) == naive(mat1, mat2)) == true);
+
+        REQUIRE(mxl::pin_thread(-1) == false);
+#ifdef MXL_HAS_AFFINITY
+        REQUIRE(mxl::available_cpus().size() > 0);
+#endif
+    }
+
+    SECTION("shape errors") {
+        matrix<int> mat3(2, 3), mat4(3, 2);
+        REQUIRE_THROWS_AS(mat3 += mat4, std::domain_error);
+        REQUIRE_THROWS_AS(mat3 *= mat3, std::domain_error);
+    }
+}
+
+TEST_CASE("Testing work-stealing task graphs", "[tasks]") {
+    mxl::context ctx(std::make_shared<mxl::thread_pool>(3));
+
+    SECTION("tiled multiply pipeline") {
+        matrix<long> a(50, 37), b(37, 45);
+        for (size_t i = 0; i != 50; i++)
+            for (size_t j = 0; j != 37; j++)
+                a(i, j) = long(i * 7 + j * 3) % 11 - 5;
+        for (size_t i = 0; i != 37; i++)
+            for (size_t j = 0; j != 45; j++)
+                b(i, j) = long(i * 5 + j) % 13 - 6;
+
+        mxl::block_grid<long> ga(a, 16, 10), gb(b, 10, 12), gc(matrix<long>(50, 45), 16, 12);
+        REQUIRE(ga.grid() == make_pair(size_t(4), size_t(4)));
+        REQUIRE(ga(3, 3).shape() == make_pair(size_t(2), size_t(7)));
+        REQUIRE((ga.to_matrix() == a) == true);
+
+        // C(i, j) += A(i, k) * B(k, j), each update waiting for the previous k.
+        mxl::task_graph g;
+        for (size_t i = 0; i != gc.grid().first; i++)
+            for (size_t j = 0; j != gc.grid().second; j++) {
+                std::vector<mxl::task_graph::task_id> last;
+                for (size_t k = 0; k != ga.grid().second; k++)
+                    last = {g.add([&, i, j, k] { gc(i, j) += ga(i, k) * gb(k, j); }, last)};
+            }
+        REQUIRE(g.size() == 64);
+        g.run(ctx);
+        REQUIRE((gc.to_matrix() == a * b) == true);
+    }
+
+    SECTION("dependencies are respected") {
+        mxl::task_graph g;
+        std::atomic<int> clock(0);
+        std::vector<int> stamp(200, -1);
+        for (int t = 0; t != 200; t++) {
+            std::vector<mxl::task_graph::task_id> deps;
+            if (t >= 2) deps = {size_t(t / 2), size_t(t - 1)};
+            g.add([&, t] { stamp[t] = clock++; }, deps);
+        }
+        for (int run = 0; run != 3; run++) {
+            g.run(ctx);
+            for (int t = 2; t != 200; t++) {
+                REQUIRE(stamp[t] > stamp[t / 2]);
+                REQUIRE(stamp[t] > stamp[t - 1]);
+            }
+        }
+
+        mxl::task_graph wide;
+        std::atomic<int> done(0);
+        auto root = wide.add([] {});
+        for (int t = 0; t != 1000; t++)
+            wide.add([&] { done++; }, {root});
+        wide.run(ctx);
+        wide.run(mxl::context(std::make_shared<mxl::thread_pool>(0)));
+        REQUIRE(done == 2000);
+
+        // Idle workers sleep through each slow link and wake for its leaves.
+        mxl::task_graph chain;
+        std::atomic<int> leaves(0);
+        auto link = chain.add([] {});
+        for (int t = 0; t != 5; t++) {
+            link = chain.add([] { std::this_thread::sleep_for(std::chrono::milliseconds(2)); }, {link});
+            for (int l = 0; l != 8; l++)
+                chain.add([&] { leaves++; }, {link});
+        }
+        chain.run(ctx);
+        REQUIRE(leaves == 40);
+    }
+
+    SECTION("errors") {
+        mxl::task_graph g;
+        REQUIRE_THROWS_AS(g.add([] {}, {0}), std::out_of_range);
+        std::atomic<int> ran(0);
+        auto bad = g.add([] { throw std::runtime_error("tile failed"); });
+        for (int t = 0; t != 10; t++)
+            g.add([&] { ran++; }, {bad});
+        REQUIRE_THROWS_AS(g.run(ctx), std::runtime_error);
+        REQUIRE(ran == 0);
+        REQUIRE_THROWS_AS(mxl::block_grid<int>(matrix<int>(2, 2), 0, 1), std::domain_error);
+    }
+}
+
+TEST_CASE("Testing asynchronous operations", "[async]") {
+    matrix<double> mat1(40, 30, mxl::uniform(-1, 1), 1);
+    matrix<double> mat2(30, 20, mxl::uniform(-1, 1), 2);
+    mxl::context ctx(std::make_shared<mxl::thread_pool>(2));
+
+    SECTION("futures") {
+        auto product = mxl::multiply_async(mat1, mat2, ctx);
+        auto sum = mxl::add_async(mat1, mat1, ctx);
+        auto bad = mxl::multiply_async(mat1, mat1, ctx);
+        REQUIRE((product.get() == mat1 * mat2) == true);
+        REQUIRE((sum.get() == mat1 + mat1) == true);
+        REQUIRE_THROWS_AS(bad.get(), std::domain_error);
+
+        // An executor without threads runs the work before returning.
+        mxl::context inline_ctx(std::make_shared<mxl::thread_pool>(0));
+        auto now = mxl::run_async([] { return 42; }, inline_ctx);
+        REQUIRE(now.wait_for(std::chrono::seconds(0)) == std::future_status::ready);
+        REQUIRE(now.get() == 42);
+    }
+
+    SECTION("callbacks") {
+        std::promise<matrix<double>> done;
+        std::promise<bool> failed;
+        mxl::run_async([&] { return mat1 * mat2; }, [&](std::future<matrix<double>> r) {
+            done.set_value(r.get());
+        }, ctx);
+        mxl::run_async([] { throw std::runtime_error("no"); }, [&](std::future<void> r) {
+            try { r.get(); failed.set_value(false); } catch (const std::runtime_error&) { failed.set_value(true); }
+        }, ctx);
+        REQUIRE((done.get_future().get() == mat1 * mat2) == true);
+        REQUIRE(failed.get_future().get() == true);
+    }
+
+    SECTION("file I/O") {
+        auto io_ctx = ctx;
+        io_ctx.io = std::make_shared<mxl::thread_pool>(1);
+        mxl::save_async(mat1, "async_test.mxl", io_ctx).get();
+        mxl::save_npy_async(mat2, "async_test.npy", io_ctx).get();
+        auto a = mxl::load_async<double>("async_test.mxl", io_ctx);
+        auto b = mxl::load_npy_async<double>("async_test.npy", io_ctx);
+        REQUIRE((a.get() == mat1) == true);
+        REQUIRE((b.get() == mat2) == true);
+        REQUIRE_THROWS_AS(mxl::load_async<double>("async_missing.mxl", io_ctx).get(), std::runtime_error);
+        std::remove("async_test.mxl");
+        std::remove("async_test.npy");
+    }
+}
+
+TEST_CASE("Testing cancellation and progress", "[cancel]") {
+    matrix<double> mat1(200, 150, mxl::uniform(-1, 1), 1);
+    matrix<double> mat2(150, 200, mxl::uniform(-1, 1), 2);
+    auto token = std::make_shared<mxl::cancellation_token>();
+    mxl::context serial(std::make_shared<mxl::thread_pool>(0));
+    mxl::context parallel(std::make_shared<mxl::thread_pool>(3));
+    serial.cancel = parallel.cancel = token;
+
+    SECTION("progress") {
+        std::vector<std::pair<size_t, size_t>> calls;
+        serial.progress = [&](size_t done, size_t total) { calls.emplace_back(done, total); };
+        matrix<double> product = mat1;
+        product.multiply_assign(mat2, serial);
+        REQUIRE((product == mat1 * mat2) == true);
+        // How many chunks there are depends on the algorithm chosen.
+        const size_t chunks = calls.back().second;
+        REQUIRE(chunks > 1);
+        REQUIRE(calls.size() == chunks);
+        REQUIRE(calls.back() == make_pair(chunks, chunks));
+
+        std::atomic<size_t> last(0), count(0);
+        parallel.progress = [&](size_t done, size_t) { REQUIRE(done > last); last = done; count++; };
+        product = mat1;
+        product.multiply_assign(mat2, parallel);
+        REQUIRE(count == chunks);
+        REQUIRE(last == chunks);
+    }
+
+    SECTION("cancelled operations leave their output unchanged") {
+        serial.progress = [&](size_t done, size_t) { if (done == 3) token->cancel(); };
+        matrix<double> big(1000, 200, 1.0), before = big;
+        REQUIRE_THROWS_AS(big.add_assign(big, serial), mxl::operation_cancelled);
+        REQUIRE((big == before) == true);
+        token->reset();
+        REQUIRE_THROWS_AS(big.multiply_assign(3.0, serial), mxl::operation_cancelled);
+        REQUIRE((big == before) == true);
+        token->reset();
+        matrix<double> product = mat1;
+        REQUIRE_THROWS_AS(product.multiply_assign(mat2, serial), mxl::operation_cancelled);
+        REQUIRE((product == mat1) == true);
+
+        parallel.progress = [&](size_t done, size_t) { if (done == 1) token->cancel(); };
+        token->reset();
+        REQUIRE_THROWS_AS(product.multiply_assign(mat2, parallel), mxl::operation_cancelled);
+        REQUIRE((product == mat1) == true);
+
+        // Without a cancel the same contexts run to completion.
+        token->reset();
+        serial.progress = parallel.progress = nullptr;
+        big.add_assign(big, parallel);
+        REQUIRE(big(999, 199) == 2);
+    }
+
+    SECTION("constructors and copies ignore cancellation and progress") {
+        size_t calls = 0;
+        parallel.progress = [&](size_t, size_t) { calls++; };
+        token->cancel();
+        mxl::context_scope scope(parallel);
+        matrix<int> a(200, 200, 1), b(a), c = a.transpose_copy();
+        b = c;
+        REQUIRE(b(199, 199) == 1);
+        REQUIRE(calls == 0);
+        REQUIRE_THROWS_AS(a += b, mxl::operation_cancelled);
+        token->reset();
+    }
+
+    SECTION("empty operands") {
+        // Chunks are grain-sized with a token, which must not divide by zero.
+        mxl::context_scope scope(parallel);
+        matrix<double> empty = matrix<double>() * matrix<double>();
+        REQUIRE(empty.shape() == make_pair(size_t(0), size_t(0)));
+        REQUIRE((matrix<double>(0, 5) * matrix<double>(5, 3)).shape() == make_pair(size_t(0), size_t(3)));
+        matrix<double> copy = empty;
+        REQUIRE(copy.shape() == empty.shape());
+    }
+
+    SECTION("tiled operations and task graphs") {
+        auto a = mxl::tiled_matrix<double>::from_matrix(mat1, "cancel_a.tiled", 64, 64);
+        auto b = mxl::tiled_matrix<double>::from_matrix(mat2, "cancel_b.tiled", 64, 64);
+        size_t tiles = 0;
+        serial.progress = [&](size_t done, size_t total) { tiles = total; if (done == 5) token->cancel(); };
+        {
+            mxl::context_scope scope(serial);
+            REQUIRE_THROWS_AS(mxl::multiply(a, b, "cancel_c.tiled"), mxl::operation_cancelled);
+        }
+        REQUIRE(tiles == 4 * 4 * 3);
+        REQUIRE(std::fopen("cancel_c.tiled", "rb") == nullptr);
+        std::remove("cancel_a.tiled");
+        std::remove("cancel_b.tiled");
+
+        token->reset();
+        mxl::task_graph g;
+        std::atomic<int> ran(0);
+        auto first = g.add([&] { ran++; token->cancel(); });
+        for (int t = 0; t != 20; t++)
+            g.add([&] { ran++; }, {first});
+        REQUIRE_THROWS_AS(g.run(parallel), mxl::operation_cancelled);
+        REQUIRE(ran == 1);
+    }
+}
+
+TEST_CASE("Testing instrumentation counters", "[instrument]") {
+    mxl::reset_instrumentation();
+    matrix<double> a(30, 20, 1.0), b(20, 10, mxl::identity);
+    matrix<double> c = a * b;
+    c += c;
+    std::string text = c.to_string();
+
+    auto stats = mxl::instrumentation_snapshot();
+    REQUIRE(stats.size() == 11);
+    auto find = [&](const std::string& name) {
+        return *std::find_if(stats.begin(), stats.end(), [&](const mxl::op_stats& s) { return s.name == name; });
+    };
+    if (!mxl::instrumentation_enabled()) {
+        REQUIRE(find("multiply").calls == 0);
+        return;
+    }
+    mxl::op_stats mult = find("multiply");
+    REQUIRE(mult.calls == 1);
+    REQUIRE(mult.flops == 2 * 30 * 20 * 10);
+    REQUIRE(mult.bytes_read == (600 + 200) * sizeof(double));
+    REQUIRE(mult.bytes_written == 300 * sizeof(double));
+    REQUIRE(mult.allocations >= 1);
+    REQUIRE(find("add").flops == 300);
+    REQUIRE(find("initialize_value").calls == 1);
+    REQUIRE(find("initialize_identity").calls == 1);
+    REQUIRE(find("copy").calls == 1);  // the left operand of a * b
+    REQUIRE(find("format").bytes_written == text.size());
+
+    mxl::reset_instrumentation();
+    REQUIRE(mxl::instrumentation_snapshot()[0].calls == 0);
+}
+
+TEST_CASE("Testing trace export", "[trace]") {
+    mxl::context ctx(std::make_shared<mxl::thread_pool>(2));
+    matrix<double> a(300, 200, 1.0), b(200, 100, 2.0);
+    mxl::start_tracing();
+    matrix<double> c = mxl::multiply(a, b, ctx);
+    mxl::task_graph g;
+    auto first = g.add([] {});
+    g.add([] {}, {first});
+    g.run(ctx);
+    mxl::stop_tracing();
+    matrix<double> untraced = a * b;
+
+    std::ostringstream os;
+    mxl::write_chrome_trace(os);
+    std::string trace = os.str();
+    REQUIRE(trace.find("\"traceEvents\": [") != std::string::npos);
+    REQUIRE(trace.substr(trace.size() - 4) == "\n]}\n");
+    if (mxl::tracing_enabled()) {
+        REQUIRE(trace.find("{\"name\": \"multiply\", \"cat\": \"op\", \"ph\": \"X\"") != std::string::npos);
+        REQUIRE(trace.find("{\"name\": \"multiply\", \"cat\": \"chunk\"") != std::string::npos);
+        REQUIRE(trace.find("\"args\": {\"begin\": 0, \"end\": ") != std::string::npos);
+        REQUIRE(trace.find("\"cat\": \"task\"") != std::string::npos);
+        REQUIRE(std::count(trace.begin(), trace.end(), '\n') > 4);
+    } else {
+        REQUIRE(trace.find("\"ph\"") == std::string::npos);
+    }
+
+    mxl::write_chrome_trace("mxl_test.trace.json");
+    std::ifstream in("mxl_test.trace.json");
+    REQUIRE(std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()) == trace);
+    std::remove("mxl_test.trace.json");
+}
+
+TEST_CASE("Testing hardware performance counters", "[perf]") {
+    matrix<double> a(200, 150, 1.0), b(150, 100, 2.0);
+    mxl::perf_counters pc;
+    mxl::perf_sample d = mxl::measure([&] { matrix<double> c = a * b; });
+    REQUIRE((pc.hardware_available() || !pc.error().empty()));
+    for (std::size_t k = 0; k != mxl::num_perf_events; ++k) {
+        mxl::perf_event e = static_cast<mxl::perf_event>(k);
+        if (!d.has(e))
+            REQUIRE(d[e] == 0);
+    }
+    if (d.has(mxl::perf_event::instructions))
+        REQUIRE(d[mxl::perf_event::instructions] > 2 * 200 * 150 * 100 / 4);
+    if (d.has(mxl::perf_event::cycles) && d.has(mxl::perf_event::instructions))
+        REQUIRE(d.ipc() > 0);
+    else
+        REQUIRE(d.ipc() == 0);
+
+    mxl::perf_sample later = pc.read(), earlier = later;
+    earlier.values.fill(0);
+    earlier.valid[0] = false;
+    mxl::perf_sample diff = later - earlier;
+    REQUIRE(!diff.has(mxl::perf_event::cycles));
+    for (std::size_t k = 1; k != mxl::num_perf_events; ++k)
+        REQUIRE(diff.values[k] == (later.valid[k] ? later.values[k] : 0));
+
+    bool enabled = mxl::enable_perf_instrumentation();
+    REQUIRE((enabled == (mxl::instrumentation_enabled() && pc.hardware_available())));
+    mxl::reset_instrumentation();
+    matrix<double> c = a * b;
+    if (enabled)
+        REQUIRE(mxl::instrumentation_snapshot()[0].instructions > 0);
+    else
+        REQUIRE(mxl::instrumentation_snapshot()[0].instructions == 0);
+    mxl::disable_perf_instrumentation();
+}
+
+TEST_CASE("Testing blocked multiplication and tuning", "[tuning]") {
+    mxl::cache_sizes caches = mxl::detect_cache_sizes();
+    REQUIRE(caches.l1d > 0);
+    REQUIRE(caches.l2 > 0);
+    mxl::blocking defaults = mxl::default_blocking(sizeof(double), caches);
+    REQUIRE(defaults.valid());
+    REQUIRE(defaults.mc % defaults.mr == 0);
+    REQUIRE(defaults.nc % defaults.nr == 0);
+    REQUIRE_THROWS_AS(mxl::set_blocking<double>(mxl::blocking{64, 64, 64, 3, 8}), std::domain_error);
+
+    SECTION("blocked results match the reference exactly") {
+        // Blocks smaller than the operands, so every edge case is hit, and a
+        // cost model that always picks them.
+        mxl::multiply_cost_model cm = mxl::default_cost_model(8);
+        cm.blocked_ns = cm.pack_ns = cm.setup_ns = 1e-6;
+        mxl::set_cost_model<double>(cm);
+        mxl::set_cost_model<int>(cm);
+        for (std::size_t mr: {4, 8})
+            for (std::size_t nr: {4, 8}) {
+                mxl::set_blocking<double>(mxl::blocking{12, 16, 20, mr, nr});
+                for (int layout = 0; layout != 4; layout++) {
+                    matrix<double> a(45, 37, mxl::uniform(-1, 1), 3), b(37, 53, mxl::uniform(-1, 1), 4);
+                    if (layout & 1)
+                        a = a.transpose_copy().transpose();
+                    if (layout & 2)
+                        b = b.transpose_copy().transpose();
+                    REQUIRE((a * b == mxl::reference_multiply(a, b)) == true);
+                }
+            }
+        matrix<int> a(70, 33, mxl::uniform(-9, 9), 5), b(33, 41, mxl::uniform(-9, 9), 6);
+        mxl::set_blocking<int>(mxl::blocking{8, 8, 8, 8, 4});
+        REQUIRE((a * b == mxl::reference_multiply(a, b)) == true);
+        mxl::reset_blocking<int>();
+        mxl::reset_blocking<double>();
+        mxl::reset_cost_model<int>();
+        mxl::reset_cost_model<double>();
+        REQUIRE(mxl::get_blocking<double>() == mxl::default_blocking(sizeof(double)));
+    }
+
+    SECTION("profiles") {
+        REQUIRE(hermetic_tuning);
+        {
+            std::ofstream out("mxl_test_profile.txt");
+            out << "# comment\nf64 mc=64 kc=128 nc=512 mr=8 nr=4\nf32 mc=0 kc=1\ni32 nonsense\n";
+        }
+        REQUIRE(mxl::load_tuning_profile("mxl_test_profile.txt"));
+        REQUIRE(mxl::get_blocking<double>() == mxl::blocking{64, 128, 512, 8, 4});
+        REQUIRE(mxl::get_blocking<float>() == mxl::default_blocking(sizeof(float)));
+        REQUIRE(!mxl::load_tuning_profile("mxl_no_such_profile.txt"));
+
+        mxl::set_blocking<long>(mxl::blocking{32, 64, 256, 4, 4});
+        mxl::save_tuning_profile("mxl_test_profile.txt");
+        mxl::reset_blocking<long>();
+        mxl::reset_blocking<double>();
+        REQUIRE(mxl::load_tuning_profile("mxl_test_profile.txt"));
+        REQUIRE(mxl::get_blocking<long>() == mxl::blocking{32, 64, 256, 4, 4});
+        REQUIRE(mxl::get_blocking<double>() == mxl::blocking{64, 128, 512, 8, 4});
+        mxl::reset_blocking<long>();
+        mxl::reset_blocking<double>();
+        std::remove("mxl_test_profile.txt");
+    }
+
+    SECTION("autotuning") {
+        mxl::autotune_options opts;
+        opts.size = 48;
+        opts.min_time = 0;
+        std::ostringstream log;
+        mxl::blocking tuned = mxl::autotune<float>(opts, &log);
+        REQUIRE(tuned.valid());
+        REQUIRE(mxl::get_blocking<float>() == tuned);
+        REQUIRE(log.str().find("f32 mc=") != std::string::npos);
+        mxl::reset_blocking<float>();
+    }
+}
+
+TEST_CASE("Testing algorithm selection", "[dispatch]") {
+    std::vector<mxl::multiply_algorithm> chosen;
+    mxl::set_multiply_hook([&](const mxl::multiply_plan& p) { chosen.push_back(p.algorithm); });
+    mxl::context serial(std::make_shared<mxl::thread_pool>(0));
+    mxl::context parallel(std::make_shared<mxl::thread_pool>(3));
+    REQUIRE_THROWS_AS(mxl::set_cost_model<double>(mxl::multiply_cost_model{}), std::domain_error);
+    REQUIRE(std::string(mxl::algorithm_name(mxl::multiply_algorithm::gemv)) == "gemv");
+
+    SECTION("every algorithm gives the reference result") {
+        using alg = mxl::multiply_algorithm;
+        const mxl::multiply_cost_model defaults = mxl::default_cost_model(sizeof(double));
+        // Makes one algorithm's costs negligible, so that it is picked.
+        auto only = [&](alg a) {
+            mxl::multiply_cost_model cm = defaults;
+            if (a == alg::naive) cm.naive_ns = cm.strided_ns = cm.loop_ns = 1e-6;
+            if (a == alg::unrolled) cm.unrolled_ns = 1e-6;
+            if (a == alg::gemv) cm.gemv_ns = cm.task_ns = 1e-6;
+            if (a == alg::blocked || a == alg::parallel) cm.blocked_ns = cm.pack_ns = cm.setup_ns = 1e-6;
+            if (a == alg::parallel) cm.task_ns = 1e-6;
+            mxl::set_cost_model<double>(cm);
+        };
+        const std::vector<std::pair<alg, std::vector<size_t>>> cases = {
+            {alg::naive, {37, 29, 41}}, {alg::unrolled, {40, 3, 33}}, {alg::gemv, {300, 45, 1}},
+            {alg::gemv, {1, 45, 300}}, {alg::blocked, {45, 37, 53}}, {alg::parallel, {200, 40, 30}}};
+        for (const auto& c: cases)
+            for (int layout = 0; layout != 4; layout++) {
+                only(c.first);
+                matrix<double> a(c.second[0], c.second[1], mxl::uniform(-1, 1), 7);
+                matrix<double> b(c.second[1], c.second[2], mxl::uniform(-1, 1), 8);
+                if (layout & 1)
+                    a = a.transpose_copy().transpose();
+                if (layout & 2)
+                    b = b.transpose_copy().transpose();
+                chosen.clear();
+                matrix<double> product = mxl::multiply(a, b, c.first == alg::parallel ? parallel : serial);
+                REQUIRE(chosen.size() == 1);
+                REQUIRE(chosen[0] == c.first);
+                REQUIRE((product == mxl::reference_multiply(a, b)) == true);
+            }
+        mxl::reset_cost_model<double>();
+    }
+
+    SECTION("Strassen is opt-in and close to the reference") {
+        matrix<double> a(128, 128, mxl::uniform(-1, 1), 9), b(128, 128, mxl::uniform(-1, 1), 10);
+        REQUIRE(mxl::plan_multiply(a, b, serial).algorithm != mxl::multiply_algorithm::strassen);
+        mxl::multiply_cost_model cm = mxl::default_cost_model(sizeof(double));
+        // Cheap additions, so that the recursion pays off at this size.
+        cm.strassen_min = 32;
+        cm.pack_ns = 1e-3;
+        mxl::set_cost_model<double>(cm);
+        mxl::multiply_plan plan = mxl::plan_multiply(a, b, serial);
+        REQUIRE(plan.algorithm == mxl::multiply_algorithm::strassen);
+        REQUIRE(plan.rows == 128);
+        REQUIRE(plan.predicted_ns > 0);
+        chosen.clear();
+        matrix<double> product = mxl::multiply(a, b, serial), expected = mxl::reference_multiply(a, b);
+        REQUIRE(chosen[0] == mxl::multiply_algorithm::strassen);
+        for (size_t i = 0; i != 128; i++)
+            for (size_t j = 0; j != 128; j++)
+                REQUIRE(std::abs(product(i, j) - expected(i, j)) < 1e-10);
+
+        // Integers always multiply exactly.
+        mxl::set_cost_model<int>(cm);
+        matrix<int> x(128, 128, mxl::uniform(-9, 9), 11), y(128, 128, mxl::uniform(-9, 9), 12);
+        REQUIRE(mxl::plan_multiply(x, y, serial).algorithm != mxl::multiply_algorithm::strassen);
+        mxl::reset_cost_model<int>();
+        mxl::reset_cost_model<double>();
+    }
+
+    SECTION("cost models in profiles") {
+        // Whatever profile was loaded first, f32 starts from the defaults.
+        mxl::reset_cost_model<float>();
+        {
+            std::ofstream out("mxl_test_profile.txt");
+            out << "f64 naive_ns=1 strided_ns=2 loop_ns=3 unrolled_ns=4 gemv_ns=5 blocked_ns=6 pack_ns=7 "
+                   "setup_ns=8 task_ns=9 strassen_min=64\nf32 naive_ns=1\n";
+        }
+        REQUIRE(mxl::load_tuning_profile("mxl_test_profile.txt"));
+        mxl::multiply_cost_model cm = mxl::get_cost_model<double>();
+        REQUIRE(cm.loop_ns == 3);
+        REQUIRE(cm.task_ns == 9);
+        REQUIRE(cm.strassen_min == 64);
+        REQUIRE(mxl::get_cost_model<float>().naive_ns == mxl::default_cost_model(sizeof(float)).naive_ns);
+
+        mxl::save_tuning_profile("mxl_test_profile.txt");
+        mxl::reset_cost_model<double>();
+        REQUIRE(mxl::get_cost_model<double>().strassen_min == 0);
+        REQUIRE(mxl::load_tuning_profile("mxl_test_profile.txt"));
+        REQUIRE(mxl::get_cost_model<double>().gemv_ns == 5);
+        mxl::reset_cost_model<double>();
+        std::remove("mxl_test_profile.txt");
+    }
+
+    SECTION("calibration") {
+        mxl::autotune_options opts;
+        opts.min_time = 0;
+        std::ostringstream log;
+        mxl::multiply_cost_model cm = mxl::calibrate_cost_model<float>(opts, &log);
+        REQUIRE(cm.valid());
+        REQUIRE(mxl::get_cost_model<float>().blocked_ns == cm.blocked_ns);
+        REQUIRE(log.str().find("f32 naive_ns=") != std::string::npos);
+        mxl::reset_cost_model<float>();
+    }
+    mxl::set_multiply_hook(nullptr);
+}
+
+TEST_CASE("Testing packed right operands", "[packed]") {
+    mxl::context serial(std::make_shared<mxl::thread_pool>(0));
+    mxl::context parallel(std::make_shared<mxl::thread_pool>(3));
+
+    SECTION("products match the reference exactly") {
+        // Blocks smaller than the operands, so every edge case is hit.
+        for (std::size_t mr: {4, 8})
+            for (std::size_t nr: {4, 8})
+                for (int layout = 0; layout != 4; layout++) {
+                    matrix<double> a(45, 37, mxl::uniform(-1, 1), 3), b(37, 150, mxl::uniform(-1, 1), 4);
+                    // Fewer rows than a register tile take another path.
+                    matrix<double> few(3, 37, mxl::uniform(-1, 1), 5);
+                    if (layout & 1) {
+                        a = a.transpose_copy().transpose();
+                        few = few.transpose_copy().transpose();
+                    }
+                    if (layout & 2)
+                        b = b.transpose_copy().transpose();
+                    mxl::packed_matrix<double> packed(b, mxl::blocking{12, 16, 20, mr, nr}, parallel);
+                    REQUIRE(packed.shape() == b.shape());
+                    REQUIRE(packed(36, 149) == b(36, 149));
+                    REQUIRE((mxl::multiply(a, packed, serial) == mxl::reference_multiply(a, b)) == true);
+                    REQUIRE((mxl::multiply(a, packed, parallel) == mxl::reference_multiply(a, b)) == true);
+                    REQUIRE((mxl::multiply(few, packed, serial) == mxl::reference_multiply(few, b)) == true);
+                    REQUIRE((mxl::multiply(few, packed, parallel) == mxl::reference_multiply(few, b)) == true);
+                }
+        matrix<int> a(70, 33, mxl::uniform(-9, 9), 5), b(33, 41, mxl::uniform(-9, 9), 6);
+        mxl::packed_matrix<int> packed(b);
+        REQUIRE((a * packed == a * b) == true);
+        // One input row, as in inference on a single sample.
+        matrix<int> x(1, 33, mxl::uniform(-9, 9), 7);
+        REQUIRE((x * packed == mxl::reference_multiply(x, b)) == true);
+    }
+
+    SECTION("memory, shapes and errors") {
+        matrix<float> w(10, 13, mxl::uniform(-1, 1), 8);
+        mxl::packed_matrix<float> packed(w, mxl::blocking{64, 64, 64, 4, 8});
+        // 13 columns pad to two strips of 8.
+        REQUIRE(packed.bytes() == 10 * 16 * sizeof(float));
+        REQUIRE(packed.block() == mxl::blocking{64, 64, 64, 4, 8});
+        REQUIRE_THROWS_AS(mxl::packed_matrix<float>(w, mxl::blocking{64, 64, 64, 4, 6}), std::domain_error);
+        REQUIRE_THROWS_AS(matrix<float>(3, 9) * packed, std::domain_error);
+        REQUIRE(mxl::packed_matrix<float>().bytes() == 0);
+
+        matrix<float> none(0, 10);
+        REQUIRE((none * packed).shape() == std::make_pair(size_t(0), size_t(13)));
+        mxl::packed_matrix<float> no_columns(matrix<float>(10, 0));
+        REQUIRE(no_columns.bytes() == 0);
+        REQUIRE((matrix<float>(2, 10) * no_columns).shape() == std::make_pair(size_t(2), size_t(0)));
+    }
+}